@@ -0,0 +1,195 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include "capture.h"
+
+namespace hr20 {
+
+Capture capture;
+
+namespace {
+
+// frames get added from the radio interrupt
+inline void lock() {
+#ifndef RFM_POLL_MODE
+    noInterrupts();
+#endif
+}
+
+inline void unlock() {
+#ifndef RFM_POLL_MODE
+    interrupts();
+#endif
+}
+
+void put_u16(StrMaker &s, uint16_t v) {
+    s += (char)(v & 0xFF);
+    s += (char)(v >> 8);
+}
+
+void put_u32(StrMaker &s, uint32_t v) {
+    put_u16(s, v & 0xFFFF);
+    put_u16(s, v >> 16);
+}
+
+} // namespace
+
+// NOTE: Called from the ISR, no ICACHE_FLASH_ATTR
+uint32_t Capture::add(bool tx, uint8_t addr, uint8_t rssi,
+                      const uint8_t *frame, uint8_t len)
+{
+    if (!enabled) return 0;
+    if (filter != ADDR_NONE && addr != ADDR_NONE && addr != filter) return 0;
+    if (len > MAX_FRAME) len = MAX_FRAME;
+
+    lock();
+
+    uint16_t need = HEADER + len;
+    if (stop_when_full && CAPTURE_BYTES - used < need) {
+        ++lost;
+        unlock();
+        return 0;
+    }
+
+    while (CAPTURE_BYTES - used < need) {
+        evict();
+        ++lost;
+    }
+
+    uint32_t ms = millis();
+    uint8_t hdr[HEADER] = {
+        static_cast<uint8_t>(tx ? FLAG_TX : 0), addr, rssi, len,
+        static_cast<uint8_t>(ms), static_cast<uint8_t>(ms >> 8),
+        static_cast<uint8_t>(ms >> 16), static_cast<uint8_t>(ms >> 24)};
+
+    put(hdr, HEADER);
+    put(frame, len);
+    uint32_t sq = ++seq;
+
+    unlock();
+    return sq;
+}
+
+// NOTE: Called from the ISR, no ICACHE_FLASH_ATTR
+void Capture::put(const uint8_t *data, uint8_t len) {
+    uint16_t part = CAPTURE_BYTES - head;
+    if (part > len) part = len;
+
+    memcpy(buf + head, data, part);
+    memcpy(buf, data + part, len - part);
+
+    head = (head + len) % CAPTURE_BYTES;
+    used += len;
+}
+
+// NOTE: Called from the ISR, no ICACHE_FLASH_ATTR
+void Capture::evict() {
+    uint16_t len = HEADER + byte_at(tail + 3);
+    tail = (tail + len) % CAPTURE_BYTES;
+    used -= len;
+    ++first;
+}
+
+ICACHE_FLASH_ATTR void Capture::verdict(uint32_t sq, bool ok) {
+    lock();
+
+    if (sq >= first && sq <= seq) {
+        uint16_t off = tail;
+        for (uint32_t s = first; s < sq; ++s)
+            off = (off + HEADER + byte_at(off + 3)) % CAPTURE_BYTES;
+
+        buf[off] |= ok ? FLAG_VERIFIED : FLAG_FAILED;
+    }
+
+    unlock();
+}
+
+ICACHE_FLASH_ATTR void Capture::clear() {
+    lock();
+    head = tail = used = 0;
+    first = seq + 1;
+    unlock();
+}
+
+template<typename F>
+ICACHE_FLASH_ATTR void Capture::read(F f) const {
+    uint8_t rec[HEADER + MAX_FRAME];
+
+    lock();
+    uint32_t sq  = first;
+    uint16_t off = tail;
+    unlock();
+
+    while (true) {
+        lock();
+
+        // overwritten while we were away, continue with the oldest
+        if (sq < first) {
+            sq  = first;
+            off = tail;
+        }
+
+        if (sq > seq) {
+            unlock();
+            return;
+        }
+
+        uint8_t len = HEADER + byte_at(off + 3);
+        for (uint8_t i = 0; i < len; ++i) rec[i] = byte_at(off + i);
+        off = (off + len) % CAPTURE_BYTES;
+        ++sq;
+
+        unlock();
+
+        f(rec);
+    }
+}
+
+ICACHE_FLASH_ATTR void Capture::pcap(StrMaker &s, time_t now) const {
+    // global header, little endian, microsecond timestamps
+    put_u32(s, 0xA1B2C3D4UL);
+    put_u16(s, 2);
+    put_u16(s, 4);
+    put_u32(s, 0); // GMT
+    put_u32(s, 0); // accuracy
+    put_u32(s, 3 + MAX_FRAME);
+    put_u32(s, LINKTYPE_USER0);
+
+    uint32_t now_ms = millis();
+
+    read([&](const uint8_t *rec) {
+        uint32_t ms = rec[4] | rec[5] << 8 | (uint32_t)rec[6] << 16
+                      | (uint32_t)rec[7] << 24;
+        // millis of the frame on the unix time scale
+        uint64_t at = (uint64_t)now * 1000 - (now_ms - ms);
+        uint8_t len = rec[3];
+
+        put_u32(s, at / 1000);
+        put_u32(s, (at % 1000) * 1000);
+        put_u32(s, 3 + len);
+        put_u32(s, 3 + len);
+
+        // flags, addr and rssi, then the frame
+        s += (char)rec[0];
+        s += (char)rec[1];
+        s += (char)rec[2];
+        for (uint8_t i = 0; i < len; ++i) s += (char)rec[HEADER + i];
+    });
+}
+
+} // namespace hr20
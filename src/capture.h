@@ -0,0 +1,102 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "str.h"
+
+namespace hr20 {
+
+/** Raw radio frame capture.
+ *
+ * The radio copies frames in as they are received or start being sent, so
+ * protocol problems can be looked at without VERBOSE hex dumps breaking the
+ * timing. Records are kept in a byte ring and served in pcap format.
+ *
+ * Record layout:
+ *   flags byte  - FLAG_TX, FLAG_VERIFIED, FLAG_FAILED
+ *   addr byte   - client the frame is from or replies to, ADDR_NONE on syncs
+ *   rssi byte   - % of bytes received above the RSSI threshold, 0 for TX
+ *   length byte - count of frame bytes
+ *   millis      - 4 bytes, little endian
+ *   frame       - the bytes from the length byte on, as on air
+ *
+ * With filter set, only frames of that client and syncs are kept.
+ */
+struct Capture {
+    static constexpr const uint8_t HEADER    = 8;
+    static constexpr const uint8_t MAX_FRAME = 80;
+    static constexpr const uint8_t ADDR_NONE = 0xFF;
+    // pcap link type for private use
+    static constexpr const uint32_t LINKTYPE_USER0 = 147;
+
+    enum Flags : uint8_t {
+        FLAG_TX       = 1,
+        FLAG_VERIFIED = 2, // CMAC verified
+        FLAG_FAILED   = 4  // verification failed
+    };
+
+    /// stores a frame. Returns the record's sequence number, 0 if the
+    /// frame was not kept. NOTE: Called from the ISR
+    uint32_t add(bool tx, uint8_t addr, uint8_t rssi, const uint8_t *frame,
+                 uint8_t len);
+
+    /// notes the verification result of the received frame sq
+    void verdict(uint32_t sq, bool ok);
+
+    void clear();
+
+    /// count of records kept
+    uint32_t size() const { return seq - first + 1; }
+
+    /// appends the records in pcap format. now is the current unix time,
+    /// the record timestamps are derived from it
+    void pcap(StrMaker &s, time_t now) const;
+
+    bool enabled = true;
+    // ring-full policy - keep the oldest records instead of the newest
+    bool stop_when_full = false;
+    // only frames of this client are kept, ADDR_NONE means all
+    uint8_t filter = ADDR_NONE;
+    // frames overwritten or not kept because of the full ring
+    uint32_t lost = 0;
+
+protected:
+    /// calls f(record) for every record, oldest first
+    template<typename F>
+    void read(F f) const;
+
+    uint8_t byte_at(uint16_t off) const { return buf[off % CAPTURE_BYTES]; }
+    void put(const uint8_t *data, uint8_t len);
+    void evict();
+
+    uint8_t  buf[CAPTURE_BYTES];
+    uint16_t head = 0; // write offset
+    uint16_t tail = 0; // oldest record
+    uint16_t used = 0;
+    uint32_t first = 1; // sequence number of the oldest record
+    uint32_t seq   = 0; // ...of the newest
+};
+
+// global capture instance
+extern Capture capture;
+
+} // namespace hr20
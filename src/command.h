@@ -0,0 +1,189 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "debug.h"
+#include "error.h"
+#include "model.h"
+
+namespace hr20 {
+
+/** A single change request for a client's model, already parsed and
+ *  converted. Fixed size, so a burst of incoming requests can be staged
+ *  without touching the model until the scheduler has time for it.
+ */
+struct Command {
+    enum Kind {
+        NONE = 0,
+        TEMP,         // requested temperature, value in TempHalfC units
+        AUTO,         // auto mode, value 0/1
+        LOCK,         // menu lock, value 0/1
+        EEPROM_READ,  // re-read eeprom byte at arg
+        EEPROM_WRITE, // write value to eeprom byte at arg
+        TIMER_MODE,   // timer mode, arg is day << 3 | slot
+        TIMER_TIME,   // timer time in minutes, arg is day << 3 | slot
+    };
+
+    Command() = default;
+
+    Command(uint8_t addr, Kind kind, uint16_t value = 0, uint8_t arg = 0)
+        : addr(addr), kind(kind), arg(arg), value(value)
+    {}
+
+    static uint8_t timer_arg(uint8_t day, uint8_t slot) {
+        return day << 3 | slot;
+    }
+
+    /// true if both commands change the same value
+    bool same_target(const Command &o) const {
+        return addr == o.addr && kind == o.kind && arg == o.arg;
+    }
+
+    /// applies the change to the client model. Returns false if the command
+    /// does not make sense for the model
+    ICACHE_FLASH_ATTR bool apply(HR20 &hr) const {
+        switch (kind) {
+        case TEMP:
+            hr.temp_wanted.set_requested(value);
+            hr.setpoint_ms = millis();
+            return true;
+        case AUTO:
+            hr.auto_mode.set_requested(value != 0);
+            return true;
+        case LOCK:
+            hr.menu_locked.set_requested(value != 0);
+            return true;
+        case EEPROM_READ:
+            // we unmask the value in case it was not seen since reboot
+            // and also invalidate remote in case it was already read...
+            hr.eeprom[arg].masked() = false;
+            hr.eeprom[arg].remote_valid() = false;
+            return true;
+        case EEPROM_WRITE:
+            hr.eeprom[arg].set_requested(value);
+            return true;
+        case TIMER_MODE:
+            return hr.set_timer_mode(arg >> 3, arg & 0x7, value);
+        case TIMER_TIME:
+            return hr.set_timer_time(arg >> 3, arg & 0x7, value);
+        default:
+            return false;
+        }
+    }
+
+    uint8_t  addr  = 0;
+    uint8_t  kind  = NONE;
+    uint8_t  arg   = 0; // eeprom address, timer day/slot
+    bool  chained  = false; // applied in one go with the following command
+    uint16_t value = 0;
+};
+
+/** Ring buffer of staged commands. Commands changing a value that is already
+ *  waiting in the queue replace the staged value instead of taking a new
+ *  slot, so repeated sets coalesce into the last one. Chained commands are
+ *  left out of that - they are staged and applied as a whole, in order.
+ */
+template<uint8_t LenT>
+struct CommandQ {
+    /// stages a single command. Returns false (and reports error) if full
+    ICACHE_FLASH_ATTR bool push(const Command &cmd) {
+        // the newest staged change of the value decides
+        for (uint8_t i = count; i-- > 0;) {
+            auto &c = at(i);
+            if (!c.same_target(cmd)) continue;
+
+            // coalescing into a chain would move the change to the chain's
+            // place in the queue
+            if (in_chain(i)) break;
+
+            c.value = cmd.value;
+            ++coalesced;
+            return true;
+        }
+
+        Command single = cmd;
+        single.chained = false;
+        return append(single);
+    }
+
+    /// stages all commands or none of them. The commands are chained so they
+    /// also get applied to the model together
+    ICACHE_FLASH_ATTR bool push_all(Command *cmds, uint8_t n) {
+        if (n > free_size()) {
+            ++overflows;
+            ERR_ARG(MQTT_COMMAND_QUEUE_FULL, n);
+            return false;
+        }
+
+        // never coalesced, a staged command of the same target stays in
+        // front and gets overridden when the chain is applied
+        for (uint8_t i = 0; i < n; ++i) {
+            cmds[i].chained = (i + 1) < n;
+            append(cmds[i]);
+        }
+
+        return true;
+    }
+
+    /// removes the oldest command into cmd. Returns false if empty
+    ICACHE_FLASH_ATTR bool pop(Command &cmd) {
+        if (!count) return false;
+        cmd = buf[head];
+        head = (head + 1) % LenT;
+        --count;
+        return true;
+    }
+
+    uint8_t size() const { return count; }
+    uint8_t free_size() const { return LenT - count; }
+    bool empty() const { return count == 0; }
+
+    // statistics
+    uint32_t coalesced = 0;
+    uint32_t overflows = 0;
+
+protected:
+    ICACHE_FLASH_ATTR bool append(const Command &cmd) {
+        if (count >= LenT) {
+            ++overflows;
+            ERR_ARG(MQTT_COMMAND_QUEUE_FULL, cmd.addr);
+            return false;
+        }
+
+        at(count++) = cmd;
+        return true;
+    }
+
+    /// the command at idx belongs to a chain. the last one of a chain is
+    /// only marked on its predecessor
+    bool in_chain(uint8_t idx) {
+        return at(idx).chained || (idx > 0 && at(idx - 1).chained);
+    }
+
+    Command &at(uint8_t idx) { return buf[(head + idx) % LenT]; }
+
+    Command buf[LenT];
+    uint8_t head  = 0;
+    uint8_t count = 0;
+};
+
+} // namespace hr20
@@ -52,7 +52,7 @@ private:
 #endif
 };
 
-// 2 minutes before the packet is surely discarded
+// 2 minutes without a revision before a queued packet's slot may be reused
 constexpr const time_t PACKET_DISCARD_AGE = 2*60;
 
 // Don't try re-reading every time. Skip a few packets in-between
@@ -71,6 +71,14 @@ constexpr const uint8_t MAX_HR_COUNT = 8;
 // Max. address (first invalid address, to be precise)
 constexpr const uint8_t MAX_HR_ADDR  = 30;
 
+// Client contacts closer than this (seconds) are extra exchanges during
+// forced comms, not the regular cadence link quality is measured against
+constexpr const time_t LINK_MIN_INTERVAL = 45;
+// Client is unreachable after missing this many expected contacts in a row
+constexpr const uint8_t LINK_UNREACHABLE_MISSES = 3;
+// Clients with link score below this get no fat comms and small bulk transfers
+constexpr const uint8_t LINK_POOR_SCORE = 50;
+
 // size of eeprom image, cached
 constexpr const uint16_t EEPROM_SIZE = 256;
 
@@ -93,13 +101,63 @@ constexpr const bool MQTT_RETAIN = true;
 
 // Reconnect attempt every N seconds
 constexpr const time_t MQTT_RECONNECT_TIME = 10;
-
-// Length of a log ring buffer (last N events)
-constexpr const uint16_t EVENT_LOG_LEN = 64;
+// Reconnect attempts back off up to this many seconds
+constexpr const time_t MQTT_RECONNECT_MAX = 5 * 60;
+// Timeout for a blocking connection step (DNS, TCP), in milliseconds. Has
+// to stay well below the 400 ms idle window, see HR20Master::is_idle
+constexpr const uint32_t MQTT_STEP_TIMEOUT = 100;
+// Timeout waiting for CONNACK, in seconds. Polled, does not block. Also
+// PubSubClient's limit for reading the rest of a started packet
+constexpr const uint16_t MQTT_CONNACK_TIMEOUT = 1;
+
+// Max. count of failed publishes waiting for a retry
+constexpr const uint8_t MQTT_PUBLISH_QUEUE_LEN = 16;
+// Max. queue entries failed eeprom publishes may take, a dump has 256
+constexpr const uint8_t MQTT_PUBLISH_EEPROM_SLOTS = 4;
+// Failed publish is dropped after this many retries
+constexpr const uint8_t MQTT_PUBLISH_MAX_RETRIES = 8;
+// Max. delay between publish retries, in seconds
+constexpr const time_t MQTT_PUBLISH_MAX_BACKOFF = 60;
+// Incoming set requests staged before being applied to the model
+constexpr const uint8_t MQTT_COMMAND_QUEUE_LEN = 32;
+// Max. staged set requests applied to the model per update call
+constexpr const uint8_t MQTT_COMMAND_BATCH = 8;
+// Max. json tokens in a set/batch payload
+constexpr const uint8_t MQTT_BATCH_MAX_TOKENS = 64;
+// Changed error/event counters get published this often
+constexpr const time_t MQTT_COUNTERS_INTERVAL = 60;
+
+// Size of the event log ring buffer in bytes (events take 3-4 bytes)
+constexpr const uint16_t EVENT_LOG_BYTES = 1024;
+// Every N-th event stores absolute time, others store time deltas
+constexpr const uint8_t EVENT_LOG_KEYFRAME = 8;
+
+// Persistent event journal - count and size of the segment files
+constexpr const uint8_t JOURNAL_SEGMENTS = 4;
+constexpr const uint16_t JOURNAL_SEGMENT_SIZE = 8192;
+// Events are written to flash in batches of this size...
+constexpr const uint8_t JOURNAL_BATCH = 32;
+// ...or when the oldest unwritten event waits for this many seconds
+constexpr const time_t JOURNAL_FLUSH_SECS = 60;
+
+// Size of the radio frame capture ring in bytes (frames take 8 + 10-40)
+constexpr const uint16_t CAPTURE_BYTES = 2048;
 
 // Count of events per event request
 constexpr const uint16_t MAX_JSON_EVENTS = 10;
 
+// Size of the chunks json responses are streamed in
+constexpr const uint16_t WEB_CHUNK_SIZE = 512;
+
+// Static assets may be cached by browsers for this long (seconds).
+// ETag revalidation makes updated assets visible after that
+#define WEB_STATIC_MAX_AGE "604800"
+
+// Max. count of simultaneously connected /stream clients
+constexpr const uint8_t WEB_STREAM_SLOTS = 2;
+// Keepalive comment is sent to idle /stream clients every N seconds
+constexpr const time_t WEB_STREAM_KEEPALIVE = 15;
+
 // every 4 minutes NTP is updated
 constexpr const int NTP_UPDATE_SECS = (4 * 60 * 1000);
 
@@ -0,0 +1,160 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include "counters.h"
+
+namespace hr20 {
+
+Counters counters;
+
+namespace {
+
+struct ClientCode {
+    EventType type;
+    uint8_t code;
+    bool addr_value; // the value is the client address
+};
+
+// codes counted per client. Slot index is the position here
+const ClientCode CLIENT_CODE_TABLE[] = {
+    {EventType::EVENT, (uint8_t)EventCode::PROTO_PACKET_RECEIVED, true},
+    {EventType::EVENT, (uint8_t)EventCode::PROTO_PACKET_SENDING,  true},
+    {EventType::ERROR, PROTO_BAD_CMAC,                            true},
+    {EventType::ERROR, PROTO_CANNOT_PROCESS,                      false},
+    {EventType::ERROR, PROTO_UNKNOWN_SEQUENCE,                    false},
+    {EventType::ERROR, PROTO_RESPONSE_TOO_SHORT,                  false},
+    {EventType::ERROR, PROTO_BAD_TEMP,                            false},
+    {EventType::ERROR, PROTO_BAD_TIMER,                           false},
+};
+
+static_assert(sizeof(CLIENT_CODE_TABLE) / sizeof(CLIENT_CODE_TABLE[0])
+              == Counters::CLIENT_CODES,
+              "Client code table does not match CLIENT_CODES");
+
+} // namespace
+
+ICACHE_FLASH_ATTR void Counters::count(EventType type, uint8_t code, int val) {
+#ifndef RFM_POLL_MODE
+    // errors get reported from the radio interrupt too
+    noInterrupts();
+#endif
+
+    if (type == EventType::ERROR) {
+        if (code < ERROR_CODES) {
+            inc(errors[code]);
+            set_bit(dirty, code);
+        }
+    } else if (code < EVENT_CODES) {
+        inc(events[code]);
+        set_bit(dirty, ERROR_CODES + code);
+    }
+
+    int8_t slot = client_slot(type, code);
+    if (slot >= 0) {
+        int addr = CLIENT_CODE_TABLE[slot].addr_value ? val : client;
+
+        if (addr > 0 && addr < MAX_HR_ADDR) {
+            inc(clients[addr][slot]);
+            set_bit(dirty, ERROR_CODES + EVENT_CODES
+                               + addr * CLIENT_CODES + slot);
+        }
+    }
+
+#ifndef RFM_POLL_MODE
+    interrupts();
+#endif
+}
+
+// now is only used with COUNTER_RATES
+ICACHE_FLASH_ATTR void Counters::update(time_t __attribute__((unused)) now) {
+#ifdef COUNTER_RATES
+    time_t m = now / 60;
+    if (m == minute) return;
+
+    // first call after boot has no whole minute behind it
+    bool valid = minute != 0;
+    minute = m;
+
+    for (uint8_t i = 0; i < ERROR_CODES; ++i) {
+        uint32_t d = errors[i] - error_base[i];
+        error_rates[i] = !valid ? 0 : d > 0xFFFF ? 0xFFFF : d;
+        error_base[i]  = errors[i];
+    }
+
+    for (uint8_t i = 0; i < EVENT_CODES; ++i) {
+        uint32_t d = events[i] - event_base[i];
+        event_rates[i] = !valid ? 0 : d > 0xFFFF ? 0xFFFF : d;
+        event_base[i]  = events[i];
+    }
+#endif
+}
+
+ICACHE_FLASH_ATTR bool Counters::next_dirty(uint16_t &cursor, uint8_t &addr,
+                                            EventType &type, uint8_t &code)
+{
+    for (; cursor < DIRTY_BITS; ++cursor) {
+        uint8_t mask = 1 << (cursor % 8);
+        if (!(dirty[cursor / 8] & mask)) continue;
+
+#ifndef RFM_POLL_MODE
+        noInterrupts();
+#endif
+        dirty[cursor / 8] &= ~mask;
+#ifndef RFM_POLL_MODE
+        interrupts();
+#endif
+
+        uint16_t idx = cursor++;
+
+        if (idx < ERROR_CODES) {
+            addr = 0;
+            type = EventType::ERROR;
+            code = idx;
+        } else if (idx < ERROR_CODES + EVENT_CODES) {
+            addr = 0;
+            type = EventType::EVENT;
+            code = idx - ERROR_CODES;
+        } else {
+            idx -= ERROR_CODES + EVENT_CODES;
+            addr = idx / CLIENT_CODES;
+            slot_code(idx % CLIENT_CODES, type, code);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+ICACHE_FLASH_ATTR void Counters::slot_code(uint8_t slot, EventType &type,
+                                           uint8_t &code)
+{
+    type = CLIENT_CODE_TABLE[slot].type;
+    code = CLIENT_CODE_TABLE[slot].code;
+}
+
+ICACHE_FLASH_ATTR int8_t Counters::client_slot(EventType type, uint8_t code) {
+    for (uint8_t i = 0; i < CLIENT_CODES; ++i)
+        if (CLIENT_CODE_TABLE[i].type == type
+            && CLIENT_CODE_TABLE[i].code == code)
+            return i;
+
+    return -1;
+}
+
+} // namespace hr20
@@ -0,0 +1,129 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "error.h"
+#include "eventlog.h"
+
+namespace hr20 {
+
+/** Occurrence counters of every error and event code.
+ *
+ * The event log only holds the last few hundred entries, these keep the
+ * totals since boot. Counters saturate instead of wrapping around.
+ *
+ * Protocol codes are counted per client too. The client is taken from the
+ * value for the codes that carry the address, otherwise from the packet the
+ * protocol is processing at the moment (see Client).
+ *
+ * Changed counters are flagged dirty, so the mqtt publisher can publish just
+ * these. With COUNTER_RATES, the count of the last whole minute is kept too.
+ */
+struct Counters {
+    // code ranges, see ErrorCode and EventCode
+    static constexpr const uint8_t ERROR_CODES = 80;
+    static constexpr const uint8_t EVENT_CODES = 64;
+    // codes counted per client, see client_slot()
+    static constexpr const uint8_t CLIENT_CODES = 8;
+    // dirty flags (and next_dirty cursor values) count
+    static constexpr const uint16_t DIRTY_BITS =
+        ERROR_CODES + EVENT_CODES + MAX_HR_ADDR * CLIENT_CODES;
+
+    /// marks the client the protocol code occurrences belong to while alive
+    struct Client {
+        Client(Counters &c, uint8_t addr) : c(c) { c.client = addr; }
+        ~Client() { c.client = 0; }
+        Counters &c;
+    };
+
+    /// counts one occurrence. val is the event/error value
+    void count(EventType type, uint8_t code, int val);
+
+    /// rolls the per minute windows
+    void update(time_t now);
+
+    uint32_t get(EventType type, uint8_t code) const {
+        if (type == EventType::ERROR)
+            return code < ERROR_CODES ? errors[code] : 0;
+        return code < EVENT_CODES ? events[code] : 0;
+    }
+
+    /// per client count, 0 for codes not counted per client
+    uint32_t get(uint8_t addr, EventType type, uint8_t code) const {
+        int8_t slot = client_slot(type, code);
+        if (slot < 0 || addr >= MAX_HR_ADDR) return 0;
+        return clients[addr][slot];
+    }
+
+#ifdef COUNTER_RATES
+    /// occurrences during the last whole minute
+    uint16_t rate(EventType type, uint8_t code) const {
+        if (type == EventType::ERROR)
+            return code < ERROR_CODES ? error_rates[code] : 0;
+        return code < EVENT_CODES ? event_rates[code] : 0;
+    }
+#endif
+
+    /// finds the next dirty counter at or after cursor and clears its dirty
+    /// flag. addr is 0 for global counters. Moves cursor past the counter,
+    /// returns false if there is no dirty one up to the end
+    bool next_dirty(uint16_t &cursor, uint8_t &addr, EventType &type,
+                    uint8_t &code);
+
+    /// type and code of a client counter slot
+    static void slot_code(uint8_t slot, EventType &type, uint8_t &code);
+
+    /// index into the per client counters, -1 if not counted per client
+    static int8_t client_slot(EventType type, uint8_t code);
+
+protected:
+    static void inc(uint32_t &c) {
+        if (c != 0xFFFFFFFFUL) ++c;
+    }
+
+    static void set_bit(uint8_t *bits, uint16_t idx) {
+        bits[idx / 8] |= 1 << (idx % 8);
+    }
+
+    uint32_t errors[ERROR_CODES] = {};
+    uint32_t events[EVENT_CODES] = {};
+    uint32_t clients[MAX_HR_ADDR][CLIENT_CODES] = {};
+
+    // dirty flags: errors, then events, then clients
+    uint8_t dirty[(DIRTY_BITS + 7) / 8] = {};
+
+#ifdef COUNTER_RATES
+    uint32_t error_base[ERROR_CODES] = {};
+    uint32_t event_base[EVENT_CODES] = {};
+    uint16_t error_rates[ERROR_CODES] = {};
+    uint16_t event_rates[EVENT_CODES] = {};
+    time_t minute = 0;
+#endif
+
+    // client being processed by the protocol, 0 for none
+    uint8_t client = 0;
+};
+
+// global counters instance
+extern Counters counters;
+
+} // namespace hr20
@@ -81,17 +81,23 @@ void ICACHE_FLASH_ATTR Crypto::begin(const uint8_t *rfm_pass)
     roll(K1, K2);
 }
 
+RTC ICACHE_FLASH_ATTR Crypto::rtc_at(time_t now) {
+    RTC r;
+    r.YY = year(now)-2000;
+    r.MM = month(now);
+    r.DD = day(now);
+    r.hh = hour(now);
+    r.mm = minute(now);
+    r.ss = second(now);
+    r.DOW = (dayOfWeek(now) + 5) % 7 + 1; // dayOfWeek has sunday=1, we need monday=1
+    r.pkt_cnt = 0;
+    return r;
+}
+
 bool ICACHE_FLASH_ATTR Crypto::update(time_t now) {
     if (now != lastTime) {
         lastTime = now;
-        rtc.YY = year(now)-2000;
-        rtc.MM = month(now);
-        rtc.DD = day(now);
-        rtc.hh = hour(now);
-        rtc.mm = minute(now);
-        rtc.ss = second(now);
-        rtc.DOW = (dayOfWeek(now) + 5) % 7 + 1; // dayOfWeek has sunday=1, we need monday=1
-        rtc.pkt_cnt = 0;
+        rtc = rtc_at(now);
         return true;
     }
 
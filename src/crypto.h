@@ -200,6 +200,9 @@ struct Crypto {
     // updates the rtc if needed. Returns true if second passed
     bool update(time_t now);
 
+    // rtc as it is during the whole second now, with packet count 0
+    static RTC rtc_at(time_t now);
+
     // packet payload encrypt/decrypt function
     void encrypt_decrypt(uint8_t *data, unsigned size);
 
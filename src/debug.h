@@ -19,10 +19,12 @@
 
 #pragma once
 
+#include "debuglog.h"
+
 #ifdef DEBUG
-#define DBGI(...) do { Serial.printf(__VA_ARGS__); } while (0)
-#define DBG(...) do { Serial.printf(__VA_ARGS__); Serial.println(); } while (0)
-// TODO: BETTER ERROR REPORTING
+// deferred, printed by debugLog.drain() in idle time
+#define DBGI(...) do { ::hr20::debugLog.log(false, __VA_ARGS__); } while (0)
+#define DBG(...) do { ::hr20::debugLog.log(true, __VA_ARGS__); } while (0)
 #else
 #define DBGI(...) do { } while (0)
 #define DBG(...) do { } while (0)
@@ -30,19 +32,12 @@
 
 #ifdef DEBUG
 inline void hex_dump(const char *prefix, const void *p, size_t size) {
-    const char *ptr = reinterpret_cast<const char *>(p);
-    DBGI("%s : [%d bytes] ", prefix, size);
-    for(;size;++ptr,--size) {
-        DBGI("%02x ", (uint8_t)*ptr);
-    }
-    DBG(".");
+    DBG("%s : [%d bytes] %s.", prefix, size, ::hr20::DebugLog::Hex{p, size});
 }
 #else
 inline void hex_dump(const char *prefix, const void *p, size_t size) {}
 #endif
 
-// TODO: Use variadic template to skip over temporary buffer usage for DBG macros
-
 // Use this to make master more verbose
-// * NOTE: it might run into timing issues with clients then
+// * NOTE: it might fill the debug log faster than it drains then
 // #define VERBOSE
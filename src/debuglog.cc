@@ -0,0 +1,219 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include "debuglog.h"
+
+namespace hr20 {
+
+DebugLog debugLog;
+
+namespace {
+
+uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+} // namespace
+
+ICACHE_FLASH_ATTR void DebugLog::append(const Record &rec) {
+#ifndef RFM_POLL_MODE
+    // called from the radio interrupt too
+    noInterrupts();
+#endif
+
+    if (BYTES - used < rec.len + 1) {
+        ++lost;
+    } else {
+        buf[head] = rec.len;
+        for (uint8_t i = 0; i < rec.len; ++i)
+            buf[(head + 1 + i) % BYTES] = rec.data[i];
+
+        head = (head + rec.len + 1) % BYTES;
+        used += rec.len + 1;
+    }
+
+#ifndef RFM_POLL_MODE
+    interrupts();
+#endif
+}
+
+ICACHE_FLASH_ATTR void DebugLog::drain() {
+    static uint32_t reported = 0;
+    uint8_t rec[MAX_RECORD];
+
+    while (used) {
+        // the ISR moves head and used together. The oldest record itself
+        // stays put, append() only writes to the free space
+#ifndef RFM_POLL_MODE
+        noInterrupts();
+#endif
+        uint16_t tail = (head + BYTES - used) % BYTES;
+#ifndef RFM_POLL_MODE
+        interrupts();
+#endif
+        uint8_t len   = buf[tail];
+
+        for (uint8_t i = 0; i < len; ++i)
+            rec[i] = buf[(tail + 1 + i) % BYTES];
+
+#ifdef DEBUG_BINARY
+        if (Serial.availableForWrite() < len + 2) return;
+
+        Serial.write(FRAME_START);
+        Serial.write(len);
+        Serial.write(rec, len);
+#else
+        char line[MAX_LINE];
+        uint8_t n = format(rec, len, line);
+
+        // waiting for space in the FIFO would block the loop
+        if (Serial.availableForWrite() < n) return;
+
+        Serial.write(line, n);
+#endif
+
+#ifndef RFM_POLL_MODE
+        noInterrupts();
+#endif
+        used -= len + 1;
+#ifndef RFM_POLL_MODE
+        interrupts();
+#endif
+    }
+
+    if (lost != reported) {
+        uint32_t cnt = lost - reported;
+        reported = lost;
+        log(true, "(DBG LOST %u)", cnt);
+    }
+}
+
+ICACHE_FLASH_ATTR uint8_t DebugLog::format(const uint8_t *rec, uint8_t len,
+                                           char *out)
+{
+    // leaves room for the newline
+    const uint8_t room = MAX_LINE - 2;
+    uint8_t n   = 0;
+    uint8_t pos = 5;
+
+    if (len < pos) return 0;
+
+    const char *fmt = reinterpret_cast<const char *>(
+        static_cast<uintptr_t>(get_u32(rec + 1)));
+
+    auto advance = [&](int printed) {
+        if (printed > 0) n = std::min<int>(room, n + printed);
+    };
+
+    while (*fmt && n < room) {
+        if (*fmt != '%') {
+            out[n++] = *fmt++;
+            continue;
+        }
+
+        // isolate the conversion spec, i.e. "%02x"
+        char spec[8];
+        uint8_t sl = 0;
+
+        spec[sl++] = *fmt++;
+        while (*fmt && sl < sizeof(spec) - 2 && strchr("-+ #0123456789.lhz", *fmt))
+            spec[sl++] = *fmt++;
+        if (*fmt) spec[sl++] = *fmt++;
+        spec[sl] = 0;
+
+        char conv = spec[sl - 1];
+        bool lmod = strchr(spec, 'l') != nullptr;
+
+        if (conv == '%') {
+            out[n++] = '%';
+            continue;
+        }
+
+        // argument did not fit the record
+        if (pos >= len) {
+            out[n++] = '?';
+            continue;
+        }
+
+        switch (rec[pos++]) {
+        case TAG_INT: {
+            uint32_t v = get_u32(rec + pos);
+            pos += 4;
+
+            switch (conv) {
+            case 'd':
+            case 'i':
+                if (lmod)
+                    advance(snprintf(out + n, room - n + 1, spec, (long)(int32_t)v));
+                else
+                    advance(snprintf(out + n, room - n + 1, spec, (int)v));
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                if (lmod)
+                    advance(snprintf(out + n, room - n + 1, spec, (unsigned long)v));
+                else
+                    advance(snprintf(out + n, room - n + 1, spec, (unsigned)v));
+                break;
+            case 'c':
+                advance(snprintf(out + n, room - n + 1, spec, (int)v));
+                break;
+            case 'p':
+                advance(snprintf(out + n, room - n + 1, "0x%08x", (unsigned)v));
+                break;
+            default:
+                out[n++] = '?';
+            }
+            break;
+        }
+        case TAG_STR: {
+            char str[MAX_STR + 1];
+            uint8_t sz = rec[pos++];
+            if (sz > MAX_STR) sz = MAX_STR;
+            memcpy(str, rec + pos, sz);
+            str[sz] = 0;
+            pos += sz;
+
+            advance(snprintf(out + n, room - n + 1, conv == 's' ? spec : "%s", str));
+            break;
+        }
+        case TAG_HEX: {
+            uint8_t sz = rec[pos++];
+            for (uint8_t i = 0; i < sz && n < room; ++i)
+                advance(snprintf(out + n, room - n + 1, "%02x ", rec[pos + i]));
+            pos += sz;
+            break;
+        }
+        default:
+            // unknown tag, the rest can't be decoded
+            pos = len;
+            out[n++] = '?';
+        }
+    }
+
+    if (rec[0] & FLAG_NEWLINE) {
+        out[n++] = '\r';
+        out[n++] = '\n';
+    }
+
+    return n;
+}
+
+} // namespace hr20
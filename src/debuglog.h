@@ -0,0 +1,158 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace hr20 {
+
+/** Deferred debug output.
+ *
+ * Printing at 38400 baud takes ~0.25ms per character, which is way too slow
+ * for the radio comms. Instead of formatting, log() stores the format string
+ * pointer and the raw arguments in a RAM ring. drain() formats and prints
+ * them later, when the master is idle, and only as much as fits the serial
+ * send buffer.
+ *
+ * Record layout (preceded by a length byte in the ring):
+ *   flags byte     - FLAG_NEWLINE
+ *   format pointer - 4 bytes, little endian
+ *   arguments      - tag byte, then 4 byte integer for TAG_INT, length byte
+ *                    and the bytes for TAG_STR and TAG_HEX
+ *
+ * Strings get copied (up to MAX_STR), so temporary buffers are fine as
+ * arguments. Format strings must be literals though.
+ *
+ * With DEBUG_BINARY, drain() sends the records as they are, prefixed with
+ * FRAME_START. tools/debuglog_decode.py takes the format strings from the
+ * firmware ELF and prints the text. That is even less serial traffic.
+ */
+struct DebugLog {
+    static constexpr const uint16_t BYTES      = 1024;
+    static constexpr const uint8_t  MAX_RECORD = 96;
+    static constexpr const uint8_t  MAX_STR    = 24;
+    // the UART FIFO is 128 bytes, lines have to fit
+    static constexpr const uint8_t  MAX_LINE   = 120;
+
+    static constexpr const uint8_t FRAME_START  = 0xDB;
+    static constexpr const uint8_t FLAG_NEWLINE = 1;
+
+    enum Tag : uint8_t {
+        TAG_INT = 'i',
+        TAG_STR = 's',
+        TAG_HEX = 'h'
+    };
+
+    /// byte array argument, printed as hex bytes by %s
+    struct Hex {
+        const void *data;
+        size_t size;
+    };
+
+    template<typename ...Args>
+    void log(bool newline, const char *fmt, Args... args) {
+        Record rec(newline, fmt);
+        put(rec, args...);
+        append(rec);
+    }
+
+    /// prints out stored records while they fit the serial send buffer
+    void drain();
+
+    // records dropped because the ring was full
+    uint32_t lost = 0;
+
+protected:
+    struct Record {
+        Record(bool newline, const char *fmt) {
+            data[len++] = newline ? FLAG_NEWLINE : 0;
+            put_u32(reinterpret_cast<uintptr_t>(fmt));
+        }
+
+        void put_u32(uint32_t v) {
+            if (len + 4 > MAX_RECORD) return;
+            for (uint8_t i = 0; i < 4; ++i, v >>= 8) data[len++] = v & 0xFF;
+        }
+
+        void put_bytes(Tag tag, const void *p, size_t size) {
+            if (len + 2 > MAX_RECORD) return;
+            size = std::min<size_t>(size, MAX_RECORD - len - 2);
+            data[len++] = tag;
+            data[len++] = size;
+            memcpy(data + len, p, size);
+            len += size;
+        }
+
+        uint8_t data[MAX_RECORD];
+        uint8_t len = 0;
+    };
+
+    static void put(Record &) {}
+
+    template<typename T, typename ...Rest>
+    static void put(Record &rec, T arg, Rest... rest) {
+        put_arg(rec, arg);
+        put(rec, rest...);
+    }
+
+    static void put_arg(Record &rec, const char *s) {
+        put_str(rec, s);
+    }
+
+    static void put_arg(Record &rec, char *s) { put_str(rec, s); }
+
+    static void put_arg(Record &rec, Hex hex) {
+        rec.put_bytes(TAG_HEX, hex.data, hex.size);
+    }
+
+    template<typename T>
+    static void put_arg(Record &rec, T *ptr) {
+        put_int(rec, reinterpret_cast<uintptr_t>(ptr));
+    }
+
+    // integers, enums and chars
+    template<typename T>
+    static void put_arg(Record &rec, T val) {
+        put_int(rec, static_cast<uint32_t>(val));
+    }
+
+    static void put_int(Record &rec, uint32_t v) {
+        if (rec.len + 5 > MAX_RECORD) return;
+        rec.data[rec.len++] = TAG_INT;
+        rec.put_u32(v);
+    }
+
+    static void put_str(Record &rec, const char *s) {
+        rec.put_bytes(TAG_STR, s, s ? strnlen(s, MAX_STR) : 0);
+    }
+
+    void append(const Record &rec);
+
+    /// formats record into text, returns its length
+    static uint8_t format(const uint8_t *rec, uint8_t len, char *out);
+
+    uint8_t  buf[BYTES];
+    uint16_t head = 0; // write offset
+    uint16_t used = 0; // bytes used
+};
+
+// global debug log instance
+extern DebugLog debugLog;
+
+} // namespace hr20
@@ -21,6 +21,8 @@
 
 #include "error.h"
 #include "eventlog.h"
+#include "counters.h"
+#include "debuglog.h"
 
 namespace hr20 {
 
@@ -29,6 +31,7 @@ ICACHE_FLASH_ATTR const char * err_to_str(ErrorCode err) {
     switch (err) {
         HANDLE(QUEUE_FULL);
         HANDLE(QUEUE_PREPARE_WHILE_SEND);
+        HANDLE(QUEUE_EVICTED);
 
         HANDLE(WIFI_CANNOT_CONNECT);
 
@@ -64,6 +67,9 @@ ICACHE_FLASH_ATTR const char * err_to_str(ErrorCode err) {
         HANDLE(MQTT_CALLBACK_BAD_ADDR);
         HANDLE(MQTT_CANT_PUBLISH);
         HANDLE(MQTT_INVALID_TOPIC_VALUE);
+        HANDLE(MQTT_PUBLISH_DROPPED);
+        HANDLE(MQTT_COMMAND_QUEUE_FULL);
+        HANDLE(MQTT_INVALID_BATCH);
 
         HANDLE(NTP_CANNOT_SYNC);
 
@@ -74,13 +80,10 @@ ICACHE_FLASH_ATTR const char * err_to_str(ErrorCode err) {
 }
 
 void ICACHE_FLASH_ATTR report_error(ErrorCode err, int val) {
-    Serial.write("(!ERR ");
-//    Serial.print(err_to_str(err));
-    Serial.print(err);
-    Serial.print(" ");
-    Serial.print(val);
-    Serial.println("!)");
+    // reported from the radio interrupt too, printing here is too slow
+    debugLog.log(true, "(!ERR %d %d!)", err, val);
 
+    counters.count(EventType::ERROR, err, val);
     eventLog.append(EventType::ERROR, err, val);
 }
 
@@ -32,6 +32,8 @@ enum ErrorCode {
     QUEUE_FULL = 1,
     // Can't prepare packet to be sent while another is being sent already
     QUEUE_PREPARE_WHILE_SEND,
+    // Queue was full, dropped a lower priority packet for a new one
+    QUEUE_EVICTED,
 
     // ========== WIFI ==========
     // Bad wifi settings, starting config interface
@@ -85,6 +87,12 @@ enum ErrorCode {
     MQTT_CALLBACK_BAD_ADDR,
     MQTT_CANT_PUBLISH,
     MQTT_INVALID_TOPIC_VALUE,
+    // Publish retry queue full or retries exhausted, value was not published
+    MQTT_PUBLISH_DROPPED,
+    // Incoming command queue full, set request was dropped
+    MQTT_COMMAND_QUEUE_FULL,
+    // Malformed set/batch payload, whole batch was ignored
+    MQTT_INVALID_BATCH,
 
     // ========== NTP ==========
     // NTP errors
@@ -18,11 +18,170 @@
  */
 
 #include "eventlog.h"
+#include "counters.h"
 
 namespace hr20 {
 
 EventLog eventLog;
 
+namespace {
+
+// LEB128 style varint. returns the count of bytes written
+uint8_t put_varint(uint8_t *p, uint32_t v) {
+    uint8_t len = 0;
+    while (v >= 0x80) {
+        p[len++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    p[len++] = v;
+    return len;
+}
+
+// time deltas may be negative when the clock gets adjusted
+uint32_t zigzag(int32_t v) { return (v << 1) ^ (v >> 31); }
+int32_t unzigzag(uint32_t v) { return (v >> 1) ^ -(int32_t)(v & 1); }
+
+} // namespace
+
+ICACHE_FLASH_ATTR void EventLog::append(EventType type, int code, int val) {
+    uint8_t rec[MAX_EVENT_BYTES];
+    uint8_t len = 0;
+
+#ifndef RFM_POLL_MODE
+    // errors get reported from the radio interrupt too
+    noInterrupts();
+#endif
+
+    uint32_t sq = seq + 1;
+    bool key    = is_keyframe(sq);
+
+    rec[len++] = (type == EventType::ERROR ? 0x80 : 0) | (code & 0x7F);
+    len += put_varint(rec + len,
+                      key ? static_cast<uint32_t>(now)
+                          : zigzag(static_cast<int32_t>(now - last_time)));
+    len += put_varint(rec + len, static_cast<uint16_t>(val));
+
+    // make room for the bytes and for the keyframe index entry
+    while ((EVENT_LOG_BYTES - used < len)
+           || (key && kf_count >= MAX_KEYFRAMES))
+        evict();
+
+    if (key) {
+        keyframes[(kf_first + kf_count) % MAX_KEYFRAMES] = head;
+        ++kf_count;
+    }
+
+    for (uint8_t i = 0; i < len; ++i)
+        buf[(head + i) % EVENT_LOG_BYTES] = rec[i];
+
+    head = (head + len) % EVENT_LOG_BYTES;
+    used += len;
+    seq = sq;
+    last_time = now;
+
+#ifndef RFM_POLL_MODE
+    interrupts();
+#endif
+}
+
+ICACHE_FLASH_ATTR void EventLog::evict() {
+    if (!kf_count) return;
+
+    uint16_t start = keyframes[kf_first];
+    uint16_t end   = kf_count > 1 ? keyframes[(kf_first + 1) % MAX_KEYFRAMES]
+                                  : head;
+
+    used -= (end + EVENT_LOG_BYTES - start) % EVENT_LOG_BYTES;
+    kf_first = (kf_first + 1) % MAX_KEYFRAMES;
+    --kf_count;
+    first += EVENT_LOG_KEYFRAME;
+}
+
+ICACHE_FLASH_ATTR void EventLog::decode(uint16_t &off, uint32_t sq,
+                                        time_t &time, Event &ev) const
+{
+    uint8_t hdr = byte_at(off++);
+    ev.type = (hdr & 0x80) ? EventType::ERROR : EventType::EVENT;
+    ev.code = hdr & 0x7F;
+
+    uint32_t v[2] = {0, 0};
+    for (auto &val : v) {
+        uint8_t shift = 0;
+        uint8_t b;
+        do {
+            b = byte_at(off++);
+            val |= static_cast<uint32_t>(b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+    }
+
+    off %= EVENT_LOG_BYTES;
+
+    time = is_keyframe(sq) ? static_cast<time_t>(v[0])
+                           : time + unzigzag(v[0]);
+    ev.time  = time;
+    ev.value = v[1];
+}
+
+ICACHE_FLASH_ATTR bool EventLog::get(uint32_t sq, Event &ev) const {
+    Reader r(*this, sq);
+    if (r.seq() != sq) return false;
+    return r.next(ev);
+}
+
+// The radio interrupt appends errors, evicting the oldest block when the
+// log is full. Decoding is done with interrupts masked, so a block can't be
+// evicted (and overwritten) halfway through reading it
+
+ICACHE_FLASH_ATTR EventLog::Reader::Reader(const EventLog &log, uint32_t sq)
+    : log(log), sq(sq)
+{
+#ifndef RFM_POLL_MODE
+    noInterrupts();
+#endif
+
+    // overwritten already, start with the oldest we have
+    if (this->sq < log.first) this->sq = log.first;
+
+    if (this->sq > log.seq) {
+        // not appended yet - this is where the next event goes
+        offset = log.head;
+        time   = log.last_time;
+    } else {
+        // decode from the keyframe up to the requested event
+        offset = log.keyframe_offset(this->sq);
+        uint32_t k = this->sq - (this->sq - 1) % EVENT_LOG_KEYFRAME;
+        Event ev;
+        for (; k < this->sq; ++k) log.decode(offset, k, time, ev);
+    }
+
+#ifndef RFM_POLL_MODE
+    interrupts();
+#endif
+}
+
+ICACHE_FLASH_ATTR bool EventLog::Reader::next(Event &ev) {
+#ifndef RFM_POLL_MODE
+    noInterrupts();
+#endif
+
+    // checked with the interrupts masked, see above
+    bool ok = sq <= log.seq && sq >= log.first;
+    if (ok) log.decode(offset, sq, time, ev);
+
+#ifndef RFM_POLL_MODE
+    interrupts();
+#endif
+
+    if (ok) ++sq;
+    return ok;
+}
+
+ICACHE_FLASH_ATTR void append_event(EventCode code, int param) {
+    counters.count(EventType::EVENT, static_cast<uint8_t>(code), param);
+    eventLog.append(EventType::EVENT, static_cast<int>(code), param);
+}
+
 ICACHE_FLASH_ATTR const char *event_to_str(EventCode err) {
 #define HANDLE(CODE) case EventCode::CODE: return #CODE;
     switch (err) {
@@ -34,6 +193,8 @@ ICACHE_FLASH_ATTR const char *event_to_str(EventCode err) {
         HANDLE(MQTT_CALLBACK)
         HANDLE(MQTT_CONN)
         HANDLE(MQTT_SUBSCRIBE)
+        HANDLE(MQTT_PUBLISH_RETRY)
+        HANDLE(MQTT_BATCH)
         HANDLE(NTP_SYNCHRONIZED)
     default:
         return "INVALID_EVENT_CODE";
@@ -45,6 +45,8 @@ enum class EventCode {
     MQTT_CALLBACK         = 51, // mqtt callback was called
     MQTT_CONN             = 52, // (re)connected to mqtt server
     MQTT_SUBSCRIBE        = 53, // subscribed to a topic
+    MQTT_PUBLISH_RETRY    = 54, // failed publish is being retried
+    MQTT_BATCH            = 55, // batch set request staged, value is command count
     // ntp
     NTP_SYNCHRONIZED      = 60,
 };
@@ -63,85 +65,112 @@ enum ProtoCommand {
 
 ICACHE_FLASH_ATTR const char * event_to_str(EventCode err);
 
-// Event type
+// Event type. Decoded form, the log stores these packed
 struct Event {
-    EventType type;
+    EventType type = EventType::EVENT;
     uint8_t  code  = 0; // code is severity dependent, either EventCode or ErrorCode
     uint16_t value = 0;
     time_t   time  = 0;
 };
 
-// Singleton event log ring buffer
+/** Singleton event log ring buffer.
+ *
+ * Events are stored packed in a byte ring, oldest first:
+ *   header byte    - type (highest bit, set for errors) and 7 bit code
+ *   time varint    - zigzag delta to the previous event's time, absolute
+ *                    time for keyframes (every EVENT_LOG_KEYFRAME-th seq)
+ *   value varint
+ * A typical event takes 3-4 bytes. Keyframe offsets are indexed, so an
+ * event is found by decoding at most EVENT_LOG_KEYFRAME entries. Space is
+ * freed a whole keyframe block (oldest EVENT_LOG_KEYFRAME events) at a time.
+ */
 struct EventLog {
+    // worst case bytes per event - header, 5 byte time, 3 byte value
+    static constexpr const uint8_t MAX_EVENT_BYTES = 9;
+    // at least 3 bytes per event
+    static constexpr const uint16_t MAX_EVENTS = EVENT_LOG_BYTES / 3;
+    static constexpr const uint16_t MAX_KEYFRAMES =
+        MAX_EVENTS / EVENT_LOG_KEYFRAME + 2;
+
+    static_assert(EVENT_LOG_BYTES >= 2 * EVENT_LOG_KEYFRAME * MAX_EVENT_BYTES,
+                  "Event log has to fit at least two keyframe blocks");
+
     ICACHE_FLASH_ATTR void update(time_t now) {
         this->now = now;
     }
 
-    ICACHE_FLASH_ATTR void append(EventType type, int code, int val = 0) {
-        auto &slot = events[pos];
+    void append(EventType type, int code, int val = 0);
 
-        slot.type  = type;
-        slot.code  = code;
-        slot.value = val;
-        slot.time  = now;
+    /// sequence number of the newest event. Every appended event gets the
+    /// next number, first event is 1. Zero means no event yet
+    uint32_t last_seq() const { return seq; }
 
-        pos = (pos + 1) % EVENT_LOG_LEN;
-    }
-
-    struct const_iterator {
-        const_iterator(const EventLog &owner, uint16_t pos)
-            : owner(owner), pos(pos)
-        {}
+    /// sequence number of the oldest event still in the log. Greater than
+    /// last_seq() if the log is empty
+    uint32_t first_seq() const { return first; }
 
-        const Event &operator *() const {
-            return owner.events[pos % EVENT_LOG_LEN];
-        }
+    /// decodes event with given sequence number. False if not in the log
+    bool get(uint32_t sq, Event &ev) const;
 
-        const Event *operator->() const {
-            return &owner.events[pos % EVENT_LOG_LEN];
-        }
+    /// decodes events in sequence order, starting at given seq
+    struct Reader {
+        Reader(const EventLog &log, uint32_t sq);
 
-        bool operator==(const_iterator &o) {
-            return pos % EVENT_LOG_LEN == o.pos % EVENT_LOG_LEN;
-        }
+        /// decodes next event, returns false at the end or if the rest was
+        /// overwritten meanwhile
+        bool next(Event &ev);
 
-        bool operator!=(const_iterator &o) {
-            return pos % EVENT_LOG_LEN != o.pos % EVENT_LOG_LEN;
-        }
+        /// seq of the event next() returns
+        uint32_t seq() const { return sq; }
 
-        const_iterator &operator++() {
-            --pos;
-            return *this;
-        }
-
-        const EventLog &owner;
-        uint8_t  pos;
+    protected:
+        const EventLog &log;
+        uint32_t sq;
+        uint16_t offset = 0;
+        time_t time     = 0;
     };
 
-    const_iterator begin() const {
-        return {
-            *this,
-            static_cast<uint16_t>((pos + EVENT_LOG_LEN - 1) % EVENT_LOG_LEN)};
+protected:
+    friend struct Reader;
+
+    static bool is_keyframe(uint32_t sq) {
+        return (sq - 1) % EVENT_LOG_KEYFRAME == 0;
     }
 
-    const_iterator end() const {
-        uint16_t endpos = pos;
-        return {*this, endpos};
+    /// frees the oldest keyframe block
+    void evict();
+
+    /// decodes event sq at off, advances off. time is the previous event's
+    void decode(uint16_t &off, uint32_t sq, time_t &time, Event &ev) const;
+
+    /// offset of the keyframe the seq belongs to
+    uint16_t keyframe_offset(uint32_t sq) const {
+        uint16_t idx = (sq - first) / EVENT_LOG_KEYFRAME;
+        return keyframes[(kf_first + idx) % MAX_KEYFRAMES];
     }
 
-protected:
-    Event events[EVENT_LOG_LEN];
-    uint16_t pos = 0;
-    time_t now;
+    uint8_t byte_at(uint16_t off) const { return buf[off % EVENT_LOG_BYTES]; }
+
+    uint8_t  buf[EVENT_LOG_BYTES];
+    uint16_t head = 0; // write offset
+    uint16_t used = 0; // bytes used
+
+    // ring of keyframe offsets. kf_first is keyframe of seq first
+    uint16_t keyframes[MAX_KEYFRAMES];
+    uint16_t kf_first = 0;
+    uint16_t kf_count = 0;
+
+    uint32_t seq   = 0; // last appended seq
+    uint32_t first = 1; // oldest seq in the log
+    time_t last_time = 0; // time of the last appended event
+    time_t now = 0;
 };
 
 // global event log instance
 extern EventLog eventLog;
 
-// appends events only
-inline void append_event(EventCode code, int param) {
-    eventLog.append(EventType::EVENT, static_cast<int>(code), param);
-}
+// appends events only, counts them in counters too
+void append_event(EventCode code, int param);
 
 #define EVENT(CODE) \
     do { append_event(EventCode::CODE, __LINE__); } while (0)
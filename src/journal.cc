@@ -0,0 +1,289 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include <stddef.h>
+
+#include "journal.h"
+#include "debug.h"
+
+namespace hr20 {
+
+Journal journal;
+
+namespace {
+
+constexpr const size_t RECORD_SIZE = sizeof(Journal::Record);
+
+static_assert(RECORD_SIZE == 12, "Journal record has to be packed");
+static_assert(JOURNAL_SEGMENT_SIZE >= 2 * RECORD_SIZE,
+              "Journal segment has to fit at least two records");
+
+// records written to flash in one go
+constexpr const uint8_t WRITE_CHUNK = 8;
+
+// segment file name, "/j0" .. "/j9"
+struct SegmentPath {
+    SegmentPath(uint8_t segment) {
+        path[0] = '/';
+        path[1] = 'j';
+        path[2] = '0' + segment;
+        path[3] = 0;
+    }
+
+    char path[4];
+};
+
+bool read_record(File &f, size_t idx, Journal::Record &rec) {
+    if (!f.seek(idx * RECORD_SIZE)) return false;
+    if (f.read(reinterpret_cast<uint8_t *>(&rec), RECORD_SIZE) != RECORD_SIZE)
+        return false;
+    return rec.valid();
+}
+
+} // namespace
+
+static_assert(JOURNAL_SEGMENTS >= 2 && JOURNAL_SEGMENTS <= 10,
+              "Journal needs 2 to 10 segments");
+
+ICACHE_FLASH_ATTR uint8_t Journal::Record::checksum() const {
+    // nonzero seed, so a zeroed record is not valid
+    uint8_t sum = 0xA5;
+    auto *p = reinterpret_cast<const uint8_t *>(this);
+
+    for (size_t i = 0; i < offsetof(Record, check); ++i)
+        sum = ((sum << 1) | (sum >> 7)) ^ p[i];
+
+    return sum;
+}
+
+ICACHE_FLASH_ATTR void Journal::begin() {
+    uint32_t last = 0;
+    segment = 0;
+
+    // the current segment is the one with the newest record
+    for (uint8_t s = 0; s < JOURNAL_SEGMENTS; ++s) {
+        SegmentPath sp(s);
+        File f = SPIFFS.open(sp.path, "r+");
+        if (!f) continue;
+
+        size_t count = f.size() / RECORD_SIZE;
+        size_t valid = count;
+        Record rec;
+
+        // power loss during write leaves a torn record at the end
+        while (valid && !read_record(f, valid - 1, rec)) --valid;
+
+        if (valid * RECORD_SIZE != f.size()) {
+            DBG("(JOURNAL TRUNC %d %d)", s, (int)valid);
+            f.truncate(valid * RECORD_SIZE);
+        }
+
+        if (valid && rec.seq > last) {
+            last    = rec.seq;
+            segment = s;
+        }
+
+        f.close();
+    }
+
+    // the RAM log starts from seq 1 again, continue after the journal
+    base    = last;
+    flushed = 0;
+    ready   = true;
+
+    DBG("(JOURNAL %d %lu)", segment, (unsigned long)base);
+}
+
+ICACHE_FLASH_ATTR void Journal::update(time_t now) {
+    if (!ready) return;
+
+    uint32_t last = eventLog.last_seq();
+
+    if (flushed >= last) {
+        last_flush = now;
+        return;
+    }
+
+    // the RAM log got ahead of us and overwrote unwritten events
+    if (flushed + 1 < eventLog.first_seq()) {
+        lost   += eventLog.first_seq() - flushed - 1;
+        flushed = eventLog.first_seq() - 1;
+    }
+
+    if ((last - flushed < JOURNAL_BATCH)
+        && (now - last_flush < JOURNAL_FLUSH_SECS))
+        return;
+
+    SegmentPath sp(segment);
+    File f = SPIFFS.open(sp.path, "a");
+    if (!f) {
+        DBG("(JOURNAL OPEN FAIL %d)", segment);
+        return;
+    }
+
+    size_t size = f.size();
+
+    // the reader decodes with interrupts masked and stops at events the
+    // radio interrupt evicted meanwhile, those count as lost next time
+    EventLog::Reader reader(eventLog, flushed + 1);
+    Record recs[WRITE_CHUNK];
+    uint8_t cnt = 0;
+    // flash writes are slow, the idle window is not to be overrun
+    uint8_t budget = JOURNAL_BATCH;
+    Event ev;
+
+    for (bool more = true; more;) {
+        more = budget && reader.next(ev);
+        if (more) --budget;
+
+        if (more) {
+            Record &rec = recs[cnt++];
+            rec.seq   = base + reader.seq() - 1;
+            rec.time  = ev.time;
+            rec.value = ev.value;
+            rec.hdr   = (ev.type == EventType::ERROR ? 0x80 : 0) | (ev.code & 0x7F);
+            rec.check = rec.checksum();
+        }
+
+        // write out full chunks, or the rest at the end
+        if (cnt < WRITE_CHUNK && (more || !cnt)) continue;
+
+        for (uint8_t i = 0; i < cnt; ++i) {
+            if (size + RECORD_SIZE > JOURNAL_SEGMENT_SIZE) {
+                f.close();
+                rotate();
+                f    = SPIFFS.open(SegmentPath(segment).path, "a");
+                size = 0;
+                if (!f) return;
+            }
+
+            size_t len = std::min<size_t>(
+                cnt - i, (JOURNAL_SEGMENT_SIZE - size) / RECORD_SIZE);
+
+            if (f.write(reinterpret_cast<const uint8_t *>(recs + i),
+                        len * RECORD_SIZE) != len * RECORD_SIZE)
+            {
+                DBG("(JOURNAL WRITE FAIL)");
+                f.close();
+                return;
+            }
+
+            size    += len * RECORD_SIZE;
+            flushed += len;
+            i       += len - 1;
+        }
+
+        cnt = 0;
+    }
+
+    f.close();
+    last_flush = now;
+}
+
+ICACHE_FLASH_ATTR uint32_t Journal::read(uint32_t after, uint16_t limit,
+                                         const ReadCb &cb, uint32_t &missing)
+{
+    uint32_t firsts[JOURNAL_SEGMENTS];
+    bool first_read = true;
+    missing = 0;
+
+    for (uint8_t s = 0; s < JOURNAL_SEGMENTS; ++s) firsts[s] = first_seq(s);
+
+    // segments oldest first, the ones written after us have greater seqs
+    for (uint8_t n = 0; n < JOURNAL_SEGMENTS && limit; ++n) {
+        uint8_t s = (segment + 1 + n) % JOURNAL_SEGMENTS;
+        if (!firsts[s]) continue;
+
+        // everything in here is older than the cursor
+        uint8_t next = (s + 1) % JOURNAL_SEGMENTS;
+        if (s != segment && firsts[next] && firsts[next] <= after + 1) continue;
+
+        SegmentPath sp(s);
+        File f = SPIFFS.open(sp.path, "r");
+        if (!f) continue;
+
+        uint32_t count = f.size() / RECORD_SIZE;
+        Record rec;
+
+        for (uint32_t idx = find(f, count, after);
+             idx < count && limit && read_record(f, idx, rec); ++idx)
+        {
+            if (first_read && rec.seq > after + 1)
+                missing = rec.seq - after - 1;
+            first_read = false;
+
+            Event ev;
+            ev.type  = rec.hdr & 0x80 ? EventType::ERROR : EventType::EVENT;
+            ev.code  = rec.hdr & 0x7F;
+            ev.value = rec.value;
+            ev.time  = rec.time;
+
+            after = rec.seq;
+            --limit;
+
+            if (!cb(rec.seq, ev)) limit = 0;
+        }
+
+        f.close();
+    }
+
+    return after;
+}
+
+ICACHE_FLASH_ATTR uint32_t Journal::first_seq(uint8_t segment) {
+    SegmentPath sp(segment);
+    File f = SPIFFS.open(sp.path, "r");
+    if (!f) return 0;
+
+    Record rec;
+    uint32_t sq = read_record(f, 0, rec) ? rec.seq : 0;
+    f.close();
+    return sq;
+}
+
+ICACHE_FLASH_ATTR void Journal::rotate() {
+    segment = (segment + 1) % JOURNAL_SEGMENTS;
+
+    // opening for writing truncates the oldest segment
+    SegmentPath sp(segment);
+    File f = SPIFFS.open(sp.path, "w");
+    f.close();
+
+    DBG("(JOURNAL ROTATE %d)", segment);
+}
+
+ICACHE_FLASH_ATTR uint32_t Journal::find(File &f, uint32_t count,
+                                         uint32_t after)
+{
+    uint32_t lo = 0, hi = count;
+
+    // invalid records are only at the end, treat them as newer
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        Record rec;
+
+        if (read_record(f, mid, rec) && rec.seq <= after)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+} // namespace hr20
@@ -0,0 +1,100 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include <functional>
+
+#include "config.h"
+#include "eventlog.h"
+
+namespace hr20 {
+
+/** Persistent copy of the event log in SPIFFS.
+ *
+ * Events are copied from the RAM event log in batches (called from the
+ * idle window, so flash writes never delay the radio). The journal is split
+ * into JOURNAL_SEGMENTS files that are filled in turn, the oldest one gets
+ * truncated when the current one is full. This spreads the writes over the
+ * flash on top of what SPIFFS does and bounds the space used.
+ *
+ * Records have fixed size and a checksum. After power loss the torn record
+ * at the end of the current segment is cut off. Sequence numbers continue
+ * from the last one in the journal, so they stay monotonic across reboots.
+ */
+struct Journal {
+    /// record as stored in the segment files
+    struct Record {
+        uint32_t seq;
+        uint32_t time;
+        uint16_t value;
+        uint8_t  hdr;   // type bit and code, as in the RAM event log
+        uint8_t  check;
+
+        uint8_t checksum() const;
+        bool valid() const { return check == checksum(); }
+    };
+
+    /// receives journal entries. Return false to stop reading
+    using ReadCb = std::function<bool(uint32_t seq, const Event &ev)>;
+
+    /// finds the segments and the last sequence number. Needs mounted SPIFFS
+    void begin();
+
+    /// writes pending events from the RAM log, if there is enough of them or
+    /// they wait too long. Up to JOURNAL_BATCH of them per call, the rest
+    /// waits for the next one
+    void update(time_t now);
+
+    /// reads up to limit entries with seq greater than after. missing is set
+    /// to the count of entries between after and the first entry read that
+    /// are not in the journal. Returns seq of the last entry read (after if
+    /// none)
+    uint32_t read(uint32_t after, uint16_t limit, const ReadCb &cb,
+                  uint32_t &missing);
+
+    /// seq of the last entry in the journal
+    uint32_t last_seq() const { return base + flushed; }
+
+    // events dropped from the RAM log before they got written
+    uint32_t lost = 0;
+
+protected:
+    /// journal seq of the first record in the segment, 0 if empty
+    uint32_t first_seq(uint8_t segment);
+    /// switches to the next segment, truncating it
+    void rotate();
+    /// binary search for the first record with seq > after
+    uint32_t find(File &f, uint32_t count, uint32_t after);
+
+    // journal seq is base + RAM event log seq
+    uint32_t base    = 0;
+    // RAM event log seq written already
+    uint32_t flushed = 0;
+    uint8_t  segment = 0; // segment being appended to
+    time_t   last_flush = 0;
+    bool     ready = false;
+};
+
+// global journal instance
+extern Journal journal;
+
+} // namespace hr20
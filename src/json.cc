@@ -41,6 +41,7 @@ static const char *S_ERROR     PROGMEM = "error";
 
 static const char *S_LAST_SEEN  PROGMEM = "last_seen";
 static const char *S_STATE      PROGMEM = "st";
+static const char *S_LINK       PROGMEM = "lq";
 
 void append_client_attr(StrMaker &str,
                         const HR20 &client)
@@ -69,14 +70,66 @@ void append_client_attr(StrMaker &str,
     // trying to compress in a bit more extra info
     // bit 1 - needs basic values set on client (requested over mqtt)
     // bit 2 - needs to read more data from the client to be synced
+    // bit 4 - client missed the last few expected contacts
     int state = (client.needs_basic_value_sync() ? 1 : 0)
-                | (client.synced ? 0 : 2);
+                | (client.synced ? 0 : 2)
+                | (client.link.unreachable() ? 4 : 0);
 
     {
         StrMaker sm1{vb};
         sm1 += state;
         json::kv_raw(obj, S_STATE, sm1.str());
     }
+
+    // link quality score 0-100
+    {
+        StrMaker sm1{vb};
+        sm1 += client.link.score();
+        json::kv_raw(obj, S_LINK, sm1.str());
+    }
+}
+
+static const char *S_RSSI      PROGMEM = "rssi";
+static const char *S_DQD       PROGMEM = "dqd";
+static const char *S_AFC       PROGMEM = "afc";
+static const char *S_AFC_TREND PROGMEM = "afc_trend";
+static const char *S_PACKETS   PROGMEM = "packets";
+
+void append_client_radio(StrMaker &str, const HR20 &client) {
+    json::Object obj(str);
+
+    const auto &r = client.radio;
+    cvt::ValueBuffer vb;
+
+    {
+        StrMaker sm{vb};
+        sm += r.rssi();
+        json::kv_raw(obj, S_RSSI, sm.str());
+    }
+
+    {
+        StrMaker sm{vb};
+        sm += r.dqd();
+        json::kv_raw(obj, S_DQD, sm.str());
+    }
+
+    {
+        StrMaker sm{vb};
+        sm += r.afc();
+        json::kv_raw(obj, S_AFC, sm.str());
+    }
+
+    {
+        StrMaker sm{vb};
+        sm += r.afc_trend();
+        json::kv_raw(obj, S_AFC_TREND, sm.str());
+    }
+
+    {
+        StrMaker sm{vb};
+        sm += r.packets;
+        json::kv_raw(obj, S_PACKETS, sm.str());
+    }
 }
 
 void append_timer_day(StrMaker &str,
@@ -107,7 +160,7 @@ void append_timer_day(StrMaker &str,
     }
 }
 
-void append_event(StrMaker &str, const Event &ev) {
+void append_event(StrMaker &str, const Event &ev, uint32_t seq) {
     json::Object obj(str);
 
     // attributes follow.
@@ -126,6 +179,7 @@ void append_event(StrMaker &str, const Event &ev) {
     }
     json::kv_raw(obj, "value", cvt::Simple::to_str(vb, ev.value));
     json::kv_raw(obj, "time",  cvt::Simple::to_str(vb, ev.time));
+    if (seq) json::kv_raw(obj, "seq", (long)seq);
 }
 
 
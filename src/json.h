@@ -103,7 +103,9 @@ inline void kv_raw(Object &o, const T &name, const V &val) {
 
 void append_client_attr(StrMaker &str, const HR20 &client);
 void append_timer_day(StrMaker &str, const HR20 &m, uint8_t day);
-void append_event(StrMaker &s, const Event &ev);
+void append_client_radio(StrMaker &str, const HR20 &client);
+// seq is only included if nonzero
+void append_event(StrMaker &s, const Event &ev, uint32_t seq = 0);
 
 } // namespace json
 } // namespace hr20
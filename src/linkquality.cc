@@ -0,0 +1,101 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include "linkquality.h"
+
+namespace hr20 {
+
+ICACHE_FLASH_ATTR void RadioStats::add(const RxMeta &m) {
+    if (!m.samples) return;
+
+    uint16_t rssi = 1600 * m.rssi / m.samples;
+    uint16_t dqd  = 1600 * m.dqd / m.samples;
+    int16_t afc   = 256 * m.afc;
+
+    if (!packets) {
+        rssi16 = rssi;
+        dqd16  = dqd;
+        afc_fast = afc_slow = afc;
+    } else {
+        rssi16   += (static_cast<int16_t>(rssi) - rssi16) / 8;
+        dqd16    += (static_cast<int16_t>(dqd) - dqd16) / 8;
+        afc_fast += (afc - afc_fast) / 4;
+        afc_slow += (afc - afc_slow) / 32;
+    }
+
+    if (packets != 0xFFFF) ++packets;
+}
+
+ICACHE_FLASH_ATTR void LinkQuality::contact(time_t now) {
+    if (last) {
+        time_t gap = now - last;
+
+        // forced comms, the regular cadence goes on
+        if (gap < LINK_MIN_INTERVAL) return;
+
+        if (gap > 0xFFFF) gap = 0xFFFF;
+
+        if (unreachable()) {
+            // the gap spans the outage. Learn again, the client might
+            // have come back with another cadence
+            interval = 0;
+        } else if (!interval) {
+            interval = gap;
+        } else if (gap < interval + interval / 2) {
+            // longer gaps are missed contacts, update() counted those
+            interval += (static_cast<int32_t>(gap) - interval) / 4;
+        }
+    }
+
+    next_slot(false);
+    last     = now;
+    expected = now + interval;
+}
+
+ICACHE_FLASH_ATTR bool LinkQuality::update(time_t now) {
+    if (!interval || !last) return false;
+
+    bool miss = false;
+    for (uint8_t n = 0; n < WINDOW; ++n) {
+        // give the client half an interval of slack
+        if (now <= expected + interval / 2) return miss;
+
+        next_slot(true);
+        expected += interval;
+        miss = true;
+    }
+
+    // whole window missed, don't bother catching up
+    expected = now + interval;
+    return miss;
+}
+
+ICACHE_FLASH_ATTR uint8_t LinkQuality::score() const {
+    if (!slots) return 100;
+
+    // a missed contact weighs twice a failure or an unconfirmed write
+    uint16_t bad = 2 * __builtin_popcount(missed)
+                   + __builtin_popcount(failed)
+                   + __builtin_popcount(unconfirmed);
+    uint16_t total = 2 * slots;
+
+    if (bad >= total) return 0;
+    return 100 - bad * 100 / total;
+}
+
+} // namespace hr20
@@ -0,0 +1,159 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "config.h"
+
+namespace hr20 {
+
+/** Radio status sampled while a packet was received.
+ *
+ * The radio reports the status word with every received byte. The flags are
+ * counted over the packet, the AFC offset is the one at the last byte.
+ */
+struct RxMeta {
+    void clear() {
+        samples = rssi = dqd = crl = 0;
+        afc = 0;
+    }
+
+    /// folds in a status word read with a received byte
+    void sample(uint16_t st) {
+        if (samples == 0xFF) return;
+        ++samples;
+        if (st & 0x0100) ++rssi; // RFM_STATUS_RSSI
+        if (st & 0x0080) ++dqd;  // RFM_STATUS_DQD
+        if (st & 0x0040) ++crl;  // RFM_STATUS_CRL
+        // OFFS(6), OFFS(3:0) - 5 bit two's complement
+        afc = (st & 0x10) ? static_cast<int8_t>((st & 0x1F) | 0xE0)
+                          : static_cast<int8_t>(st & 0x0F);
+    }
+
+    uint8_t samples = 0; // status words sampled
+    uint8_t rssi    = 0; // ...with signal above the RSSI threshold
+    uint8_t dqd     = 0; // ...with good data quality
+    uint8_t crl     = 0; // ...with clock recovery locked
+    int8_t  afc     = 0; // AFC offset, in frequency setting steps
+};
+
+/** Radio signal statistics of a client, averaged over received packets.
+ *
+ * Averages are exponential, percentages kept in 1/16, AFC offsets in 1/256
+ * units. The AFC offset has a fast and a slow average, their difference is
+ * the trend - a valve drifting off frequency shows there well before it
+ * stops hearing the syncs.
+ */
+struct RadioStats {
+    /// folds in the metadata of a verified packet from the client
+    void add(const RxMeta &m);
+
+    /// percentage of bytes received with signal above the RSSI threshold
+    uint8_t rssi() const { return (rssi16 + 8) / 16; }
+    /// percentage of bytes received with good data quality
+    uint8_t dqd() const { return (dqd16 + 8) / 16; }
+    /// average AFC offset in frequency steps
+    float afc() const { return afc_slow / 256.0f; }
+    /// recent minus long term AFC offset average, in frequency steps
+    float afc_trend() const { return (afc_fast - afc_slow) / 256.0f; }
+
+    uint16_t packets = 0;
+
+protected:
+    uint16_t rssi16  = 0;
+    uint16_t dqd16   = 0;
+    int16_t afc_fast = 0;
+    int16_t afc_slow = 0;
+};
+
+/** Link quality of a single client.
+ *
+ * Clients talk to us in their own slot after the sync packets, so contacts
+ * come in a steady cadence. The interval between contacts is learned here,
+ * and every interval we expected a contact in is a slot in the bitmaps below
+ * (bit 0 being the current slot). A slot notes a missed contact, a CMAC
+ * failure attributed to the client and a write sent to the client that the
+ * next response did not confirm.
+ */
+struct LinkQuality {
+    // slots kept in the bitmaps
+    static constexpr const uint8_t WINDOW = 32;
+
+    /// client contacted us
+    void contact(time_t now);
+
+    /// rolls the slots of missed contacts. Returns true if a contact was missed
+    bool update(time_t now);
+
+    /// clock was stepped, expect the next contact an interval from now
+    void rebase(time_t now) {
+        if (last) last = now;
+        expected = now + interval;
+    }
+
+    /// packet with the client's address failed verification
+    void cmac_failure() { failed |= 1; }
+
+    /// sent are the writes that went out to the client now, still_needed
+    /// the ones the client has not confirmed yet. Writes sent at the last
+    /// contact that are still needed count as unconfirmed
+    void writes(uint8_t sent, uint8_t still_needed) {
+        if (pending & still_needed) unconfirmed |= 1;
+        pending = sent;
+    }
+
+    /// 0-100, 100 meaning no problems within the window
+    uint8_t score() const;
+
+    /// the last few expected contacts were all missed
+    bool unreachable() const {
+        constexpr uint32_t MASK = (1UL << LINK_UNREACHABLE_MISSES) - 1;
+        return slots >= LINK_UNREACHABLE_MISSES && (missed & MASK) == MASK;
+    }
+
+    /// the client should not be burdened with long exchanges
+    bool poor() const { return score() < LINK_POOR_SCORE; }
+
+    // learned contact interval in seconds, 0 until known
+    uint16_t interval = 0;
+    // valid slots in the bitmaps
+    uint8_t slots = 0;
+
+protected:
+    void next_slot(bool miss) {
+        missed      <<= 1;
+        failed      <<= 1;
+        unconfirmed <<= 1;
+        missed |= miss ? 1 : 0;
+        if (slots < WINDOW) ++slots;
+    }
+
+    time_t last     = 0; // last contact
+    time_t expected = 0; // next contact due
+
+    uint32_t missed      = 0;
+    uint32_t failed      = 0;
+    uint32_t unconfirmed = 0;
+
+    // writes sent at the last contact, bitmask
+    uint8_t pending = 0;
+};
+
+} // namespace hr20
@@ -25,6 +25,9 @@
 #include "debug.h"
 #include "master.h"
 #include "eventlog.h"
+#include "journal.h"
+#include "counters.h"
+#include "metrics.h"
 #include "button.h"
 #include "webserver.h"
 
@@ -62,6 +65,9 @@ void setup(void) {
     // and loads the propper config values
     webserver.begin();
 
+    // needs SPIFFS, mounted by the webserver
+    hr20::journal.begin();
+
     ntptime.begin();
     master.begin();
 
@@ -76,6 +82,7 @@ void setup(void) {
     // attaches the path's prefix to the setup value
     hr20::mqtt::Path::begin(config.mqtt_topic_prefix);
     publisher.begin();
+    webserver.set_publisher(&publisher);
 #endif
 
 #ifdef HR20_DISPLAY
@@ -84,6 +91,8 @@ void setup(void) {
 }
 
 void loop(void) {
+    hr20::loopStats.tick();
+
     // handle OTA updates as appropriate
     ArduinoOTA.handle();
 
@@ -102,12 +111,19 @@ void loop(void) {
 
     if (ntptime.isSynced()) {
         hr20::eventLog.update(now);
+        hr20::counters.update(now);
 
         bool __attribute__((unused))
             sec_pass = master.update(changed_time, ntptime.localTime());
 
         // sec_pass = second passed (once every second)
 
+        // replies for the clients to come are prepared while nobody talks
+        if (master.is_idle()) master.prepare_ahead();
+
+        // flash writes take a while, keep them out of the radio's way
+        if (master.is_idle()) hr20::journal.update(now);
+
 #ifdef MQTT
     // only update mqtt if we have a time to do so, as controlled by master
     if (master.is_idle()) publisher.update(now);
@@ -118,6 +134,10 @@ void loop(void) {
     // TODO: Eats a lot of time. display.update();
 #endif
 
+    // a client talked to us meanwhile, reply before the slow work below
+    if (ntptime.isSynced() && master.rx_complete())
+        master.update(false, ntptime.localTime());
+
     static int last_status = -1;
     int status = WiFi.status();
     if (status != last_status) {
@@ -125,6 +145,9 @@ void loop(void) {
         DBG("(WIFI %d)", status);
     }
 
+    // debug output is deferred to when the radio's not talking
+    if (!ntptime.isSynced() || master.is_idle()) hr20::debugLog.drain();
+
 #ifdef RFM_POLL_MODE
     // only update web when radio's not talking
     if (master.is_idle())
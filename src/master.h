@@ -25,6 +25,7 @@
 #include "rfm12b.h"
 #include "crypto.h"
 #include "packetqueue.h"
+#include "capture.h"
 
 namespace hr20 {
 
@@ -56,59 +57,78 @@ struct HR20Master {
         // TODO: if it's 00 or 30, we send sync
         if (sec_pass) {
             DBGI("[:%d]\n", crypto.rtc.ss);
+            // armed replies are encrypted for the second they were made for
+            if (radio.is_armed() && armed_time != now) {
+                radio.disarm();
+                queue.cancel_ahead();
+            }
             time_t curtime = time.localTime();
             proto.update(curtime, time.isSynced(), changed_time, time.cur_slew);
         }
 
         // send data/receive data as appropriate
         send();
-        receive();
+
+        // a reply prepared for the packet goes out in this very iteration
+        if (receive()) {
+            send();
+            radio.update();
+        }
+
         return sec_pass;
     }
 
-    void ICACHE_FLASH_ATTR receive() {
-        int b = radio.recv();
+    /// true once after the radio completed a packet. The main loop then
+    /// calls update() again instead of doing slow work first
+    bool ICACHE_FLASH_ATTR rx_complete() {
+        return radio.rx_complete();
+    }
+
+    /// processes a received packet, returns false if there was none
+    bool ICACHE_FLASH_ATTR receive() {
+        // the radio already waits for the next packet in the other slot
+        auto *slot = radio.received();
 
         // no data on input means we just ignore
-        if (b < 0) return;
+        if (!slot) return false;
 
-        if (!packet.push(b)) {
-            ERR(PROTO_PACKET_TOO_LONG);
-            wait_for_sync();
+        // the radio replied on its own, the queued packet is gone
+        if (slot->replied) {
+            queue.sent_ahead();
+            proto.replied(slot->data[1]);
         }
 
-        if (length == 0) {
-            length = b & ~0x80;
-            if (length == 0) {
-                ERR(PROTO_EMPTY_PACKET);
-                wait_for_sync();
-                return;
-            } else {
-#ifdef VERBOSE
-                DBG(" * Start rcv. of %d bytes", length);
-#endif
-            }
+        if (slot->error) {
+            ERR(static_cast<ErrorCode>(slot->error));
+        } else {
+            DBG("(RCV %u)", slot->data.size());
+            bool ok = proto.receive(slot->data, slot->meta);
+            capture.verdict(slot->capture_seq, ok);
         }
 
-        --length;
+        // the reply's encryption and cmac moved the packet counter on, as
+        // sending it the usual way would have
+        if (slot->replied) crypto.rtc.pkt_cnt = armed_pkt_cnt;
 
-        if (!length) {
-            DBG("(RCV %u)", packet.size());
-            // TODO: Close the RX sooner here
-            proto.receive(packet);
-            wait_for_sync();
-        }
+        radio.release(slot);
+        return true;
     }
 
     bool ICACHE_FLASH_ATTR send() {
+        // the send buffer holds a reply waiting for its packet. Anything
+        // due now takes precedence
+        if (radio.is_armed()) {
+            if (queue.peek() < 0) return false;
+            radio.disarm();
+            queue.cancel_ahead();
+        }
+
+        if (queue.sending) radio.send_to(queue.sending_addr);
+
         while (true) {
             int b = queue.peek();
 
             if (b >= 0) {
-                // when sending, we are sure to discard any prior received data
-                length = 0;
-                packet.clear();
-
                 if (radio.send(b)) {
                     queue.pop();
                 } else {
@@ -122,10 +142,43 @@ struct HR20Master {
         }
     }
 
-    void ICACHE_FLASH_ATTR wait_for_sync() {
-        length = 0;
-        packet.clear();
-        radio.wait_for_sync();
+    /** idle time work. Queues replies for clients with pending work, and
+     * encrypts the one for the client expected to talk in the next second.
+     * The radio sends that from the interrupt, see RFM12B::arm()
+     */
+    void ICACHE_FLASH_ATTR prepare_ahead() {
+        proto.queue_ahead();
+
+        // once a second, with nothing else on the radio
+        time_t next = time.localTime() + 1;
+        if (armed_time == next) return;
+        if (!radio.is_idle() || !radio.sent() || queue.sending) return;
+        armed_time = next;
+
+        uint8_t addr, length;
+        if (!proto.expected_at(time.unixTime() + 1, addr, length)) return;
+
+        // encrypted as if the client's packet was the first in that second
+        crypto::RTC now_rtc = crypto.rtc;
+        crypto.rtc = crypto::Crypto::rtc_at(next);
+        crypto.rtc.pkt_cnt = Protocol::count_after_receive(length);
+
+        // filled aside, the radio only gets a complete reply
+        uint8_t reply[RFM12B::OUT_SIZE];
+        uint8_t size = 0;
+        bool fits = true;
+        bool ok = queue.prepare_ahead(addr, [&](uint8_t b) {
+            if (size < sizeof(reply))
+                reply[size++] = b;
+            else
+                fits = false;
+        });
+        armed_pkt_cnt = crypto.rtc.pkt_cnt;
+        crypto.rtc = now_rtc;
+
+        if (!ok) return;
+        if (!fits || !radio.arm(addr, length, reply, size))
+            queue.cancel_ahead();
     }
 
     /** indicates master has no time-sensitive work
@@ -166,9 +219,10 @@ struct HR20Master {
     Model model;
     Protocol proto;
 
-    // received packet
-    RcvPacket packet;
-    int length = 0;
+    // local time of the second the armed reply is encrypted for
+    time_t armed_time = 0;
+    // packet counter after the armed reply, see receive()
+    uint8_t armed_pkt_cnt = 0;
 };
 
 } // namespace hr20
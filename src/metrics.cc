@@ -0,0 +1,321 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include "metrics.h"
+#include "counters.h"
+#include "capture.h"
+#include "debuglog.h"
+#include "journal.h"
+#include "master.h"
+
+#ifdef MQTT
+#include "mqtt.h"
+#endif
+
+namespace hr20 {
+
+LoopStats loopStats;
+
+ICACHE_FLASH_ATTR uint32_t LoopStats::percentile(uint8_t pct) const {
+    uint64_t total = 0;
+    for (auto b : buckets) total += b;
+    if (!total) return 0;
+
+    uint64_t want = (total * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (uint8_t b = 0; b < BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen >= want) return 1UL << (b + 1);
+    }
+
+    return max;
+}
+
+namespace {
+
+void header(StrMaker &s, const char *name, const char *type, const char *help)
+{
+    s += "# HELP ";
+    s += name;
+    s += ' ';
+    s += help;
+    s += "\n# TYPE ";
+    s += name;
+    s += ' ';
+    s += type;
+    s += '\n';
+}
+
+void value(StrMaker &s, unsigned long val) {
+    s += ' ';
+    s += val;
+    s += '\n';
+}
+
+void gauge(StrMaker &s, const char *name, const char *help, long val) {
+    header(s, name, "gauge", help);
+    s += name;
+    s += ' ';
+    s += val;
+    s += '\n';
+}
+
+void counter(StrMaker &s, const char *name, const char *help,
+             unsigned long val)
+{
+    header(s, name, "counter", help);
+    s += name;
+    value(s, val);
+}
+
+// microseconds as fractional seconds, the prometheus base unit
+void seconds(StrMaker &s, uint64_t us) {
+    s += ' ';
+    s += (unsigned long)(us / 1000000);
+    s += '.';
+
+    uint32_t frac = us % 1000000;
+    for (uint32_t d = 100000; d; d /= 10) s += (char)('0' + (frac / d) % 10);
+
+    s += '\n';
+}
+
+const char *code_name(EventType type, uint8_t code) {
+    return type == EventType::ERROR ? err_to_str(static_cast<ErrorCode>(code))
+                                    : event_to_str(static_cast<EventCode>(code));
+}
+
+void codes(StrMaker &s, const char *name, const char *help, EventType type,
+           uint8_t max)
+{
+    header(s, name, "counter", help);
+
+    for (uint8_t code = 0; code < max; ++code) {
+        uint32_t cnt = counters.get(type, code);
+        if (!cnt) continue;
+
+        s += name;
+        s += "{code=\"";
+        s += code_name(type, code);
+        s += "\"}";
+        value(s, cnt);
+    }
+}
+
+void client_codes(StrMaker &s, const char *name, const char *help,
+                  EventType type)
+{
+    header(s, name, "counter", help);
+
+    for (uint8_t addr = 1; addr < MAX_HR_ADDR; ++addr) {
+        for (uint8_t slot = 0; slot < Counters::CLIENT_CODES; ++slot) {
+            EventType t;
+            uint8_t code;
+            Counters::slot_code(slot, t, code);
+            if (t != type) continue;
+
+            uint32_t cnt = counters.get(addr, t, code);
+            if (!cnt) continue;
+
+            s += name;
+            s += "{addr=\"";
+            s += addr;
+            s += "\",code=\"";
+            s += code_name(t, code);
+            s += "\"}";
+            value(s, cnt);
+        }
+    }
+}
+
+void client_links(StrMaker &s, HR20Master &master) {
+    static const char *NAME = "hr20_client_link_quality";
+
+    header(s, NAME, "gauge", "Link quality score 0-100, by client");
+
+    for (uint8_t addr = 1; addr < MAX_HR_ADDR; ++addr) {
+        auto *hr = master.model[addr];
+        if (!hr || !hr->last_contact) continue;
+
+        s += NAME;
+        s += "{addr=\"";
+        s += addr;
+        s += "\"}";
+        value(s, hr->link.score());
+    }
+}
+
+// radio stats of clients we got packets from, value picked by get
+template<typename F>
+void client_radio(StrMaker &s, HR20Master &master, const char *name,
+                  const char *help, F get)
+{
+    header(s, name, "gauge", help);
+
+    for (uint8_t addr = 1; addr < MAX_HR_ADDR; ++addr) {
+        auto *hr = master.model[addr];
+        if (!hr || !hr->radio.packets) continue;
+
+        s += name;
+        s += "{addr=\"";
+        s += addr;
+        s += "\"} ";
+        s += get(hr->radio);
+        s += '\n';
+    }
+}
+
+void setpoint_latency(StrMaker &s, HR20Master &master) {
+    static const char *NAME = "hr20_client_setpoint_latency_seconds";
+
+    header(s, NAME, "gauge",
+           "Setpoint request to client confirmation, last time, by client");
+
+    for (uint8_t addr = 1; addr < MAX_HR_ADDR; ++addr) {
+        auto *hr = master.model[addr];
+        if (!hr || !hr->setpoint_latency_ms) continue;
+
+        s += NAME;
+        s += "{addr=\"";
+        s += addr;
+        s += "\"}";
+        seconds(s, hr->setpoint_latency_ms * 1000ULL);
+    }
+}
+
+void loop_latency(StrMaker &s) {
+    static const char *NAME = "hr20_loop_seconds";
+    static const uint8_t QUANTILES[] = {50, 90, 99};
+
+    header(s, NAME, "summary",
+           "Main loop iteration time (quantiles are power of 2 bounds)");
+
+    for (auto q : QUANTILES) {
+        s += NAME;
+        s += "{quantile=\"0.";
+        s += q;
+        s += "\"}";
+        seconds(s, loopStats.percentile(q));
+    }
+
+    s += NAME;
+    s += "{quantile=\"1\"}";
+    seconds(s, loopStats.max);
+
+    s += NAME;
+    s += "_sum";
+    seconds(s, loopStats.sum);
+
+    s += NAME;
+    s += "_count";
+    value(s, loopStats.count);
+}
+
+} // namespace
+
+ICACHE_FLASH_ATTR void append_metrics(StrMaker &s, HR20Master &master,
+                                      mqtt::MQTTPublisher *pub)
+{
+    // error and event totals cover packets, CMAC failures, TX underruns,
+    // QUEUE_FULL, publishes and reconnects
+    codes(s, "hr20_errors_total", "Errors reported, by code",
+          EventType::ERROR, Counters::ERROR_CODES);
+    codes(s, "hr20_events_total", "Events logged, by code",
+          EventType::EVENT, Counters::EVENT_CODES);
+    client_codes(s, "hr20_client_errors_total",
+                 "Protocol errors, by client and code", EventType::ERROR);
+    client_codes(s, "hr20_client_events_total",
+                 "Packets received and sent, by client", EventType::EVENT);
+    client_links(s, master);
+    client_radio(s, master, "hr20_client_rssi_percent",
+                 "Bytes received above the RSSI threshold, by client",
+                 [](const RadioStats &r) { return (int)r.rssi(); });
+    client_radio(s, master, "hr20_client_dqd_percent",
+                 "Bytes received with good data quality, by client",
+                 [](const RadioStats &r) { return (int)r.dqd(); });
+    client_radio(s, master, "hr20_client_afc_offset",
+                 "Average AFC offset in frequency steps, by client",
+                 [](const RadioStats &r) { return r.afc(); });
+    client_radio(s, master, "hr20_client_afc_trend",
+                 "Recent minus long term AFC offset, by client",
+                 [](const RadioStats &r) { return r.afc_trend(); });
+    setpoint_latency(s, master);
+
+    gauge(s, "hr20_packet_queue_used", "Send queue slots in use",
+          master.queue.size());
+    gauge(s, "hr20_packet_queue_max", "Send queue high-water mark",
+          master.queue.max_size);
+    gauge(s, "hr20_packet_queue_size", "Send queue slots",
+          PACKET_QUEUE_LEN);
+
+#ifdef MQTT
+    if (pub) {
+        gauge(s, "hr20_mqtt_connected", "Connected to the mqtt broker",
+              pub->conn.connected() ? 1 : 0);
+        counter(s, "hr20_mqtt_connects_total", "Successful mqtt (re)connects",
+                pub->conn.connects);
+        counter(s, "hr20_mqtt_connect_failures_total",
+                "Failed mqtt connection attempts", pub->conn.failures);
+        counter(s, "hr20_mqtt_publish_retries_total",
+                "Failed publishes retried", pub->retries.retried);
+        counter(s, "hr20_mqtt_publish_dropped_total",
+                "Publishes given up on", pub->retries.dropped);
+        counter(s, "hr20_mqtt_commands_coalesced_total",
+                "Set requests merged into a queued one",
+                pub->commands.coalesced);
+        counter(s, "hr20_mqtt_command_overflows_total",
+                "Set requests dropped on full queue", pub->commands.overflows);
+    }
+#endif
+
+#ifdef NTP_CLIENT
+    gauge(s, "hr20_ntp_synced", "Time is synchronized",
+          master.time.isSynced() ? 1 : 0);
+    gauge(s, "hr20_ntp_drift_ms", "Clock drift being slewed away",
+          master.time.cur_slew);
+#endif
+
+    counter(s, "hr20_radio_rx_overflows_total",
+            "Packets dropped with both receive slots full",
+            master.radio.rx_overflows);
+    counter(s, "hr20_radio_armed_replies_total",
+            "Replies prepared ahead and sent from the radio interrupt",
+            master.radio.armed_sent);
+    gauge(s, "hr20_radio_turnaround_us",
+          "Last time from a received packet to the reply",
+          master.radio.turnaround_us);
+    gauge(s, "hr20_radio_turnaround_max_us",
+          "Longest time from a received packet to the reply",
+          master.radio.turnaround_max_us);
+    counter(s, "hr20_capture_lost_total",
+            "Radio frames overwritten or not kept in the capture ring",
+            capture.lost);
+    counter(s, "hr20_debug_log_dropped_total",
+            "Debug records dropped on full ring", debugLog.lost);
+    counter(s, "hr20_journal_lost_total",
+            "Events overwritten before written to flash", journal.lost);
+
+    loop_latency(s);
+
+    gauge(s, "hr20_free_heap_bytes", "Free heap", ESP.getFreeHeap());
+    counter(s, "hr20_uptime_seconds_total", "Time since boot",
+            millis() / 1000);
+}
+
+} // namespace hr20
@@ -0,0 +1,78 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "str.h"
+
+namespace hr20 {
+
+struct HR20Master;
+
+namespace mqtt {
+struct MQTTPublisher;
+} // namespace mqtt
+
+/** Main loop duration histogram.
+ *
+ * Bucket i counts loop iterations that took less than 2^(i+1) microseconds
+ * (and at least 2^i, except bucket 0). Percentiles are thus only known up to
+ * a factor of 2, which is plenty to tell whether something blocks the loop.
+ */
+struct LoopStats {
+    static constexpr const uint8_t BUCKETS = 24; // up to ~16 s
+
+    /// call once per loop iteration
+    void tick() {
+        uint32_t now = micros();
+        if (last) record(now - last);
+        last = now;
+    }
+
+    void record(uint32_t us) {
+        uint8_t b = 0;
+        while ((us >> (b + 1)) && b < BUCKETS - 1) ++b;
+
+        if (buckets[b] != 0xFFFFFFFFUL) ++buckets[b];
+        ++count;
+        sum += us;
+        if (us > max) max = us;
+    }
+
+    /// upper bound of the bucket holding the given percentile, in us
+    uint32_t percentile(uint8_t pct) const;
+
+    uint32_t buckets[BUCKETS] = {};
+    uint32_t count = 0;
+    uint64_t sum   = 0;
+    uint32_t max   = 0;
+
+protected:
+    uint32_t last = 0;
+};
+
+// global loop stats instance
+extern LoopStats loopStats;
+
+/// appends all metrics in prometheus text exposition format. pub is optional
+void append_metrics(StrMaker &s, HR20Master &master,
+                    mqtt::MQTTPublisher *pub);
+
+} // namespace hr20
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include "error.h"
+#include "linkquality.h"
 #include "value.h"
 #include "timer.h"
 #include "str.h"
@@ -39,12 +41,21 @@ struct HR20 {
     const HR20 &operator = (const HR20 &) = delete;
 
     time_t last_contact = 0;  // last contact
+    uint8_t last_length = 0;  // length byte of the last packet received
+    uint32_t setpoint_ms = 0; // millis() of the last setpoint request
+    uint32_t setpoint_latency_ms = 0; // request to confirmation, last time
+    /// value of Model::generation at the last change of this client
+    uint32_t generation = 0;
     bool synced = false;      // we have fully populated copy of values if true
     /** set to true means we have quite a few things to talk about with the
      * client and would appreciate a more frequent packet exchgange.
      * frequent comms with the client.
      */
     bool need_fat_comms = false;
+    /// expected contacts missed, CMAC failures, unconfirmed writes
+    LinkQuality link;
+    /// signal strength, data quality and AFC offset of received packets
+    RadioStats radio;
 
     // == Controllable values ==
     // these are mirrored values - we sync them to HR20 when a change is requested
@@ -93,17 +104,40 @@ struct HR20 {
 
     ICACHE_FLASH_ATTR bool set_timer_mode(uint8_t day,
                                           uint8_t slot,
-                                          const Str &val)
+                                          uint8_t mode)
     {
         if (day >= TIMER_DAYS) return false;
         if (slot >= TIMER_SLOTS_PER_DAY) return false;
 
+        auto &tmr = timers[day][slot];
+        Timer t = requested_timer(tmr);
+        t.set_mode(mode & 0x0F);
+        tmr.set_requested(t);
+        return true;
+    }
+
+    ICACHE_FLASH_ATTR bool set_timer_time(uint8_t day,
+                                          uint8_t slot,
+                                          uint16_t time)
+    {
+        if (day >= TIMER_DAYS) return false;
+        if (slot >= TIMER_SLOTS_PER_DAY) return false;
+
+        auto &tmr = timers[day][slot];
+        Timer t = requested_timer(tmr);
+        t.set_time(time);
+        tmr.set_requested(t);
+        return true;
+    }
+
+    ICACHE_FLASH_ATTR bool set_timer_mode(uint8_t day,
+                                          uint8_t slot,
+                                          const Str &val)
+    {
         uint8_t cvtd;
 
-        if (cvt::Simple::from_str(val, cvtd)) {
-            timers[day][slot].get_requested().set_mode(cvtd & 0x0F);
-            return true;
-        }
+        if (cvt::Simple::from_str(val, cvtd))
+            return set_timer_mode(day, slot, cvtd);
 
         return false;
     }
@@ -112,17 +146,18 @@ struct HR20 {
                                           uint8_t slot,
                                           const Str &val)
     {
-        if (day >= TIMER_DAYS) return false;
-        if (slot >= TIMER_SLOTS_PER_DAY) return false;
-
         uint16_t cvtd;
-        if (cvt::TimeHHMM::from_str(val, cvtd)) {
-            timers[day][slot].get_requested().set_time(cvtd);
-            return true;
-        }
+        if (cvt::TimeHHMM::from_str(val, cvtd))
+            return set_timer_time(day, slot, cvtd);
 
         return false;
     }
+
+protected:
+    // pending change if there is one, otherwise what the client has
+    static Timer requested_timer(const TimerSlot &tmr) {
+        return tmr.is_requested_set() ? tmr.get_requested() : tmr.get_remote();
+    }
 };
 
 // Holds all clients in one array
@@ -168,6 +203,15 @@ struct Model {
         return &clients[slot - 1];
     }
 
+    /// marks the client as changed. Call after modifying client's values
+    ICACHE_FLASH_ATTR void touch(HR20 &hr) {
+        hr.generation = ++generation;
+    }
+
+    /// increments on every change of any client. Lets web clients check
+    /// for changes without fetching the whole model
+    uint32_t generation = 0;
+
 protected:
     Model(const Model &) = delete;
 
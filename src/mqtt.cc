@@ -17,12 +17,183 @@
  *
  */
 
+#include <jsmn.h>
+
 #include "mqtt.h"
 
 namespace hr20 {
 namespace mqtt {
 
-const char *Path::prefix = "hr20";
+namespace {
+
+/// collects the commands parsed from the batch
+struct BatchOut {
+    Command *cmds;
+    uint8_t max;
+    uint8_t n;
+
+    ICACHE_FLASH_ATTR bool add(const Command &c) {
+        if (n >= max) return false;
+        cmds[n++] = c;
+        return true;
+    }
+};
+
+/// walks the jsmn token array of the set/batch payload
+struct BatchParser {
+    const char *json;
+    const jsmntok_t *t;
+    int n;
+
+    ICACHE_FLASH_ATTR Str str(int i) const {
+        return {json + t[i].start, static_cast<unsigned>(t[i].end - t[i].start)};
+    }
+
+    /// returns index of the token following the i-th token's subtree
+    ICACHE_FLASH_ATTR int skip(int i) const {
+        int end = t[i].end;
+        for (++i; i < n && t[i].start < end; ++i) {}
+        return i;
+    }
+
+    ICACHE_FLASH_ATTR bool is(int i, jsmntype_t type) const {
+        return i < n && t[i].type == type;
+    }
+
+    // all parse methods return index of the next token, or -1 on error
+
+    // [[DAY, SLOT, MODE, TIME], ...]
+    ICACHE_FLASH_ATTR int timers(int i, uint8_t addr, BatchOut &out) const {
+        if (!is(i, JSMN_ARRAY)) return -1;
+        int cnt = t[i++].size;
+
+        while (cnt--) {
+            if (!is(i, JSMN_ARRAY) || t[i].size != 4 || i + 4 >= n)
+                return -1;
+
+            uint8_t day, slot, mode;
+            uint16_t time;
+            if (!str(i + 1).toInt(day) || day >= TIMER_DAYS) return -1;
+            if (!str(i + 2).toInt(slot) || slot >= TIMER_SLOTS_PER_DAY)
+                return -1;
+            if (!cvt::Simple::from_str(str(i + 3), mode)) return -1;
+            if (!cvt::TimeHHMM::from_str(str(i + 4), time)) return -1;
+
+            uint8_t arg = Command::timer_arg(day, slot);
+            if (!out.add({addr, Command::TIMER_MODE, mode, arg})) return -1;
+            if (!out.add({addr, Command::TIMER_TIME, time, arg})) return -1;
+
+            i = skip(i);
+        }
+
+        return i;
+    }
+
+    // {"EE_ADDR": VALUE or "read", ...}
+    ICACHE_FLASH_ATTR int eeprom(int i, uint8_t addr, BatchOut &out) const {
+        if (!is(i, JSMN_OBJECT)) return -1;
+        int cnt = t[i++].size;
+
+        while (cnt--) {
+            if (!is(i, JSMN_STRING) || i + 1 >= n) return -1;
+
+            uint8_t ee_addr, val;
+            if (!str(i).toInt(ee_addr)) return -1;
+
+            if (t[i + 1].type == JSMN_STRING && str_eq(str(i + 1), S_EA_READ)) {
+                if (!out.add({addr, Command::EEPROM_READ, 0, ee_addr}))
+                    return -1;
+            } else {
+                if (!str(i + 1).toInt(val)) return -1;
+                if (!out.add({addr, Command::EEPROM_WRITE, val, ee_addr}))
+                    return -1;
+            }
+
+            i = skip(i + 1);
+        }
+
+        return i;
+    }
+
+    // {"temp": .., "mode": .., "auto": .., "lock": .., "timers": .., "eeprom": ..}
+    ICACHE_FLASH_ATTR int client(int i, uint8_t addr, BatchOut &out) const {
+        if (!is(i, JSMN_OBJECT)) return -1;
+        int cnt = t[i++].size;
+
+        while (cnt--) {
+            if (!is(i, JSMN_STRING) || i + 1 >= n) return -1;
+
+            Str key = str(i);
+            Str val = str(i + 1);
+            int next = i + 1;
+
+            if (str_eq(key, S_B_TEMP)) {
+                uint8_t temp;
+                if (!cvt::TempHalfC::from_str(val, temp)) return -1;
+                if (!out.add({addr, Command::TEMP, temp})) return -1;
+            } else if (str_eq(key, S_AUTO) || str_eq(key, S_LOCK)) {
+                bool b;
+                if (!cvt::Simple::from_str(val, b)) return -1;
+                auto kind = str_eq(key, S_AUTO) ? Command::AUTO : Command::LOCK;
+                if (!out.add({addr, kind, b})) return -1;
+            } else if (str_eq(key, S_MODE)) {
+                Command cmds[2];
+                uint8_t mc = mode_commands(addr, parse_mode(val), cmds);
+                if (!mc) return -1;
+                for (uint8_t c = 0; c < mc; ++c)
+                    if (!out.add(cmds[c])) return -1;
+            } else if (str_eq(key, S_B_TIMERS)) {
+                if ((next = timers(next, addr, out)) < 0) return -1;
+                i = next;
+                continue;
+            } else if (str_eq(key, S_EEPROM)) {
+                if ((next = eeprom(next, addr, out)) < 0) return -1;
+                i = next;
+                continue;
+            } else {
+                return -1;
+            }
+
+            i = skip(next);
+        }
+
+        return i;
+    }
+};
+
+} // namespace
+
+ICACHE_FLASH_ATTR int parse_batch(const char *json, unsigned len,
+                                  Command *cmds, uint8_t max)
+{
+    jsmn_parser parser;
+    // ~1KB, too much for the stack of the PubSubClient callback
+    static jsmntok_t tokens[MQTT_BATCH_MAX_TOKENS];
+
+    jsmn_init(&parser);
+    int n = jsmn_parse(&parser, json, len, tokens, MQTT_BATCH_MAX_TOKENS);
+
+    if (n < 1 || tokens[0].type != JSMN_OBJECT) return -1;
+
+    BatchParser p{json, tokens, n};
+    BatchOut out{cmds, max, 0};
+
+    // top level object is keyed by client address
+    int cnt = tokens[0].size;
+    int i = 1;
+
+    while (cnt--) {
+        if (!p.is(i, JSMN_STRING)) return -1;
+
+        uint8_t addr;
+        if (!p.str(i).toInt(addr) || addr == 0 || addr >= MAX_HR_ADDR)
+            return -1;
+
+        if ((i = p.client(i + 1, addr, out)) < 0) return -1;
+    }
+
+    return out.n;
+}
 
 } // namespace mqtt
 } // namespace hr20
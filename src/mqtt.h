@@ -27,534 +27,143 @@
 #include "error.h"
 #include "master.h"
 #include "util.h"
+#include "command.h"
+#include "counters.h"
 #include "json.h"
+#include "mqttconn.h"
+#include "mqttpath.h"
 #include "str.h"
 
 namespace hr20 {
 namespace mqtt {
 
-// topic enum. Each has different initial letter for simple parsing
-enum Topic {
-    AVG_TMP = 1,
-    BAT     = 2,
-    ERR     = 3,
-    LOCK    = 4,
-    AUTO    = 5,
-    REQ_TMP = 6,
-    VALVE_WTD = 7,
-    WND       = 8,
-    LAST_SEEN = 9,
-    TIMER     = 10,
-    STATE     = 11,
-    EEPROM    = 12,
-    MODE      = 13,
-    INVALID_TOPIC = 255
-};
-
-enum TimerTopic {
-    TIMER_NONE = 0,
-    TIMER_TIME,
-    TIMER_MODE,
-    INVALID_TIMER_TOPIC = 255
-};
-
-enum EEPROMAccess {
-    EA_READ  = 0,
-    EA_WRITE = 1,
-    INVALID_EEPROM_TOPIC = 255
-};
-
-enum Mode {
-    MODE_OFF = 0,
-    MODE_AUTO,
-    MODE_MANUAL,
-    MODE_OPEN,
-    INVALID_MODE_TYPE = 255
-};
-
-static const char *S_AVG_TMP   = "average_temp";
-static const char *S_BAT       = "battery";
-static const char *S_ERR       = "error";
-static const char *S_EEPROM     = "eeprom";
-static unsigned    S_EEPROM_LEN = 6;
-static const char *S_LOCK      = "lock";
-static const char *S_MODE      = "mode"; // this is a OFF/MANUAL/AUTO mode info topic
-static const char *S_AUTO      = "auto";
-static const char *S_REQ_TMP   = "requested_temp"; // 14
-static const char *S_VALVE_WTD = "valve_wanted";
-static const char *S_WND       = "window";
-static const char *S_LAST_SEEN = "last_seen";
-static const char *S_STATE     = "state";
-
-static const char *S_TIMER     = "timer";
-static unsigned    S_TIMER_LEN = 5;
-
-// timer subtopics
-static const char *S_TIMER_MODE = "mode";
-static const char *S_TIMER_TIME = "time";
-
-// set topic branch mid-prefix
-static const char *S_SET_MODE   = "set";
-
-// eeprom access strs
-static const char *S_EA_READ  = "read";
-static const char *S_EA_WRITE = "write";
-
-// valve modes
-static const char *S_MODE_OFF    = "off";
-static const char *S_MODE_AUTO   = "auto";
-static const char *S_MODE_MANUAL = "manual";
-static const char *S_MODE_OPEN   = "open";
-
-constexpr const uint8_t MAX_MQTT_PATH_LENGTH = 128;
-using PathBuffer = BufferHolder<MAX_MQTT_PATH_LENGTH>;
-
-ICACHE_FLASH_ATTR static const char *topic_str(Topic topic) {
-    switch (topic) {
-    case AVG_TMP:   return S_AVG_TMP;
-    case BAT:       return S_BAT;
-    case ERR:       return S_ERR;
-    case EEPROM:    return S_EEPROM;
-    case LOCK:      return S_LOCK;
-    case AUTO:      return S_AUTO;
-    case MODE:      return S_MODE;
-    case REQ_TMP:   return S_REQ_TMP;
-    case VALVE_WTD: return S_VALVE_WTD;
-    case WND:       return S_WND;
-    case LAST_SEEN: return S_LAST_SEEN;
-    case STATE:     return S_STATE;
-    case TIMER:     return S_TIMER;
-    default:
-        return nullptr;
-    }
-}
-
-ICACHE_FLASH_ATTR static const char *eeprom_access_str(EEPROMAccess ea) {
-    switch (ea) {
-    case EA_READ:   return S_EA_READ;
-    case EA_WRITE:  return S_EA_WRITE;
-    default:
-        return nullptr;
-    }
-}
-
-ICACHE_FLASH_ATTR static const char *timer_topic_str(TimerTopic sub) {
-    switch (sub) {
-    case TIMER_TIME: return S_TIMER_TIME;
-    case TIMER_MODE: return S_TIMER_MODE;
-    default:
-        return nullptr;
-    }
-}
-
-ICACHE_FLASH_ATTR static Topic parse_topic(const char *top) {
-    switch (*top) {
-    case 'a':
-        if (strcmp(top, S_AVG_TMP) == 0) return AVG_TMP;
-        if (strcmp(top, S_AUTO) == 0) return AUTO;
-        return INVALID_TOPIC;
-    case 'b':
-        if (strcmp(top, S_BAT) == 0) return BAT;
-        return INVALID_TOPIC;
-    case 'e':
-        if (strcmp(top, S_ERR) == 0) return ERR;
-        if (strncmp(top, S_EEPROM, S_EEPROM_LEN) == 0) return EEPROM;
-        return INVALID_TOPIC;
-    case 'l':
-        if (strcmp(top, S_LOCK) == 0) return LOCK;
-        if (strcmp(top, S_LAST_SEEN) == 0) return LAST_SEEN;
-        return INVALID_TOPIC;
-    case 'm':
-        if (strcmp(top, S_MODE) == 0) return MODE;
-    case 'r':
-        if (strcmp(top, S_REQ_TMP) == 0) return REQ_TMP;
-        return INVALID_TOPIC;
-    case 's':
-        if (strcmp(top, S_STATE) == 0) return STATE;
-        return INVALID_TOPIC;
-    case 't':
-        if (strncmp(top, S_TIMER, S_TIMER_LEN) == 0) return TIMER;
-        return INVALID_TOPIC;
-    case 'v':
-        if (strcmp(top, S_VALVE_WTD) == 0) return VALVE_WTD;
-        return INVALID_TOPIC;
-    case 'w':
-        if (strcmp(top, S_WND) == 0) return WND;
-        return INVALID_TOPIC;
-    default:
-        return INVALID_TOPIC;
-    }
-}
-
-ICACHE_FLASH_ATTR static TimerTopic parse_timer_topic(const char *top) {
-    if (!top) return INVALID_TIMER_TOPIC;
-
-    if (top[0] == 't') {
-        if (strcmp(top, S_TIMER_TIME) == 0) return TIMER_TIME;
-        return INVALID_TIMER_TOPIC;
-    }
-
-    if (top[0] == 'm') {
-        if (strcmp(top, S_TIMER_MODE) == 0) return TIMER_MODE;
-        return INVALID_TIMER_TOPIC;
-    }
-
-    return INVALID_TIMER_TOPIC;
-}
-
-ICACHE_FLASH_ATTR static EEPROMAccess parse_eeprom_access(const char *top) {
-    if (!top) return INVALID_EEPROM_TOPIC;
-
-    if (top[0] == 'r') {
-        if (strcmp(top, S_EA_READ) == 0) return EA_READ;
-        return INVALID_EEPROM_TOPIC;
-    }
-
-    if (top[0] == 'w') {
-        if (strcmp(top, S_EA_WRITE) == 0) return EA_WRITE;
-        return INVALID_EEPROM_TOPIC;
-    }
-
-    return INVALID_EEPROM_TOPIC;
-}
-
-ICACHE_FLASH_ATTR static Mode parse_mode(const char *top) {
-    if (!top) return INVALID_MODE_TYPE;
-
-    if (top[0] == 'o') {
-        if (strcmp(top, S_MODE_OFF)  == 0) return MODE_OFF;
-        if (strcmp(top, S_MODE_OPEN) == 0) return MODE_OPEN;
-    }
-
-    if (top[0] == 'a') {
-        if (strcmp(top, S_MODE_AUTO) == 0) return MODE_AUTO;
-    }
-
-    if (top[0] == 'm') {
-        if (strcmp(top, S_MODE_MANUAL) == 0) return MODE_MANUAL;
-    }
-
-    return INVALID_MODE_TYPE;
-}
-
-// mqtt path parser/composer
-struct Path {
-    static const char SEPARATOR = '/';
-    static const char WILDCARD  = '#';
-    static const char *prefix;
-
-    // static method that overrides prefix
-    ICACHE_FLASH_ATTR static void begin(const char *pfx) {
-        prefix = pfx;
-    }
-
-    ICACHE_FLASH_ATTR Path() {}
-
-    // constructor for normal or timer topics
-    ICACHE_FLASH_ATTR Path(uint8_t addr,
-                           Topic t,
-                           bool set_mode = false,
-                           TimerTopic st = TIMER_NONE,
-                           uint8_t day   = 0,
-                           uint8_t slot  = 0)
-        : addr(addr),
-          day(day),
-          slot(slot),
-          topic(t),
-          timer_topic(st),
-          set_mode(set_mode)
-    {}
-
-    // this constructs eeprom access topics
-    ICACHE_FLASH_ATTR Path(uint8_t addr,
-                           bool set_mode,
-                           EEPROMAccess ea,
-                           uint8_t ee_address)
-        : addr(addr),
-          day(0),
-          slot(0),
-          topic(EEPROM),
-          timer_topic(TIMER_NONE),
-          set_mode(set_mode),
-          eeprom_access(ea),
-          eeprom_address(ee_address)
-    {}
-
-    ICACHE_FLASH_ATTR static Str compose_set_prefix_wildcard(Buffer b) {
-        StrMaker rv(b);
-
-        rv += prefix;
-        rv += SEPARATOR;
-        rv += S_SET_MODE;
-        rv += SEPARATOR;
-        rv += WILDCARD;
-
-        return rv.str();
-    }
-
-
-    ICACHE_FLASH_ATTR Str compose(Buffer b) const {
-        StrMaker rv(b);
-
-        rv += prefix;
-        rv += SEPARATOR;
-
-        if (set_mode) {
-            rv += S_SET_MODE;
-            rv += SEPARATOR;
-        }
-
-        rv += addr;
-        rv += SEPARATOR;
-        rv += topic_str(topic);
-
-        if (topic == EEPROM) {
-            rv += SEPARATOR;
-            rv += eeprom_address;
-
-            // In set mode we include read/write op. specifier
-            if (set_mode) {
-                rv += SEPARATOR;
-                rv += eeprom_access_str(eeprom_access);
-            }
-        } else if (topic == TIMER) {
-            rv += SEPARATOR;
-            rv += day;
-            rv += SEPARATOR;
-            rv += slot;
-            rv += SEPARATOR;
-            rv += timer_topic_str(timer_topic);
+/** Bounded queue of topics that failed to publish and will be retried.
+ *  Entries only reference the value in the model (client, topic and
+ *  slot/address), so the retry always publishes the latest version of the
+ *  value and repeated failures of one topic coalesce into a single entry.
+ */
+struct PublishQ {
+    struct Item {
+        uint8_t addr    = 0; // client address. 0 marks a free slot
+        uint8_t topic   = INVALID_TOPIC;
+        uint8_t sub     = 0; // day << 3 | slot for timers, eeprom address
+        uint8_t retries = 0;
+        time_t next_try = 0;
+
+        ICACHE_FLASH_ATTR Path path() const {
+            Topic t = static_cast<Topic>(topic);
+            if (t == TIMER)
+                return {addr, t, false, TIMER_NONE,
+                        static_cast<uint8_t>(sub >> 3),
+                        static_cast<uint8_t>(sub & 0x7)};
+            if (t == EEPROM)
+                return {addr, false, EA_READ, sub};
+            return {addr, t};
         }
+    };
 
-        return rv.str();
-    }
-
-    ICACHE_FLASH_ATTR static Path parse(const char *p) {
-        // compare prefix first
-        const char *pos = p;
-        bool set_mode = false;
-
-        // skips the prefix path and compares if it equals
-        // also skips leading separators
-        // skip the prefix (1..n tokens)
-        pos = skip_prefix(pos, prefix);
-
-        // prefix does not match!
-        if (!pos) return {};
-
-        // premature end (just the prefix)
-        if (!*pos) return {};
-
-        // tokenize the address
-        auto addr = token(pos);
-
-        static const Token S_SET_TOK{S_SET_MODE, strlen(S_SET_MODE)};
-
-        // is it by chance a set sub_branch?
-        if (cmp_tokens(addr, S_SET_TOK)) {
-            pos = skip_token(addr);
-            set_mode = true;
+    /// queues path for a retry. returns false if the queue was full and the
+    /// publish was dropped
+    ICACHE_FLASH_ATTR bool push(const Path &p, time_t now) {
+        uint8_t sub = (p.topic == TIMER) ? (p.day << 3 | p.slot)
+                                         : p.eeprom_address;
+        Item *free = nullptr;
 
-            if (!pos) return {};
+        for (auto &it : items) {
+            // already waiting - the retry will pick up the new value anyway
+            if (it.addr == p.addr && it.topic == p.topic && it.sub == sub)
+                return true;
 
-            // re-read the token for address
-            addr = token(pos);
+            if (!free && it.addr == 0) free = &it;
         }
 
-        // convert to number
-        uint8_t address = to_num(&pos, addr.second);
-
-        // is the next char a separator? if not then it wasn't a valid path
-        if (*pos != Path::SEPARATOR) return {};
-
-        ++pos;
-
-        // now follows the ending element. Parse via parse_topic
-        Topic top = parse_topic(pos);
-
-        if (top == INVALID_TOPIC) return {};
-
-        if (top == EEPROM) {
-            // eeprom is a sub-tree
-            // here we see these
-            // set/.../eeprom/addr/read  - read request to an address (value sent is ignored)
-            // set/.../eeprom/addr/write - write request with value for addr written to this topic
-            // .../eeprom/addr - value as gathered from client with specified topic
-
-            // skip the token 'eeprom'
-            auto ee_topic_t = token(pos);
-            pos = ee_topic_t.first + ee_topic_t.second;
-            if (*pos != Path::SEPARATOR) return {};
-            ++pos;
-
-            // unless read mode is set, we expect an address as a continuation
-            auto addr_t = token(pos);
-            uint8_t ee_addr = to_num(&pos, addr_t.second);
-
-            // in set mode we expect either read/write tokens next
-            EEPROMAccess ea = EA_READ;
-            if (set_mode) {
-                // is the next char a separator? if not then it wasn't a valid path
-                if (*pos != Path::SEPARATOR) return {};
-                ++pos;
-
-                ea = parse_eeprom_access(pos);
-
-                if (ea == INVALID_EEPROM_TOPIC) return {};
-            }
-
-            return {address, set_mode, ea, ee_addr};
-        } else if (top == TIMER) {
-            // timer subtree... .../timer/day/slot/[mode/time]
-            // skip the 'timer' token
-            auto tt_topic_t = token(pos);
-            pos = tt_topic_t.first + tt_topic_t.second;
-
-            if (*pos != Path::SEPARATOR) return {};
-            ++pos;
-
-            // day
-            auto d_t = token(pos);
-            uint8_t d = to_num(&pos, d_t.second);
-
-            // is the next char a separator? if not then it wasn't a valid path
-            if (*pos != Path::SEPARATOR) return {};
-            ++pos;
-
-            auto s_t = token(pos);
-            uint8_t s = to_num(&pos, s_t.second);
-
-            // is the next char a separator? if not then it wasn't a valid path
-            if (*pos != Path::SEPARATOR) return {};
-            ++pos;
-
-            // now timer topic
-            auto tt = parse_timer_topic(pos);
-
-            if (tt == INVALID_TIMER_TOPIC) return {};
-
-            // whole timer specification is okay
-            return {address, top, set_mode, tt, d, s};
+        if (!free) {
+            ++dropped;
+            ERR_ARG(MQTT_PUBLISH_DROPPED, p.as_uint());
+            return false;
         }
 
-        return {address, top, set_mode};
+        free->addr     = p.addr;
+        free->topic    = p.topic;
+        free->sub      = sub;
+        free->retries  = 0;
+        free->next_try = now + 1;
+        ++count;
+        return true;
     }
 
-    ICACHE_FLASH_ATTR static uint8_t to_num(const char **p, uint8_t cnt) {
-        uint8_t res = 0;
-        for (;cnt--;++(*p)) {
-            if (**p == 0) return res;
-
-            switch (**p) {
-                case '0':
-                case '1':
-                case '2':
-                case '3':
-                case '4':
-                case '5':
-                case '6':
-                case '7':
-                case '8':
-                case '9':
-                    res *= 10;
-                    res += static_cast<uint8_t>(**p - '0');
-                    continue;
-            default:
-                return res;
-            }
-        }
-        return res;
-    }
+    /// returns an item that is due for retry, or nullptr
+    ICACHE_FLASH_ATTR Item *due(time_t now) {
+        if (!count) return nullptr;
 
-    using Token = std::pair<const char*, uint8_t>;
+        for (auto &it : items) {
+            if (it.addr != 0 && it.next_try <= now) return &it;
+        }
 
-    ICACHE_FLASH_ATTR static const char *skip_token(const Token &t) {
-        // skips the token chars plus optionally a separator
-        const char *end = t.first + t.second;
-        return skip_separator(end);
+        return nullptr;
     }
 
-    // skips a separator, and if there is nothing past it, it returns a nullptr
-    // returns `other` if the separator is missing (defaults to nullptr)
-    ICACHE_FLASH_ATTR static const char *skip_separator(
-        const char *p, const char *other = nullptr)
-    {
-        // skip initial SEPARATOR if present
-        if (!p) return nullptr;
-        // this might not be obvious, but it includes a trailing '\0'
-        if (*p != SEPARATOR) return other;
-        ++p;
-        if (*p == 0) return nullptr;
-        return p;
+    /// call after item was published successfully
+    ICACHE_FLASH_ATTR void done(Item &it) {
+        it.addr = 0;
+        --count;
     }
 
-
-    ICACHE_FLASH_ATTR static const char *skip_prefix(const char *p, const char *pfx) {
-        // also skip any initial separators in prefix path
-        // the second arg is there to ignore if the separator is missing
-        p   = skip_separator(p, p);
-        pfx = skip_separator(pfx, pfx);
-
-        // do we still have something to process?
-        while (p != nullptr && pfx != nullptr) {
-            auto p_t    = token(p);
-            auto pfx_t  = token(pfx);
-
-            // is the first token same as prefix?
-            p = cmp_tokens(p_t, pfx_t);
-
-            // differing tokens?
-            if (!p) return nullptr;
-
-            // and onto the next part of the path
-            p   = skip_token(p_t);
-            pfx = skip_token(pfx_t);
+    /// call after item failed to publish again, backs off exponentially
+    ICACHE_FLASH_ATTR void failed(Item &it, time_t now) {
+        if (++it.retries >= MQTT_PUBLISH_MAX_RETRIES) {
+            ++dropped;
+            ERR_ARG(MQTT_PUBLISH_DROPPED, it.path().as_uint());
+            done(it);
+            return;
         }
 
-        // still some prefix left? if so we didn't eat all tokens of it and have
-        // to bail
-        if (pfx) return nullptr;
-
-        return p;
+        time_t backoff = static_cast<time_t>(1) << it.retries;
+        if (backoff > MQTT_PUBLISH_MAX_BACKOFF)
+            backoff = MQTT_PUBLISH_MAX_BACKOFF;
+        it.next_try = now + backoff;
     }
 
-    ICACHE_FLASH_ATTR static const char *cmp_tokens(const Token &a, const Token &b) {
-        if (a.second != b.second) return nullptr;
-        return (strncmp(a.first, b.first, a.second) == 0) ? a.first + a.second : nullptr;
-    }
+    uint8_t size() const { return count; }
 
-    // returns separator pos (or zero byte) and number of bytes that it took to
-    // get there
-    ICACHE_FLASH_ATTR static Token token(const char *p) {
-        const char *pos = p;
-        for(;*p;++p) {
-            if (*p == Path::SEPARATOR) {
-                break;
-            }
-        }
-
-        return {pos, p - pos};
+    /// count of entries waiting for topic t
+    ICACHE_FLASH_ATTR uint8_t count_of(Topic t) const {
+        uint8_t n = 0;
+        for (auto &it : items)
+            if (it.addr != 0 && it.topic == t) ++n;
+        return n;
     }
 
-    ICACHE_FLASH_ATTR bool valid() { return addr != 0; }
+    Item items[MQTT_PUBLISH_QUEUE_LEN];
+    uint8_t count = 0;
 
-    // compressed topic code for debugging (addr 5 bits, topic 4 bits, timer topic 2 bits)
-    ICACHE_FLASH_ATTR uint16_t as_uint() const {
-        return addr | ((uint16_t)topic << 5) | ((uint16_t)timer_topic << 9);
-    }
+    // statistics - publishes lost for good and retry attempts done
+    uint32_t dropped = 0;
+    uint32_t retried = 0;
+};
 
-    // client ID. 0 means invalid path!
-    uint8_t addr = 0;
-    uint8_t day  = 0;
-    uint8_t slot = 0;
-    Topic topic            = INVALID_TOPIC;
-    TimerTopic timer_topic = TIMER_NONE;
-    bool    set_mode = false; // true in the S_SET_MODE sub-branch
-
-    EEPROMAccess eeprom_access = EA_READ;
-    uint8_t eeprom_address = 0; // eeprom address in case topic is EEPROM
+// topics published in the frequent publish pass, in order
+static const Topic FREQUENT_TOPICS[] = {
+    AUTO,
+    LOCK,
+    WND,
+    AVG_TMP,
+    BAT,
+    REQ_TMP,
+    VALVE_WTD,
+    ERR,
+    LAST_SEEN,
+    LINK_QUALITY,
+    MODE,
+#ifdef MQTT_JSON
+    STATE,
+    RADIO,
+#endif
 };
 
+static constexpr const uint8_t FREQUENT_TOPIC_COUNT =
+    sizeof(FREQUENT_TOPICS) / sizeof(FREQUENT_TOPICS[0]);
+
 /// Publishes/receives topics in mqtt
 struct MQTTPublisher {
     // TODO: Make this configurable!
@@ -563,13 +172,18 @@ struct MQTTPublisher {
         : config(config),
           master(master),
           wifiClient(),
-          client(wifiClient)
+          link(wifiClient),
+          client(link),
+          conn(config, wifiClient, link, client)
     {
         for (uint8_t i = 0; i < MAX_HR_ADDR; ++i) states[i] = 0;
     }
 
     ICACHE_FLASH_ATTR void begin() {
-        client.setServer(config.mqtt_server, atoi(config.mqtt_port));
+        // subscribe to the set sub-branch on every connect
+        conn.begin(Path::compose_set_prefix_wildcard(sub_topic).c_str());
+        batch_topic = Path::compose_set_batch(batch_buf);
+
         client.setCallback([&](char *topic, byte *payload, unsigned int length)
                            {
                                callback(topic, payload, length);
@@ -580,40 +194,6 @@ struct MQTTPublisher {
                                   });
     }
 
-    ICACHE_FLASH_ATTR bool reconnect(time_t now) {
-        if (!client.connected()) {
-            if ((now - last_conn) <  MQTT_RECONNECT_TIME)
-                return false;
-            last_conn = now;
-
-            DBG("(MQTT CONN)");
-
-            char *user = nullptr;
-            char *pass = nullptr;
-
-            size_t unl = ::strnlen(config.mqtt_user, sizeof(config.mqtt_user));
-
-            if ((unl > 0) && (unl < sizeof(config.mqtt_user))) {
-                user = config.mqtt_user;
-                pass = config.mqtt_pass;
-            }
-
-            if (!client.connect(config.mqtt_client_id, user, pass)) {
-                ERR(MQTT_CANNOT_CONNECT);
-                return false;
-            } else {
-                EVENT(MQTT_CONN);
-
-                // subscribe to the set sub-branch
-                PathBuffer pb;
-                auto path = Path::compose_set_prefix_wildcard(pb);
-                client.subscribe(path.c_str());
-            }
-        }
-
-        return true;
-    }
-
     enum StateMajor {
         STM_FREQ        = 0,
         STM_TIMER       = 1,
@@ -622,12 +202,22 @@ struct MQTTPublisher {
     };
 
     ICACHE_FLASH_ATTR void update(time_t now) {
-        // TODO: Try to reconnect in intervals. Don't block the main loop too
-        // often
-        if (!reconnect(now)) return;
+        // set requests staged by the callback get into the model first
+        apply_commands();
+
+        // connects in small steps, so this does not block the idle window
+        if (!conn.update()) return;
 
         client.loop();
 
+        cur_time = now;
+
+        // failed publishes get a chance first, one per update call
+        if (retry_publish()) return;
+
+        // changed counters, one per update call
+        if (publish_counters()) return;
+
         if (!states[addr]) {
             // no changes for this client
             // switch to next one and check here next loop
@@ -668,71 +258,220 @@ struct MQTTPublisher {
         if (state_maj >= STM_NEXT_CLIENT) next_client();
     }
 
+    /// publishes one due entry of the retry queue. returns true if it did
+    /// any publishing work
+    ICACHE_FLASH_ATTR bool retry_publish() {
+        auto *it = retries.due(cur_time);
+        if (!it) return false;
+
+        Path p = it->path();
+        auto *hr = master.model[p.addr];
+
+        if (!hr) {
+            // client vanished, nothing to publish any more
+            retries.done(*it);
+            return false;
+        }
+
+        ++retries.retried;
+        EVENT_ARG(MQTT_PUBLISH_RETRY, p.as_uint());
+
+        if (publish_value(p, *hr)) {
+            retries.done(*it);
+        } else {
+            retries.failed(*it, cur_time);
+        }
+
+        return true;
+    }
+
+    /// publishes one changed error/event counter. All changed counters get
+    /// published in one pass every MQTT_COUNTERS_INTERVAL. Returns true if
+    /// it did any publishing work
+    ICACHE_FLASH_ATTR bool publish_counters() {
+        if (cur_time - counters_time < MQTT_COUNTERS_INTERVAL) return false;
+
+        uint8_t a;
+        EventType type;
+        uint8_t code;
+
+        if (!counters.next_dirty(counters_cursor, a, type, code)) {
+            // pass done
+            counters_cursor = 0;
+            counters_time   = cur_time;
+            return false;
+        }
+
+        // prefix/counters/NAME or prefix/ADDR/counters/NAME
+        PathBuffer pb;
+        StrMaker path(pb);
+        path += Path::prefix;
+        path += Path::SEPARATOR;
+        if (a) {
+            path += a;
+            path += Path::SEPARATOR;
+        }
+        path += S_COUNTERS;
+        path += Path::SEPARATOR;
+        path += type == EventType::ERROR
+                    ? err_to_str(static_cast<ErrorCode>(code))
+                    : event_to_str(static_cast<EventCode>(code));
+
+        cvt::ValueBuffer vb;
+        StrMaker val(vb);
+        val += (unsigned long)(a ? counters.get(a, type, code)
+                                 : counters.get(type, code));
+
+        auto ps = path.str();
+        auto vs = val.str();
+
+        // not logged as MQTT_PUBLISH, that would keep the counters dirty.
+        // a failed one gets published with the next change
+        if (!client.publish(ps.c_str(),
+                            reinterpret_cast<const uint8_t *>(vs.c_str()),
+                            vs.length(), MQTT_RETAIN))
+            ERR(MQTT_CANT_PUBLISH);
+
+        return true;
+    }
+
+    /// publishes the value addressed by path, queues a retry if it fails
+    ICACHE_FLASH_ATTR void publish_or_retry(const Path &p, HR20 &hr) {
+        if (!publish_value(p, hr)) retries.push(p, cur_time);
+    }
+
+    /// publishes the value addressed by path p. Returns false if publish
+    /// failed and should be repeated later.
+    ICACHE_FLASH_ATTR bool publish_value(const Path &p, HR20 &hr) {
+        switch (p.topic) {
+        case mqtt::AUTO:      return publish(p, hr.auto_mode);
+        case mqtt::LOCK:      return publish(p, hr.menu_locked);
+        case mqtt::WND:       return publish(p, hr.mode_window);
+        // TODO: this is in 0.01 of C, change it to float?
+        case mqtt::AVG_TMP:   return publish(p, hr.temp_avg);
+        // TODO: Battery is in 0.01 of V, change it to float?
+        case mqtt::BAT:       return publish(p, hr.bat_avg);
+        // TODO: Fix formatting for temp_wanted - float?
+        // temp_wanted is in 0.5 C
+        case mqtt::REQ_TMP:   return publish(p, hr.temp_wanted);
+        case mqtt::VALVE_WTD: return publish(p, hr.cur_valve_wtd);
+        // TODO: test_auto
+        case mqtt::ERR:       return publish(p, hr.ctl_err);
+        case mqtt::LAST_SEEN: {
+            cvt::ValueBuffer vb;
+            StrMaker sm{vb};
+            sm += hr.last_contact;
+            return publish(p, sm.str(), /*ratain*/true);
+        }
+        case mqtt::LINK_QUALITY: {
+            cvt::ValueBuffer vb;
+            StrMaker sm{vb};
+            sm += hr.link.score();
+            return publish(p, sm.str());
+        }
+        case mqtt::MODE: {
+            cvt::ValueBuffer vb;
+            StrMaker sm{vb};
+
+            // Combining off/open and auto/manual for a simple HASS integration here
+            if (hr.temp_wanted.get_remote() == TEMP_OFF)
+                sm += S_MODE_OFF;
+            else if (hr.temp_wanted.get_remote() == TEMP_OPEN)
+                sm += S_MODE_OPEN;
+            else if (hr.auto_mode.get_remote())
+                sm += S_MODE_AUTO;
+            else
+                sm += S_MODE_MANUAL;
+
+            return publish(p, sm.str());
+        }
+#ifdef MQTT_JSON
+        case mqtt::STATE: {
+            BufferHolder<176> buf;
+            StrMaker sm{buf};
+            json::append_client_attr(sm, hr);
+            return publish(p, sm.str());
+        }
+        case mqtt::RADIO: {
+            BufferHolder<96> buf;
+            StrMaker sm{buf};
+            json::append_client_radio(sm, hr);
+            return publish(p, sm.str());
+        }
+#endif
+        case mqtt::TIMER:
+            // TODO: Rework this to implicit conversion system
+            return publish_timer_slot(p, hr.timers[p.day][p.slot]);
+        case mqtt::EEPROM:
+            return publish(p, hr.eeprom[p.eeprom_address]);
+        default:
+            return true;
+        }
+    }
+
+    /// publishes the value if it changed since last publish. Returns false
+    /// on publish failure, in which case the value stays unpublished.
     template <typename T, typename CvT>
-    ICACHE_FLASH_ATTR void publish(const Str &path,
+    ICACHE_FLASH_ATTR bool publish(const Str &path,
                                    CachedValue<T, CvT> &val,
                                    uint16_t hint,
                                    bool retain = MQTT_RETAIN) const
     {
         if (val.published() || !val.remote_valid())
-            return;
+            return true;
 
         cvt::ValueBuffer vb;
         auto vstr = val.to_str(vb);
 
-        if (client.publish(path.c_str(),
-                           reinterpret_cast<const uint8_t *>(vstr.c_str()),
-                           vstr.length(),
-                           // retained
-                           retain))
+        if (!client.publish(path.c_str(),
+                            reinterpret_cast<const uint8_t *>(vstr.c_str()),
+                            vstr.length(),
+                            // retained
+                            retain))
         {
-            EVENT_ARG(MQTT_PUBLISH, hint);
-        } else {
             ERR_ARG(MQTT_CANT_PUBLISH, hint);
+            return false;
         }
 
+        EVENT_ARG(MQTT_PUBLISH, hint);
         val.published() = true;
+        return true;
     }
 
     template <typename T, typename CvT>
-    ICACHE_FLASH_ATTR void publish(const Path &p,
+    ICACHE_FLASH_ATTR bool publish(const Path &p,
                                    CachedValue<T, CvT> &val) const
     {
         PathBuffer pb;
         auto path = p.compose(pb);
-        publish(path.c_str(), val, p.as_uint());
+        return publish(path.c_str(), val, p.as_uint());
     }
 
-    ICACHE_FLASH_ATTR void publish(const Path &p,
+    ICACHE_FLASH_ATTR bool publish(const Path &p,
                                    const Str &val,
                                    bool retain = MQTT_RETAIN) const
     {
         PathBuffer pb;
         auto path = p.compose(pb);
 
-        if (client.publish(path.c_str(),
-                           reinterpret_cast<const uint8_t *>(val.c_str()),
-                           val.length(),
-                           retain))
+        if (!client.publish(path.c_str(),
+                            reinterpret_cast<const uint8_t *>(val.c_str()),
+                            val.length(),
+                            retain))
         {
-            EVENT_ARG(MQTT_PUBLISH, p.as_uint());
-        } else {
             ERR_ARG(MQTT_CANT_PUBLISH, p.as_uint());
+            return false;
         }
-    }
-
-    template <typename T, typename CvT>
-    ICACHE_FLASH_ATTR void publish_synced(const Path &p,
-                                          SyncedValue<T, CvT> &val) const
-    {
-        PathBuffer pb;
-        auto path = p.compose(pb);
 
-        publish(path.c_str(), val, p.as_uint());
+        EVENT_ARG(MQTT_PUBLISH, p.as_uint());
+        return true;
     }
 
-    ICACHE_FLASH_ATTR void publish_timer_slot(const Path &p, TimerSlot &val) const
+    ICACHE_FLASH_ATTR bool publish_timer_slot(const Path &p, TimerSlot &val) const
     {
+        if (val.published() || !val.remote_valid())
+            return true;
+
         PathBuffer pb;
 
         // clone paths and set the two possile endings for them
@@ -742,37 +481,36 @@ struct MQTTPublisher {
         mode_path.timer_topic = mqtt::TIMER_MODE;
         time_path.timer_topic = mqtt::TIMER_TIME;
 
-        if (!val.published() && val.remote_valid()) {
-            const auto &remote = val.get_remote();
+        const auto &remote = val.get_remote();
 
-            // holds the converted value between to_str and publish
-            cvt::ValueBuffer vb;
-            auto mode = cvt::Simple::to_str(vb, remote.mode());
-            auto path = mode_path.compose(pb);
-            bool err =
-                client.publish(path.c_str(),
-                               reinterpret_cast<const uint8_t *>(mode.c_str()),
-                               mode.length(),
-                               /*retained*/ MQTT_RETAIN);
-
-            path = time_path.compose(pb);
-            // overwrites the old vb content!
-            auto time = cvt::TimeHHMM::to_str(vb, remote.time());
-            bool err1 =
-                client.publish(path.c_str(),
-                               reinterpret_cast<const uint8_t *>(time.c_str()),
-                               time.length(),
-                               /*retained*/ MQTT_RETAIN);
-
-
-            if (!err || !err1) {
-                ERR_ARG(MQTT_CANT_PUBLISH, p.as_uint());
-            } else {
-                EVENT_ARG(MQTT_PUBLISH, p.as_uint());
-            }
-
-            val.published() = true;
+        // holds the converted value between to_str and publish
+        cvt::ValueBuffer vb;
+        auto mode = cvt::Simple::to_str(vb, remote.mode());
+        auto path = mode_path.compose(pb);
+        bool ok =
+            client.publish(path.c_str(),
+                           reinterpret_cast<const uint8_t *>(mode.c_str()),
+                           mode.length(),
+                           /*retained*/ MQTT_RETAIN);
+
+        path = time_path.compose(pb);
+        // overwrites the old vb content!
+        auto time = cvt::TimeHHMM::to_str(vb, remote.time());
+        bool ok1 =
+            client.publish(path.c_str(),
+                           reinterpret_cast<const uint8_t *>(time.c_str()),
+                           time.length(),
+                           /*retained*/ MQTT_RETAIN);
+
+
+        if (!ok || !ok1) {
+            ERR_ARG(MQTT_CANT_PUBLISH, p.as_uint());
+            return false;
         }
+
+        EVENT_ARG(MQTT_PUBLISH, p.as_uint());
+        val.published() = true;
+        return true;
     }
 
     ICACHE_FLASH_ATTR void publish_eeprom() {
@@ -802,12 +540,23 @@ struct MQTTPublisher {
                 break;
             }
 
-            Path p{addr, false, mqtt::EA_READ, state_min};
-
-            auto &rec = hr->eeprom[state_min];
+            Path p{addr, false, mqtt::EA_READ,
+                   static_cast<uint8_t>(state_min)};
 
             // only publish remote-valid values
-            publish(p, rec);
+            if (!publish_value(p, *hr)) {
+                // a failing dump must not take the whole retry queue. the
+                // rest stays unpublished and CHANGE_EEPROM set, the next
+                // pass over the client picks it up
+                if (retries.count_of(mqtt::EEPROM) >= MQTT_PUBLISH_EEPROM_SLOTS)
+                {
+                    next_client();
+                    return;
+                }
+
+                retries.push(p, cur_time);
+            }
+
             ++state_min;
         }
     }
@@ -831,97 +580,19 @@ struct MQTTPublisher {
             return;
         }
 
-        Path p{addr, mqtt::INVALID_TOPIC};
-
-#define STATE(ST) case ST
-#define NEXT_MIN_STATE ++state_min; break;
-
-        switch (state_min) {
-        STATE(0):
-            p.topic = mqtt::AUTO;
-            publish_synced(p, hr->auto_mode);
-            NEXT_MIN_STATE;
-        STATE(1):
-            p.topic = mqtt::LOCK;
-            publish_synced(p, hr->menu_locked);
-            NEXT_MIN_STATE;
-        STATE(2):
-            p.topic = mqtt::WND;
-            publish(p, hr->mode_window);
-            NEXT_MIN_STATE;
-        STATE(3):
-            // TODO: this is in 0.01 of C, change it to float?
-            p.topic = mqtt::AVG_TMP;
-            publish(p, hr->temp_avg);
-            NEXT_MIN_STATE;
-        STATE(4):
-            // TODO: Battery is in 0.01 of V, change it to float?
-            p.topic = mqtt::BAT;
-            publish(p, hr->bat_avg);
-            NEXT_MIN_STATE;
-        STATE(5):
-            // TODO: Fix formatting for temp_wanted - float?
-            // temp_wanted is in 0.5 C
-            p.topic = mqtt::REQ_TMP;
-            publish_synced(p, hr->temp_wanted);
-            NEXT_MIN_STATE;
-        STATE(6):
-            p.topic = mqtt::VALVE_WTD;
-            publish(p, hr->cur_valve_wtd);
-            NEXT_MIN_STATE;
-        // TODO: test_auto
-        STATE(7):
-            p.topic = mqtt::ERR;
-            publish(p, hr->ctl_err);
-            NEXT_MIN_STATE;
-        STATE(8): {
-            p.topic = mqtt::LAST_SEEN;
-            cvt::ValueBuffer vb;
-            StrMaker sm{vb};
-            sm += hr->last_contact;
-            publish(p, sm.str(), /*ratain*/true);
-            NEXT_MIN_STATE;
-        }
-        STATE(9): {
-            p.topic = mqtt::MODE;
-            cvt::ValueBuffer vb;
-            StrMaker sm{vb};
-
-            // Combining off/open and auto/manual for a simple HASS integration here
-            if (hr->temp_wanted.get_remote() == TEMP_OFF)
-                sm += S_MODE_OFF;
-            else if (hr->temp_wanted.get_remote() == TEMP_OPEN)
-                sm += S_MODE_OPEN;
-            else if (hr->auto_mode.get_remote())
-                sm += S_MODE_AUTO;
-            else
-                sm += S_MODE_MANUAL;
-
-            publish(p, sm.str());
-            NEXT_MIN_STATE;
-        }
-#ifdef MQTT_JSON
-        STATE(10): {
-            p.topic = mqtt::STATE;
-            BufferHolder<160> buf;
-            StrMaker sm{buf};
-            json::append_client_attr(sm, *hr);
-            publish(p, sm.str());
-            NEXT_MIN_STATE;
+        // one topic per call
+        if (state_min < FREQUENT_TOPIC_COUNT) {
+            Path p{addr, FREQUENT_TOPICS[state_min]};
+            publish_or_retry(p, *hr);
+            ++state_min;
+            return;
         }
-#endif
 
-        default:
-            DBG("(PUB F)");
-            // clear out the change bit
-            states[addr] &= ~CHANGE_FREQUENT;
-            next_major(); // moves to next major state
-            break;
-        }
-#undef STATE
-#undef NEXT_MIN_STATE
+        DBG("(PUB F)");
+        // clear out the change bit
+        states[addr] &= ~CHANGE_FREQUENT;
+        next_major(); // moves to next major state
     }
-
     ICACHE_FLASH_ATTR void publish_timers() {
         auto *hr = master.model[addr];
         if (!hr) {
@@ -965,13 +636,70 @@ struct MQTTPublisher {
         // only publish timers that have bit set in mask
         Path p{addr, mqtt::TIMER, false, mqtt::TIMER_NONE, day, slot};
 
-        // TODO: Rework this to implicit conversion system
-        publish_timer_slot(p, hr->timers[day][slot]);
+        publish_or_retry(p, *hr);
+    }
+
+    /// applies a batch of staged set requests to the model
+    ICACHE_FLASH_ATTR void apply_commands() {
+        Command cmd;
+        bool chained = false;
+
+        // chained commands (a batch) never get split between update calls
+        for (uint8_t i = 0;
+             (i < MQTT_COMMAND_BATCH || chained) && commands.pop(cmd);
+             ++i)
+        {
+            chained = cmd.chained;
+
+            auto *hr = master.model[cmd.addr];
+            if (!hr) {
+                ERR(MQTT_CALLBACK_BAD_ADDR);
+                continue;
+            }
+
+            // not an error. change happened on the client model, sync is lost
+            if (cmd.apply(*hr)) {
+                hr->synced = false;
+                master.model.touch(*hr);
+            } else
+                ERR_ARG(MQTT_INVALID_TOPIC_VALUE, cmd.addr);
+        }
     }
 
+    /// stages all commands of a set/batch message, or none if invalid
+    ICACHE_FLASH_ATTR void batch_callback(byte *payload, unsigned int length)
+    {
+        Command cmds[MQTT_COMMAND_QUEUE_LEN];
+        int n = parse_batch((const char *)payload, length, cmds,
+                            MQTT_COMMAND_QUEUE_LEN);
+
+        if (n < 0) {
+            ERR(MQTT_INVALID_BATCH);
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (!master.model[cmds[i].addr]) {
+                ERR_ARG(MQTT_CALLBACK_BAD_ADDR, cmds[i].addr);
+                return;
+            }
+        }
+
+        if (commands.push_all(cmds, n))
+            EVENT_ARG(MQTT_BATCH, n);
+    }
+
+    /** Runs inside client.loop(). Only parses the set request into commands,
+     *  which get applied to the model later in apply_commands(), so a burst
+     *  of (retained) messages does not touch the model here. */
     ICACHE_FLASH_ATTR void callback(char *topic, byte *payload,
                                     unsigned int length)
     {
+        if (batch_topic == Str{topic, static_cast<unsigned>(strlen(topic))}) {
+            batch_callback(payload, length);
+            return;
+        }
+
         // only allowed on some endpoints. will switch through
         Path p = Path::parse(topic);
 
@@ -985,8 +713,7 @@ struct MQTTPublisher {
             return;
         }
 
-        auto *hr = master.model[p.addr];
-        if (!hr) {
+        if (!master.model[p.addr]) {
             ERR(MQTT_CALLBACK_BAD_ADDR);
             return;
         }
@@ -996,55 +723,43 @@ struct MQTTPublisher {
         Str val{(const char *)payload, length};
 
         switch (p.topic) {
-        case mqtt::REQ_TMP: ok = hr->temp_wanted.set_requested_from_str(val); break;
-        case mqtt::AUTO: ok = hr->auto_mode.set_requested_from_str(val); break;
+        case mqtt::REQ_TMP: {
+            uint8_t temp;
+            ok = cvt::TempHalfC::from_str(val, temp)
+                 && commands.push({p.addr, Command::TEMP, temp});
+            break;
+        }
+        case mqtt::AUTO:
+        case mqtt::LOCK: {
+            bool b;
+            ok = cvt::Simple::from_str(val, b)
+                 && commands.push({p.addr,
+                                   p.topic == mqtt::AUTO ? Command::AUTO
+                                                         : Command::LOCK,
+                                   b});
+            break;
+        }
         case mqtt::MODE: {
-            // off will set temp to TEMP_OFF
-            auto mode = parse_mode(val.c_str());
-
-            switch (mode) {
-            case MODE_OFF: // off sets manual and 4.5 degrees
-                hr->auto_mode.set_requested(false);
-                hr->temp_wanted.set_requested(TEMP_OFF);
-                ok = true;
-                break;
-            case MODE_OPEN: // open sets over 30C and manual
-                hr->auto_mode.set_requested(false);
-                hr->temp_wanted.set_requested(TEMP_OPEN);
-                ok = true;
-                break;
-            case MODE_AUTO:
-                ok = true;
-                hr->auto_mode.set_requested(true); break;
-            case MODE_MANUAL:
-                ok = true;
-                hr->auto_mode.set_requested(false); break;
-            default:
-                ERR(MQTT_INVALID_TOPIC_VALUE);
-                ok = false;
-            }
+            // off/open also change the temperature, these go in together
+            Command cmds[2];
+            uint8_t n = mode_commands(p.addr, parse_mode(val), cmds);
+            ok = n && commands.push_all(cmds, n);
+            break;
         }
-        case mqtt::LOCK: ok = hr->menu_locked.set_requested_from_str(val); break;
         case mqtt::EEPROM: {
-            //            ok = hr->eeprom;
             // we're in set mode here. for reads we invalidate the remote and let it be read again
             if (p.eeprom_access == EA_WRITE) {
-                int ival = 0;
-                if (!val.toInt(ival)) {
-                    ERR(MQTT_INVALID_TOPIC_VALUE);
-                    ok = false;
-                    break;
-                }
-                hr->eeprom[p.eeprom_address].set_requested(ival);
+                uint8_t ival = 0;
+                ok = val.toInt(ival)
+                     && commands.push({p.addr, Command::EEPROM_WRITE, ival,
+                                       p.eeprom_address});
             } else if (p.eeprom_access == EA_READ) {
                 // we got a re-read request, we do it without questioning
-                // we unmask the value in case it was not seen since reboot
-                // and also invalidate remote in case it was already read...
-                hr->eeprom[p.eeprom_address].masked() = false;
-                hr->eeprom[p.eeprom_address].remote_valid() = false;
+                ok = commands.push({p.addr, Command::EEPROM_READ, 0,
+                                    p.eeprom_address});
             } else {
                 ERR(MQTT_INVALID_TOPIC);
-                ok = false;
+                return;
             }
 
             break;
@@ -1053,32 +768,41 @@ struct MQTTPublisher {
             // check day/slot first
             if (p.day >= TIMER_DAYS) {
                 ERR_ARG(MQTT_INVALID_TIMER_TOPIC, p.day | 0x10);
-                break;
+                return;
             }
 
             if (p.slot >= TIMER_SLOTS_PER_DAY) {
                 ERR_ARG(MQTT_INVALID_TIMER_TOPIC, p.slot | 0x20);
-                break;
+                return;
             }
 
+            uint8_t arg = Command::timer_arg(p.day, p.slot);
+
             // subswitch based on the timer topic
             switch (p.timer_topic) {
-            case mqtt::TIMER_MODE: ok = hr->set_timer_mode(p.day, p.slot, val); break;
-            case mqtt::TIMER_TIME: ok = hr->set_timer_time(p.day, p.slot, val); break;
-            default: ERR(MQTT_INVALID_TIMER_TOPIC);
+            case mqtt::TIMER_MODE: {
+                uint8_t mode;
+                ok = cvt::Simple::from_str(val, mode)
+                     && commands.push({p.addr, Command::TIMER_MODE, mode, arg});
+                break;
+            }
+            case mqtt::TIMER_TIME: {
+                uint16_t time;
+                ok = cvt::TimeHHMM::from_str(val, time)
+                     && commands.push({p.addr, Command::TIMER_TIME, time, arg});
+                break;
+            }
+            default: ERR(MQTT_INVALID_TIMER_TOPIC); return;
             }
             break;
         }
         default: ERR(MQTT_INVALID_TOPIC); return;
         }
 
-        // not an error. change happened on the client model, sync is lost
-        if (ok) hr->synced = false;
-
         EVENT_ARG(MQTT_CALLBACK, p.as_uint());
         DBG("(MQTT %d %d %d)", p.addr, p.as_uint(), ok ? 1 : 0);
 
-        // conversion went sideways
+        // conversion went sideways (or the command queue is full)
         if (!ok) {
             ERR_ARG(MQTT_INVALID_TOPIC_VALUE, p.as_uint());
 #ifdef VERBOSE
@@ -1094,15 +818,29 @@ struct MQTTPublisher {
     Config &config;
     HR20Master &master;
     WiFiClient wifiClient;
+    Link link;
     /// seriously, const correctness anyone? PubSubClient does not have single const method...
     mutable PubSubClient client;
+    Connection conn;
+    PathBuffer sub_topic;
+    PathBuffer batch_buf;
+    Str batch_topic; // points to batch_buf
     uint32_t states[MAX_HR_ADDR];
 
     // Publisher state machine
     uint8_t addr = 0;
     uint8_t  state_maj = 0; // state category (FREQUENT, CALENDAR)
     uint16_t state_min = 0; // state detail (depends on major state)
-    time_t   last_conn = 0; // last connection attempt
+    time_t   cur_time  = 0; // time of the current update call
+
+    // counter publishing pass position and start time
+    uint16_t counters_cursor = 0;
+    time_t   counters_time   = 0;
+
+    // failed publishes waiting for another attempt
+    PublishQ retries;
+    // set requests waiting to be applied to the model
+    CommandQ<MQTT_COMMAND_QUEUE_LEN> commands;
 };
 
 } // namespace mqtt
@@ -0,0 +1,357 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+#include <WiFiClient.h>
+
+#include "config.h"
+#include "debug.h"
+#include "error.h"
+#include "eventlog.h"
+
+namespace hr20 {
+namespace mqtt {
+
+/** The client PubSubClient talks through. Forwards to the network client,
+ * except while a CONNACK is held: PubSubClient::connect() sends CONNECT and
+ * spins until the CONNACK arrives. Connection sends CONNECT itself and
+ * polls for the answer, then runs connect() against the held CONNACK with
+ * the CONNECT it writes swallowed, so PubSubClient takes the session as
+ * its own without waiting.
+ */
+struct Link : public Client {
+    static constexpr const uint8_t CONNACK_SIZE = 4;
+
+    explicit Link(Client &net) : net(net) {}
+
+    /// serves connack to reads and swallows writes until release()
+    void hold(const uint8_t *connack) {
+        memcpy(held, connack, CONNACK_SIZE);
+        held_pos = 0;
+        holding  = true;
+    }
+
+    void release() { holding = false; }
+
+    // PubSubClient before 2.8 connects again even if TCP is up, which would
+    // drop the connection the held CONNACK stands for
+    int connect(IPAddress ip, uint16_t port) override {
+        return holding ? 1 : net.connect(ip, port);
+    }
+
+    int connect(const char *host, uint16_t port) override {
+        return holding ? 1 : net.connect(host, port);
+    }
+
+    size_t write(uint8_t b) override { return holding ? 1 : net.write(b); }
+
+    size_t write(const uint8_t *buf, size_t size) override {
+        return holding ? size : net.write(buf, size);
+    }
+
+    int available() override {
+        return holding ? CONNACK_SIZE - held_pos : net.available();
+    }
+
+    int read() override {
+        if (!holding) return net.read();
+        return held_pos < CONNACK_SIZE ? held[held_pos++] : -1;
+    }
+
+    int read(uint8_t *buf, size_t size) override {
+        if (!holding) return net.read(buf, size);
+
+        size_t n = 0;
+        for (; n < size && held_pos < CONNACK_SIZE; ++n)
+            buf[n] = held[held_pos++];
+        return n;
+    }
+
+    int peek() override {
+        if (!holding) return net.peek();
+        return held_pos < CONNACK_SIZE ? held[held_pos] : -1;
+    }
+
+    void flush() override {
+        if (!holding) net.flush();
+    }
+
+    void stop() override {
+        holding = false;
+        net.stop();
+    }
+
+    uint8_t connected() override { return net.connected(); }
+    operator bool() override { return net.connected(); }
+
+protected:
+    Client &net;
+    uint8_t held[CONNACK_SIZE];
+    uint8_t held_pos = 0;
+    bool holding     = false;
+};
+
+/** Connection state machine for the MQTT broker.
+ *
+ * Splits the connection into DNS resolve, TCP connect, MQTT CONNECT, CONNACK
+ * and subscription steps. Every call to update() does at most one of these.
+ * CONNECT is sent without waiting and the CONNACK is polled for, the DNS
+ * and TCP steps block for MQTT_STEP_TIMEOUT at most, which keeps every step
+ * inside the idle window. Failed attempts back off exponentially with
+ * random jitter.
+ */
+struct Connection {
+    enum State {
+        DISCONNECTED = 0, // waiting for the backoff to pass
+        RESOLVE,          // resolve the broker's address
+        TCP_CONNECT,      // open the TCP connection
+        MQTT_CONNECT,     // send CONNECT
+        CONNACK,          // wait for CONNACK
+        SUBSCRIBE,        // subscribe to the set sub-branch
+        CONNECTED
+    };
+
+    ICACHE_FLASH_ATTR Connection(Config &config,
+                                 WiFiClient &wifi,
+                                 Link &link,
+                                 PubSubClient &client)
+        : config(config), wifi(wifi), link(link), client(client)
+    {}
+
+    /// topic we (re)subscribe to after every successful connect
+    ICACHE_FLASH_ATTR void begin(const char *sub_topic) {
+        subscription = sub_topic;
+        port = atoi(config.mqtt_port);
+        client.setSocketTimeout(MQTT_CONNACK_TIMEOUT);
+    }
+
+    /// advances the state machine by one step. returns true if connected
+    ICACHE_FLASH_ATTR bool update() {
+        if (state == CONNECTED) {
+            if (client.connected()) return true;
+
+            // lost the connection. Try again soon, but not immediately
+            DBG("(MQTT LOST)");
+            failed(CONNECTED);
+            return false;
+        }
+
+        // no point in trying without wifi
+        if (WiFi.status() != WL_CONNECTED) return false;
+
+        switch (state) {
+        case DISCONNECTED:
+            if ((long)(millis() - next_attempt) < 0) return false;
+            DBG("(MQTT CONN)");
+            state = resolved ? TCP_CONNECT : RESOLVE;
+            return false;
+        case RESOLVE:
+            resolve();
+            return false;
+        case TCP_CONNECT:
+            tcp_connect();
+            return false;
+        case MQTT_CONNECT:
+            mqtt_connect();
+            return false;
+        case CONNACK:
+            connack();
+            return false;
+        case SUBSCRIBE:
+            client.subscribe(subscription);
+            EVENT(MQTT_SUBSCRIBE);
+            state = CONNECTED;
+            return true;
+        default:
+            state = DISCONNECTED;
+            return false;
+        }
+    }
+
+    bool connected() const { return state == CONNECTED; }
+
+    // count of successful (re)connects
+    uint32_t connects = 0;
+    // count of failed connection attempts
+    uint32_t failures = 0;
+
+protected:
+    ICACHE_FLASH_ATTR void resolve() {
+        // literal IP addresses need no DNS
+        if (!ip.fromString(config.mqtt_server)
+            && !WiFi.hostByName(config.mqtt_server, ip, MQTT_STEP_TIMEOUT))
+        {
+            failed(RESOLVE);
+            return;
+        }
+
+        resolved = true;
+        state = TCP_CONNECT;
+    }
+
+    ICACHE_FLASH_ATTR void tcp_connect() {
+        wifi.setTimeout(MQTT_STEP_TIMEOUT);
+
+        if (!wifi.connect(ip, port)) {
+            // the address might have changed, resolve again next time
+            resolved = false;
+            failed(TCP_CONNECT);
+            return;
+        }
+
+        state = MQTT_CONNECT;
+    }
+
+    /// user name to log in with, nullptr for none
+    ICACHE_FLASH_ATTR const char *user() const {
+        size_t unl = ::strnlen(config.mqtt_user, sizeof(config.mqtt_user));
+        return (unl > 0) && (unl < sizeof(config.mqtt_user)) ? config.mqtt_user
+                                                              : nullptr;
+    }
+
+    /// appends s with its length, at most N - 1 chars
+    template<size_t N>
+    ICACHE_FLASH_ATTR static void put_str(uint8_t *&p, const char (&s)[N]) {
+        size_t len = ::strnlen(s, N - 1);
+        *p++ = len >> 8;
+        *p++ = len & 0xFF;
+        memcpy(p, s, len);
+        p += len;
+    }
+
+    /// sends CONNECT the way PubSubClient::connect(id, user, pass) would
+    ICACHE_FLASH_ATTR void mqtt_connect() {
+        // header and remaining length, protocol name and level, flags,
+        // keepalive, then the three strings with their lengths
+        uint8_t buf[2 + 10 + 2 + sizeof(config.mqtt_client_id)
+                    + 2 + sizeof(config.mqtt_user)
+                    + 2 + sizeof(config.mqtt_pass)];
+        // so the remaining length fits a single byte
+        static_assert(sizeof(buf) - 2 < 128, "CONNECT too long");
+
+        const char *usr = user();
+
+        uint8_t *p = buf + 2;
+        put_str(p, "MQTT");
+        *p++ = 4;                       // 3.1.1
+        *p++ = 0x02 | (usr ? 0xC0 : 0); // clean session, user and password
+        *p++ = MQTT_KEEPALIVE >> 8;
+        *p++ = MQTT_KEEPALIVE & 0xFF;
+        put_str(p, config.mqtt_client_id);
+        if (usr) {
+            put_str(p, config.mqtt_user);
+            put_str(p, config.mqtt_pass);
+        }
+
+        buf[0] = 0x10; // CONNECT
+        buf[1] = p - (buf + 2);
+
+        size_t size = p - buf;
+        if (wifi.write(buf, size) != size) {
+            wifi.stop();
+            failed(MQTT_CONNECT);
+            return;
+        }
+
+        sent_at = millis();
+        state = CONNACK;
+    }
+
+    ICACHE_FLASH_ATTR void connack() {
+        if (wifi.available() < Link::CONNACK_SIZE) {
+            if (wifi.connected()
+                && millis() - sent_at < MQTT_CONNACK_TIMEOUT * 1000UL)
+                return;
+
+            wifi.stop();
+            failed(CONNACK);
+            return;
+        }
+
+        uint8_t ack[Link::CONNACK_SIZE];
+        wifi.read(ack, sizeof(ack));
+
+        // CONNACK, 2 bytes long, return code 0 is connection accepted
+        if (ack[0] != 0x20 || ack[1] != 0x02 || ack[3] != 0) {
+            DBG("(MQTT REFUSED %d)", ack[0] == 0x20 ? ack[3] : -1);
+            wifi.stop();
+            failed(CONNACK);
+            return;
+        }
+
+        // PubSubClient finds the TCP connection open, writes a CONNECT that
+        // gets swallowed and reads the held CONNACK
+        client.setServer(ip, port);
+        link.hold(ack);
+        bool ok = client.connect(config.mqtt_client_id, user(),
+                                 config.mqtt_pass);
+        link.release();
+
+        if (!ok) {
+            wifi.stop();
+            failed(CONNACK);
+            return;
+        }
+
+        EVENT(MQTT_CONN);
+        ++connects;
+        backoff = 0;
+        state = SUBSCRIBE;
+    }
+
+    /// schedules next attempt with exponential backoff and jitter
+    ICACHE_FLASH_ATTR void failed(State st) {
+        if (st != CONNECTED) {
+            ERR_ARG(MQTT_CANNOT_CONNECT, st);
+            ++failures;
+        }
+
+        unsigned long wait = MQTT_RECONNECT_TIME * 1000UL;
+        wait <<= backoff;
+        if (wait > MQTT_RECONNECT_MAX * 1000UL)
+            wait = MQTT_RECONNECT_MAX * 1000UL;
+        else
+            ++backoff;
+
+        // jitter of up to a quarter of the wait
+        next_attempt = millis() + wait + random(wait / 4);
+        state = DISCONNECTED;
+    }
+
+    Config &config;
+    WiFiClient &wifi;
+    Link &link;
+    PubSubClient &client;
+
+    const char *subscription = nullptr;
+    IPAddress ip;
+    uint16_t port = 0;
+    bool resolved = false;
+
+    State state = DISCONNECTED;
+    uint8_t backoff = 0; // exponent of the current reconnect delay
+    unsigned long next_attempt = 0;
+    unsigned long sent_at = 0; // CONNECT sent
+};
+
+} // namespace mqtt
+} // namespace hr20
@@ -0,0 +1,618 @@
+/*
+ * HR20 ESP Master
+ * ---------------
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "debug.h"
+#include "error.h"
+#include "util.h"
+#include "command.h"
+#include "str.h"
+
+namespace hr20 {
+namespace mqtt {
+
+// topic enum. Each has different initial letter for simple parsing
+enum Topic {
+    AVG_TMP = 1,
+    BAT     = 2,
+    ERR     = 3,
+    LOCK    = 4,
+    AUTO    = 5,
+    REQ_TMP = 6,
+    VALVE_WTD = 7,
+    WND       = 8,
+    LAST_SEEN = 9,
+    TIMER     = 10,
+    STATE     = 11,
+    EEPROM    = 12,
+    MODE      = 13,
+    LINK_QUALITY = 14,
+    RADIO        = 15,
+    INVALID_TOPIC = 255
+};
+
+enum TimerTopic {
+    TIMER_NONE = 0,
+    TIMER_TIME,
+    TIMER_MODE,
+    INVALID_TIMER_TOPIC = 255
+};
+
+enum EEPROMAccess {
+    EA_READ  = 0,
+    EA_WRITE = 1,
+    INVALID_EEPROM_TOPIC = 255
+};
+
+enum Mode {
+    MODE_OFF = 0,
+    MODE_AUTO,
+    MODE_MANUAL,
+    MODE_OPEN,
+    INVALID_MODE_TYPE = 255
+};
+
+static const char *S_AVG_TMP   = "average_temp";
+static const char *S_BAT       = "battery";
+static const char *S_ERR       = "error";
+static const char *S_EEPROM     = "eeprom";
+static unsigned    S_EEPROM_LEN = 6;
+static const char *S_LOCK      = "lock";
+static const char *S_MODE      = "mode"; // this is a OFF/MANUAL/AUTO mode info topic
+static const char *S_AUTO      = "auto";
+static const char *S_REQ_TMP   = "requested_temp"; // 14
+static const char *S_VALVE_WTD = "valve_wanted";
+static const char *S_WND       = "window";
+static const char *S_LAST_SEEN = "last_seen";
+static const char *S_LINK_QUALITY = "link_quality";
+static const char *S_RADIO     = "radio";
+static const char *S_STATE     = "state";
+
+static const char *S_TIMER     = "timer";
+static unsigned    S_TIMER_LEN = 5;
+
+// timer subtopics
+static const char *S_TIMER_MODE = "mode";
+static const char *S_TIMER_TIME = "time";
+
+// error/event counters branch, global and per client
+static const char *S_COUNTERS   = "counters";
+
+// set topic branch mid-prefix
+static const char *S_SET_MODE   = "set";
+// multi-client set topic in the set branch
+static const char *S_BATCH      = "batch";
+
+// set/batch json fields
+static const char *S_B_TEMP     = "temp";
+static const char *S_B_TIMERS   = "timers";
+
+// eeprom access strs
+static const char *S_EA_READ  = "read";
+static const char *S_EA_WRITE = "write";
+
+// valve modes
+static const char *S_MODE_OFF    = "off";
+static const char *S_MODE_AUTO   = "auto";
+static const char *S_MODE_MANUAL = "manual";
+static const char *S_MODE_OPEN   = "open";
+
+constexpr const uint8_t MAX_MQTT_PATH_LENGTH = 128;
+using PathBuffer = BufferHolder<MAX_MQTT_PATH_LENGTH>;
+
+ICACHE_FLASH_ATTR static const char *topic_str(Topic topic) {
+    switch (topic) {
+    case AVG_TMP:   return S_AVG_TMP;
+    case BAT:       return S_BAT;
+    case ERR:       return S_ERR;
+    case EEPROM:    return S_EEPROM;
+    case LOCK:      return S_LOCK;
+    case AUTO:      return S_AUTO;
+    case MODE:      return S_MODE;
+    case REQ_TMP:   return S_REQ_TMP;
+    case VALVE_WTD: return S_VALVE_WTD;
+    case WND:       return S_WND;
+    case LAST_SEEN: return S_LAST_SEEN;
+    case LINK_QUALITY: return S_LINK_QUALITY;
+    case RADIO:     return S_RADIO;
+    case STATE:     return S_STATE;
+    case TIMER:     return S_TIMER;
+    default:
+        return nullptr;
+    }
+}
+
+ICACHE_FLASH_ATTR static const char *eeprom_access_str(EEPROMAccess ea) {
+    switch (ea) {
+    case EA_READ:   return S_EA_READ;
+    case EA_WRITE:  return S_EA_WRITE;
+    default:
+        return nullptr;
+    }
+}
+
+ICACHE_FLASH_ATTR static const char *timer_topic_str(TimerTopic sub) {
+    switch (sub) {
+    case TIMER_TIME: return S_TIMER_TIME;
+    case TIMER_MODE: return S_TIMER_MODE;
+    default:
+        return nullptr;
+    }
+}
+
+ICACHE_FLASH_ATTR static Topic parse_topic(const char *top) {
+    switch (*top) {
+    case 'a':
+        if (strcmp(top, S_AVG_TMP) == 0) return AVG_TMP;
+        if (strcmp(top, S_AUTO) == 0) return AUTO;
+        return INVALID_TOPIC;
+    case 'b':
+        if (strcmp(top, S_BAT) == 0) return BAT;
+        return INVALID_TOPIC;
+    case 'e':
+        if (strcmp(top, S_ERR) == 0) return ERR;
+        // sub-trees, the topic continues past a separator
+        if (strncmp(top, S_EEPROM, S_EEPROM_LEN) == 0
+            && top[S_EEPROM_LEN] == '/')
+            return EEPROM;
+        return INVALID_TOPIC;
+    case 'l':
+        if (strcmp(top, S_LOCK) == 0) return LOCK;
+        if (strcmp(top, S_LAST_SEEN) == 0) return LAST_SEEN;
+        if (strcmp(top, S_LINK_QUALITY) == 0) return LINK_QUALITY;
+        return INVALID_TOPIC;
+    case 'm':
+        if (strcmp(top, S_MODE) == 0) return MODE;
+        return INVALID_TOPIC;
+    case 'r':
+        if (strcmp(top, S_REQ_TMP) == 0) return REQ_TMP;
+        if (strcmp(top, S_RADIO) == 0) return RADIO;
+        return INVALID_TOPIC;
+    case 's':
+        if (strcmp(top, S_STATE) == 0) return STATE;
+        return INVALID_TOPIC;
+    case 't':
+        if (strncmp(top, S_TIMER, S_TIMER_LEN) == 0 && top[S_TIMER_LEN] == '/')
+            return TIMER;
+        return INVALID_TOPIC;
+    case 'v':
+        if (strcmp(top, S_VALVE_WTD) == 0) return VALVE_WTD;
+        return INVALID_TOPIC;
+    case 'w':
+        if (strcmp(top, S_WND) == 0) return WND;
+        return INVALID_TOPIC;
+    default:
+        return INVALID_TOPIC;
+    }
+}
+
+ICACHE_FLASH_ATTR static TimerTopic parse_timer_topic(const char *top) {
+    if (!top) return INVALID_TIMER_TOPIC;
+
+    if (top[0] == 't') {
+        if (strcmp(top, S_TIMER_TIME) == 0) return TIMER_TIME;
+        return INVALID_TIMER_TOPIC;
+    }
+
+    if (top[0] == 'm') {
+        if (strcmp(top, S_TIMER_MODE) == 0) return TIMER_MODE;
+        return INVALID_TIMER_TOPIC;
+    }
+
+    return INVALID_TIMER_TOPIC;
+}
+
+ICACHE_FLASH_ATTR static EEPROMAccess parse_eeprom_access(const char *top) {
+    if (!top) return INVALID_EEPROM_TOPIC;
+
+    if (top[0] == 'r') {
+        if (strcmp(top, S_EA_READ) == 0) return EA_READ;
+        return INVALID_EEPROM_TOPIC;
+    }
+
+    if (top[0] == 'w') {
+        if (strcmp(top, S_EA_WRITE) == 0) return EA_WRITE;
+        return INVALID_EEPROM_TOPIC;
+    }
+
+    return INVALID_EEPROM_TOPIC;
+}
+
+ICACHE_FLASH_ATTR static bool str_eq(const Str &s, const char *lit) {
+    return s == Str{lit, static_cast<unsigned>(strlen(lit))};
+}
+
+// payloads are not zero terminated, so this parses a Str
+ICACHE_FLASH_ATTR static Mode parse_mode(const Str &top) {
+    if (str_eq(top, S_MODE_OFF))    return MODE_OFF;
+    if (str_eq(top, S_MODE_OPEN))   return MODE_OPEN;
+    if (str_eq(top, S_MODE_AUTO))   return MODE_AUTO;
+    if (str_eq(top, S_MODE_MANUAL)) return MODE_MANUAL;
+
+    return INVALID_MODE_TYPE;
+}
+
+/// fills cmds (2 entries max) with commands for the given mode. Returns the
+/// command count, 0 for invalid mode
+ICACHE_FLASH_ATTR static uint8_t mode_commands(uint8_t addr, Mode mode,
+                                               Command *cmds)
+{
+    switch (mode) {
+    case MODE_OFF: // off sets manual and 4.5 degrees
+        cmds[0] = {addr, Command::AUTO, false};
+        cmds[1] = {addr, Command::TEMP, TEMP_OFF};
+        return 2;
+    case MODE_OPEN: // open sets over 30C and manual
+        cmds[0] = {addr, Command::AUTO, false};
+        cmds[1] = {addr, Command::TEMP, TEMP_OPEN};
+        return 2;
+    case MODE_AUTO:
+        cmds[0] = {addr, Command::AUTO, true};
+        return 1;
+    case MODE_MANUAL:
+        cmds[0] = {addr, Command::AUTO, false};
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/** parses the set/batch json payload into cmds. Format:
+ *  {"ADDR": {"temp": 21.5, "mode": "auto", "auto": true, "lock": false,
+ *            "timers": [[DAY, SLOT, MODE, "HH:MM"], ...],
+ *            "eeprom": {"EE_ADDR": VALUE or "read", ...}}, ...}
+ *  All fields are optional. Returns the command count or -1 if the payload
+ *  was malformed or did not fit into max commands. Not reentrant.
+ */
+int parse_batch(const char *json, unsigned len, Command *cmds, uint8_t max);
+
+// mqtt path parser/composer
+struct Path {
+    static const char SEPARATOR = '/';
+    static const char WILDCARD  = '#';
+    static const char *prefix;
+
+    // static method that overrides prefix
+    ICACHE_FLASH_ATTR static void begin(const char *pfx) {
+        prefix = pfx;
+    }
+
+    ICACHE_FLASH_ATTR Path() {}
+
+    // constructor for normal or timer topics
+    ICACHE_FLASH_ATTR Path(uint8_t addr,
+                           Topic t,
+                           bool set_mode = false,
+                           TimerTopic st = TIMER_NONE,
+                           uint8_t day   = 0,
+                           uint8_t slot  = 0)
+        : addr(addr),
+          day(day),
+          slot(slot),
+          topic(t),
+          timer_topic(st),
+          set_mode(set_mode)
+    {}
+
+    // this constructs eeprom access topics
+    ICACHE_FLASH_ATTR Path(uint8_t addr,
+                           bool set_mode,
+                           EEPROMAccess ea,
+                           uint8_t ee_address)
+        : addr(addr),
+          day(0),
+          slot(0),
+          topic(EEPROM),
+          timer_topic(TIMER_NONE),
+          set_mode(set_mode),
+          eeprom_access(ea),
+          eeprom_address(ee_address)
+    {}
+
+    ICACHE_FLASH_ATTR static Str compose_set_prefix_wildcard(Buffer b) {
+        StrMaker rv(b);
+
+        rv += prefix;
+        rv += SEPARATOR;
+        rv += S_SET_MODE;
+        rv += SEPARATOR;
+        rv += WILDCARD;
+
+        return rv.str();
+    }
+
+
+    ICACHE_FLASH_ATTR static Str compose_set_batch(Buffer b) {
+        StrMaker rv(b);
+
+        rv += prefix;
+        rv += SEPARATOR;
+        rv += S_SET_MODE;
+        rv += SEPARATOR;
+        rv += S_BATCH;
+
+        return rv.str();
+    }
+
+    ICACHE_FLASH_ATTR Str compose(Buffer b) const {
+        StrMaker rv(b);
+
+        rv += prefix;
+        rv += SEPARATOR;
+
+        if (set_mode) {
+            rv += S_SET_MODE;
+            rv += SEPARATOR;
+        }
+
+        rv += addr;
+        rv += SEPARATOR;
+        rv += topic_str(topic);
+
+        if (topic == EEPROM) {
+            rv += SEPARATOR;
+            rv += eeprom_address;
+
+            // In set mode we include read/write op. specifier
+            if (set_mode) {
+                rv += SEPARATOR;
+                rv += eeprom_access_str(eeprom_access);
+            }
+        } else if (topic == TIMER) {
+            rv += SEPARATOR;
+            rv += day;
+            rv += SEPARATOR;
+            rv += slot;
+            rv += SEPARATOR;
+            rv += timer_topic_str(timer_topic);
+        }
+
+        return rv.str();
+    }
+
+    ICACHE_FLASH_ATTR static Path parse(const char *p) {
+        // compare prefix first
+        const char *pos = p;
+        bool set_mode = false;
+
+        // skips the prefix path and compares if it equals
+        // also skips leading separators
+        // skip the prefix (1..n tokens)
+        pos = skip_prefix(pos, prefix);
+
+        // prefix does not match!
+        if (!pos) return {};
+
+        // premature end (just the prefix)
+        if (!*pos) return {};
+
+        // tokenize the address
+        auto addr = token(pos);
+
+        static const Token S_SET_TOK{S_SET_MODE, strlen(S_SET_MODE)};
+
+        // is it by chance a set sub_branch?
+        if (cmp_tokens(addr, S_SET_TOK)) {
+            pos = skip_token(addr);
+            set_mode = true;
+
+            if (!pos) return {};
+
+            // re-read the token for address
+            addr = token(pos);
+        }
+
+        // convert to number
+        uint8_t address;
+        if (!to_num(&pos, addr.second, address)) return {};
+
+        // is the next char a separator? if not then it wasn't a valid path
+        if (*pos != Path::SEPARATOR) return {};
+
+        ++pos;
+
+        // now follows the ending element. Parse via parse_topic
+        Topic top = parse_topic(pos);
+
+        if (top == INVALID_TOPIC) return {};
+
+        if (top == EEPROM) {
+            // eeprom is a sub-tree
+            // here we see these
+            // set/.../eeprom/addr/read  - read request to an address (value sent is ignored)
+            // set/.../eeprom/addr/write - write request with value for addr written to this topic
+            // .../eeprom/addr - value as gathered from client with specified topic
+
+            // skip the token 'eeprom'
+            auto ee_topic_t = token(pos);
+            pos = ee_topic_t.first + ee_topic_t.second;
+            if (*pos != Path::SEPARATOR) return {};
+            ++pos;
+
+            // unless read mode is set, we expect an address as a continuation
+            auto addr_t = token(pos);
+            uint8_t ee_addr;
+            if (!to_num(&pos, addr_t.second, ee_addr)) return {};
+
+            // in set mode we expect either read/write tokens next
+            EEPROMAccess ea = EA_READ;
+            if (set_mode) {
+                // is the next char a separator? if not then it wasn't a valid path
+                if (*pos != Path::SEPARATOR) return {};
+                ++pos;
+
+                ea = parse_eeprom_access(pos);
+
+                if (ea == INVALID_EEPROM_TOPIC) return {};
+            }
+
+            return {address, set_mode, ea, ee_addr};
+        } else if (top == TIMER) {
+            // timer subtree... .../timer/day/slot/[mode/time]
+            // skip the 'timer' token
+            auto tt_topic_t = token(pos);
+            pos = tt_topic_t.first + tt_topic_t.second;
+
+            if (*pos != Path::SEPARATOR) return {};
+            ++pos;
+
+            // day
+            auto d_t = token(pos);
+            uint8_t d;
+            if (!to_num(&pos, d_t.second, d)) return {};
+
+            // is the next char a separator? if not then it wasn't a valid path
+            if (*pos != Path::SEPARATOR) return {};
+            ++pos;
+
+            auto s_t = token(pos);
+            uint8_t s;
+            if (!to_num(&pos, s_t.second, s)) return {};
+
+            // is the next char a separator? if not then it wasn't a valid path
+            if (*pos != Path::SEPARATOR) return {};
+            ++pos;
+
+            // now timer topic
+            auto tt = parse_timer_topic(pos);
+
+            if (tt == INVALID_TIMER_TOPIC) return {};
+
+            // whole timer specification is okay
+            return {address, top, set_mode, tt, d, s};
+        }
+
+        return {address, top, set_mode};
+    }
+
+    /// parses the cnt chars at *p as a number into res, advancing *p past
+    /// them. Returns false unless all are digits and the number fits uint8_t
+    ICACHE_FLASH_ATTR static bool to_num(const char **p, unsigned cnt,
+                                         uint8_t &res)
+    {
+        if (!cnt) return false;
+
+        unsigned val = 0;
+        for (;cnt--;++(*p)) {
+            if (**p < '0' || **p > '9') return false;
+
+            val = val * 10 + static_cast<uint8_t>(**p - '0');
+            if (val > 0xFF) return false;
+        }
+
+        res = val;
+        return true;
+    }
+
+    // token start and length. topics can be longer than 255 chars
+    using Token = std::pair<const char*, unsigned>;
+
+    ICACHE_FLASH_ATTR static const char *skip_token(const Token &t) {
+        // skips the token chars plus optionally a separator
+        const char *end = t.first + t.second;
+        return skip_separator(end);
+    }
+
+    // skips a separator, and if there is nothing past it, it returns a nullptr
+    // returns `other` if the separator is missing (defaults to nullptr)
+    ICACHE_FLASH_ATTR static const char *skip_separator(
+        const char *p, const char *other = nullptr)
+    {
+        // skip initial SEPARATOR if present
+        if (!p) return nullptr;
+        // this might not be obvious, but it includes a trailing '\0'
+        if (*p != SEPARATOR) return other;
+        ++p;
+        if (*p == 0) return nullptr;
+        return p;
+    }
+
+
+    ICACHE_FLASH_ATTR static const char *skip_prefix(const char *p, const char *pfx) {
+        // also skip any initial separators in prefix path
+        // the second arg is there to ignore if the separator is missing
+        p   = skip_separator(p, p);
+        pfx = skip_separator(pfx, pfx);
+
+        // do we still have something to process?
+        while (p != nullptr && pfx != nullptr) {
+            auto p_t    = token(p);
+            auto pfx_t  = token(pfx);
+
+            // is the first token same as prefix?
+            p = cmp_tokens(p_t, pfx_t);
+
+            // differing tokens?
+            if (!p) return nullptr;
+
+            // and onto the next part of the path
+            p   = skip_token(p_t);
+            pfx = skip_token(pfx_t);
+        }
+
+        // still some prefix left? if so we didn't eat all tokens of it and have
+        // to bail
+        if (pfx) return nullptr;
+
+        return p;
+    }
+
+    ICACHE_FLASH_ATTR static const char *cmp_tokens(const Token &a, const Token &b) {
+        if (a.second != b.second) return nullptr;
+        return (strncmp(a.first, b.first, a.second) == 0) ? a.first + a.second : nullptr;
+    }
+
+    // returns separator pos (or zero byte) and number of bytes that it took to
+    // get there
+    ICACHE_FLASH_ATTR static Token token(const char *p) {
+        const char *pos = p;
+        for(;*p;++p) {
+            if (*p == Path::SEPARATOR) {
+                break;
+            }
+        }
+
+        return {pos, p - pos};
+    }
+
+    ICACHE_FLASH_ATTR bool valid() { return addr != 0; }
+
+    // compressed topic code for debugging (addr 5 bits, topic 4 bits, timer topic 2 bits)
+    ICACHE_FLASH_ATTR uint16_t as_uint() const {
+        return addr | ((uint16_t)topic << 5) | ((uint16_t)timer_topic << 9);
+    }
+
+    // client ID. 0 means invalid path!
+    uint8_t addr = 0;
+    uint8_t day  = 0;
+    uint8_t slot = 0;
+    Topic topic            = INVALID_TOPIC;
+    TimerTopic timer_topic = TIMER_NONE;
+    bool    set_mode = false; // true in the S_SET_MODE sub-branch
+
+    EEPROMAccess eeprom_access = EA_READ;
+    uint8_t eeprom_address = 0; // eeprom address in case topic is EEPROM
+};
+
+} // namespace mqtt
+} // namespace hr20
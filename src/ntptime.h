@@ -36,6 +36,9 @@ namespace hr20 {
 namespace ntptime {
 
 struct NTPTime {
+    // slew of the last NTP update, stays 0 without NTP_CLIENT
+    long cur_slew = 0;
+
 #ifdef NTP_CLIENT
     /*** time management **/
     WiFiUDP ntpUDP;
@@ -45,8 +48,6 @@ struct NTPTime {
     // update interval (in milliseconds, can be changed using setUpdateInterval() ).
     NTPClient timeClient;
 
-    long cur_slew = 0;
-
     //Central European Time (Frankfurt, Paris, Prague)
     TimeChangeRule CEST = {"CEST", Last, Sun, Mar, 2, 120};     //Central European Summer Time
     TimeChangeRule CET = {"CET ", Last, Sun, Oct, 3, 60};       //Central European Standard Time
@@ -115,7 +116,11 @@ struct NTPTime {
     }
 
     time_t unixTime() {
+#ifdef NTP_CLIENT
         return timeClient.getEpochTime();
+#else
+        return now();
+#endif
     }
 
     time_t localTime() {
@@ -44,6 +44,19 @@ struct PacketQ {
         SYNC_ADDR = 0x21 // MAX ADDR IS 0x20, we're fine here
     };
 
+    /// priority classes of the queued commands, lower is served first
+    enum Priority : uint8_t {
+        PRIO_SYNC = 0,
+        PRIO_SETPOINT, // A
+        PRIO_MODE,     // M, L
+        PRIO_TIMER,    // R, W
+        PRIO_EEPROM,   // G, S
+        PRIO_ACK       // empty packet
+    };
+
+    /// classes up to this one are commands somebody is waiting for
+    static constexpr const uint8_t PRIO_INTERACTIVE = PRIO_MODE;
+
     ICACHE_FLASH_ATTR PacketQ(crypto::Crypto &crypto, time_t packet_max_age)
         : crypto(crypto), que(), packet_max_age(packet_max_age)
     {}
@@ -52,6 +65,7 @@ struct PacketQ {
         void clear() {
             addr = -1;
             time  = 0;
+            prio  = PRIO_ACK;
             packet.clear();
         }
 
@@ -63,6 +77,7 @@ struct PacketQ {
         int8_t addr = -1;
         Packet packet;
         time_t time = 0;
+        uint8_t prio = PRIO_ACK; // best class of the commands in the packet
     };
 
     //
@@ -73,10 +88,20 @@ struct PacketQ {
 
         // let's hope someone wasn't sending something...
         sending = nullptr;
+        ahead = nullptr;
         prologue.clear();
         cmac.clear();
     }
 
+    /// count of used slots
+    uint8_t ICACHE_FLASH_ATTR size() const {
+        uint8_t cntr = 0;
+        for (int i = 0; i < PACKET_QUEUE_LEN; ++i) {
+            cntr += (que[i].addr != -1) ? 1 : 0;
+        }
+        return cntr;
+    }
+
     uint8_t ICACHE_FLASH_ATTR get_update_count(uint8_t addr) {
         uint8_t cntr = 0;
         for (int i = 0; i < PACKET_QUEUE_LEN; ++i) {
@@ -86,8 +111,12 @@ struct PacketQ {
     }
 
     /// insert into queue or return nullptr if full
-    /// returns packet structure to be filled with data
-    Packet * ICACHE_FLASH_ATTR want_to_send_for(uint8_t addr, uint8_t bytes, time_t curtime) {
+    /// returns packet structure to be filled with data. Interactive commands
+    /// only go to packets that start with interactive ones, bulk commands
+    /// fill whatever space is left
+    Packet * ICACHE_FLASH_ATTR want_to_send_for(uint8_t addr, uint8_t bytes,
+                                                time_t curtime, uint8_t prio)
+    {
 #ifdef VERBOSE
         DBG(" * Q APP %p", this);
 #endif
@@ -98,10 +127,15 @@ struct PacketQ {
             Item &it = que[ri];
 
             if (addr != SYNC_ADDR && (it.addr == addr)) {
-                if (it.packet.free_size() > bytes) {
+                bool fits = prio > PRIO_INTERACTIVE
+                            || it.prio <= PRIO_INTERACTIVE
+                            || it.packet.empty();
+
+                if (fits && it.packet.free_size() > bytes) {
 #ifdef VERBOSE
                     DBG(" * Q APPEND [%d] %d", ri, addr);
 #endif
+                    if (prio < it.prio) it.prio = prio;
                     return &it.packet;
                 }
             }
@@ -111,14 +145,34 @@ struct PacketQ {
 #ifdef VERBOSE
                 DBG(" * Q NEW [%d] %d", ri, addr);
 #endif
-                it.addr = addr;
-                it.time = curtime;
-                it.packet.clear();
+                bool was_free = it.addr == -1;
+                take(it, addr, curtime, prio);
+
+                if (was_free) {
+                    uint8_t used = size();
+                    if (used > max_size) max_size = used;
+                }
+
                 return &it.packet;
             }
         }
 
-        // full
+        // full - bulk work makes room for anything more urgent
+        Item *victim = nullptr;
+        for (int i = 0; i < PACKET_QUEUE_LEN; ++i) {
+            Item &it = que[i];
+            if (it.addr < 0 || it.prio <= prio) continue;
+            if (!victim || it.prio > victim->prio
+                || (it.prio == victim->prio && it.time < victim->time))
+                victim = &it;
+        }
+
+        if (victim) {
+            ERR_ARG(QUEUE_EVICTED, victim->addr);
+            take(*victim, addr, curtime, prio);
+            return &victim->packet;
+        }
+
         ERR(QUEUE_FULL);
         return nullptr;
     }
@@ -131,65 +185,31 @@ struct PacketQ {
             return false;
         }
 
-        for (unsigned i = 0; i < PACKET_QUEUE_LEN; ++i) {
-            Item &it = que[i];
-            if (it.addr == addr) {
+        Item *found = first_for(addr);
+        if (found) {
+            Item &it = *found;
 #ifdef VERBOSE
-                DBG("(PREP SND %d)", i);
+            DBG("(PREP SND %d)", (int)(found - que));
 #endif
-                sending = &it;
-                bool isSync = (it.addr == SYNC_ADDR);
-                // just something to not get handled while we're sending this
-                it.addr = -2;
-
-                prepare_prologue();
-
-                // 1 is the length itself
-                // length, highest byte indicates sync word
-                // non-sync packet includes an address (see branch below)
-                uint8_t lenbyte = 1 + it.packet.size() + crypto::CMAC::CMAC_SIZE;
-
-                cmac.clear();
-
-                // non-sync packets have to be encrypted as well
-                if (!isSync) {
-                    ++lenbyte; // we're pushing address so we extend length
-                    prologue.push(lenbyte);
-                    prologue.push(MASTER_ADDR);
-
-                    crypto.encrypt_decrypt(it.packet.data(), it.packet.size());
-
-                    // non-sync packets include address in the cmac checksum
-                    crypto.cmac_fill_addr(it.packet.data(),
-                                          it.packet.size(),
-                                          MASTER_ADDR, cmac);
-                } else {
-                    prologue.push(lenbyte | 0x80); // 0x80 indicates sync
-                    crypto.cmac_fill_sync(it.packet.data(),
-                                          it.packet.size(),
-                                          cmac);
-                }
+            sending = &it;
+            sending_addr = addr;
+            bool isSync = (it.addr == SYNC_ADDR);
+            // just something to not get handled while we're sending this
+            it.addr = -2;
 
+            if (&it == ahead) ahead = nullptr;
 
-                // dummy bytes, this gives the radio time to process the 16 bit
-                // tx queue in time - we don't care if these get sent whole.
-                cmac.push(0xAA); cmac.push(0xAA);
+            frame(it.packet, isSync, prologue, cmac);
 
-#ifdef VERBOSE
-                hex_dump("PRLG", prologue.data(), prologue.size());
-                hex_dump(" DTA", it.packet.data(), it.packet.size());
-                hex_dump("CMAC", cmac.data(), cmac.size());
-#endif
-                if (addr == SYNC_ADDR) {
+            if (addr == SYNC_ADDR) {
 #ifdef DEBUG
-                    // only log sync packets in debug mode
-                    EVENT(PROTO_PACKET_SYNC);
+                // only log sync packets in debug mode
+                EVENT(PROTO_PACKET_SYNC);
 #endif
-                } else {
-                    EVENT_ARG(PROTO_PACKET_SENDING, addr);
-                }
-                return true;
+            } else {
+                EVENT_ARG(PROTO_PACKET_SENDING, addr);
             }
+            return true;
         }
 
 #ifdef VERBOSE
@@ -198,13 +218,160 @@ struct PacketQ {
         return false;
     }
 
-    void prepare_prologue() {
-        // TODO: this should probably be handled by Protocol class
+    /** encrypts a copy of the first packet for addr with the current crypto
+     * rtc and passes the whole frame to out byte by byte. The packet stays
+     * queued, until sent_ahead() drops it or prepare_to_send_to() sends it
+     * the usual way. Returns false if there's nothing for addr.
+     */
+    template<typename Out>
+    bool ICACHE_FLASH_ATTR prepare_ahead(uint8_t addr, Out out) {
+        if (addr == SYNC_ADDR) return false;
+
+        Item *found = first_for(addr);
+        if (found) {
+            Item &it = *found;
+            Packet data = it.packet;
+            ShortQ<6> pro, mac;
+            frame(data, false, pro, mac);
+
+            while (!pro.empty()) out(pro.pop());
+            while (!data.empty()) out(data.pop());
+            while (!mac.empty()) out(mac.pop());
+
+            ahead = &it;
+            return true;
+        }
+
+        return false;
+    }
+
+    /** lets revise() rewrite the packets queued for addr, still in plaintext.
+     * It returns the class of the commands it left in the packet. Packets it
+     * empties are dropped, empty ones (acks) stay. Revised packets count as
+     * fresh for the age based eviction.
+     */
+    template<typename F>
+    void ICACHE_FLASH_ATTR revise(uint8_t addr, time_t curtime, F revise) {
+        for (unsigned i = 0; i < PACKET_QUEUE_LEN; ++i) {
+            Item &it = que[i];
+            if (it.addr != addr) continue;
+
+            bool was_ack = it.packet.empty();
+            uint8_t prio = revise(it.packet);
+
+            if (it.packet.empty() && !was_ack) {
+                if (&it == ahead) ahead = nullptr;
+                it.clear();
+                continue;
+            }
+
+            it.prio = prio;
+            it.time = curtime;
+        }
+    }
+
+    /// drops the packet being sent, if any
+    void ICACHE_FLASH_ATTR abort_send() {
+        if (!sending) return;
+
         prologue.clear();
-        prologue.push(0xaa); // just some gibberish
-        prologue.push(0xaa);
-        prologue.push(0x2d); // 2 byte sync word
-        prologue.push(0xd4);
+        sending->clear();
+        cmac.clear();
+        sending = nullptr;
+    }
+
+    /// the packet for addr to go out next - best class, then queue order
+    Item * ICACHE_FLASH_ATTR first_for(uint8_t addr) {
+        Item *best = nullptr;
+        for (unsigned i = 0; i < PACKET_QUEUE_LEN; ++i) {
+            Item &it = que[i];
+            if (it.addr != addr) continue;
+            if (!best || it.prio < best->prio) best = &it;
+        }
+        return best;
+    }
+
+    /// (re)uses the slot for a new packet
+    void ICACHE_FLASH_ATTR take(Item &it, uint8_t addr, time_t curtime,
+                                uint8_t prio)
+    {
+        if (&it == ahead) ahead = nullptr;
+
+        it.addr = addr;
+        it.time = curtime;
+        it.prio = prio;
+        it.packet.clear();
+    }
+
+    /// the packet from prepare_ahead() went out, drop it
+    void ICACHE_FLASH_ATTR sent_ahead() {
+        if (!ahead) return;
+        EVENT_ARG(PROTO_PACKET_SENDING, ahead->addr);
+        ahead->clear();
+        ahead = nullptr;
+    }
+
+    /// the packet from prepare_ahead() was not sent, it stays queued
+    void ICACHE_FLASH_ATTR cancel_ahead() {
+        ahead = nullptr;
+    }
+
+    /// drops the packets queued for addr. The one being sent stays
+    void ICACHE_FLASH_ATTR drop(uint8_t addr) {
+        for (unsigned i = 0; i < PACKET_QUEUE_LEN; ++i) {
+            Item &it = que[i];
+            if (it.addr != addr) continue;
+            if (&it == ahead) ahead = nullptr;
+            it.clear();
+        }
+    }
+
+    /// encrypts data in place and fills the frame prologue and cmac for it
+    void ICACHE_FLASH_ATTR frame(Packet &data, bool isSync, ShortQ<6> &pro,
+                                 ShortQ<6> &mac)
+    {
+        prepare_prologue(pro);
+
+        // 1 is the length itself
+        // length, highest byte indicates sync word
+        // non-sync packet includes an address (see branch below)
+        uint8_t lenbyte = 1 + data.size() + crypto::CMAC::CMAC_SIZE;
+
+        mac.clear();
+
+        // non-sync packets have to be encrypted as well
+        if (!isSync) {
+            ++lenbyte; // we're pushing address so we extend length
+            pro.push(lenbyte);
+            pro.push(MASTER_ADDR);
+
+            crypto.encrypt_decrypt(data.data(), data.size());
+
+            // non-sync packets include address in the cmac checksum
+            crypto.cmac_fill_addr(data.data(), data.size(), MASTER_ADDR, mac);
+        } else {
+            pro.push(lenbyte | 0x80); // 0x80 indicates sync
+            crypto.cmac_fill_sync(data.data(), data.size(), mac);
+        }
+
+        // dummy bytes, this gives the radio time to process the 16 bit
+        // tx queue in time - we don't care if these get sent whole.
+        mac.push(0xAA); mac.push(0xAA);
+
+#ifdef VERBOSE
+        hex_dump("PRLG", pro.data(), pro.size());
+        hex_dump(" DTA", data.data(), data.size());
+        hex_dump("CMAC", mac.data(), mac.size());
+#endif
+    }
+
+    static void prepare_prologue(ShortQ<6> &pro) {
+        // TODO: this should probably be handled by Protocol class
+        pro.clear();
+        pro.push(0xaa); // just some gibberish
+        pro.push(0xaa);
+        pro.push(0x2d); // 2 byte sync word
+        pro.push(0xd4);
     }
 
     int ICACHE_FLASH_ATTR peek() {
@@ -256,8 +423,11 @@ struct PacketQ {
     crypto::Crypto &crypto;
     Item que[PACKET_QUEUE_LEN];
     Item *sending = nullptr;
+    uint8_t sending_addr = 0; // sending's address, it.addr is -2 meanwhile
+    Item *ahead = nullptr; // encrypted in advance, see prepare_ahead()
     ShortQ<6> prologue; // stores sync-word, size and optionally an address
     ShortQ<6> cmac; // stores cmac for sent packet, and 2 dummy bytes
+    uint8_t max_size = 0; // high-water mark of used slots
     const time_t packet_max_age;
 };
 
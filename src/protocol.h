@@ -24,6 +24,7 @@
 #include "ntptime.h"
 #include "packetqueue.h"
 #include "model.h"
+#include "counters.h"
 
 namespace hr20 {
 
@@ -45,6 +46,18 @@ struct Protocol {
         : model(m), time(time), crypto(crypto), sndQ(sndQ)
     {}
 
+    // queue_updates_for result bits
+    enum Updates : uint8_t {
+        WRITE_TEMP  = 1,
+        WRITE_AUTO  = 2,
+        WRITE_LOCK  = 4,
+        RW_EEPROM   = 8,
+        READ_TIMER  = 16,
+        WRITE_TIMER = 32,
+        // basic values, confirmed by the next debug response
+        WRITE_BASIC = WRITE_TEMP | WRITE_AUTO | WRITE_LOCK
+    };
+
     // bitfield
     enum Error {
         OK = 0, // no bit allocated for OK
@@ -56,29 +69,42 @@ struct Protocol {
         on_change_cb = cb;
     }
 
-    /// verifies incoming packet, processes it accordingly
-    void ICACHE_FLASH_ATTR receive(RcvPacket &packet) {
+    /// verifies incoming packet, processes it accordingly. meta is the radio
+    /// status sampled while it was received. Returns false if the packet
+    /// did not pass verification
+    bool ICACHE_FLASH_ATTR receive(RcvPacket &packet, const RxMeta &meta) {
         rd_time = time.unixTime();
+        rd_meta = meta;
 
 #ifdef VERBOSE
         DBG("== Will verify_decode packet of %d bytes ==", packet.size());
         hex_dump("PKT", packet.data(), packet.size());
 #endif
-        // length byte in packet contains the length byte itself (thus -1)
-        size_t data_size = (packet[0] & 0x7f) - 1;
-        bool   isSync    = (packet[0] & 0x80) != 0;
+        if (packet.empty()) {
+            ERR(PROTO_EMPTY_PACKET);
+            return false;
+        }
 
-        if ((data_size + 1) > packet.size()) {
+        // length byte in packet contains the length byte itself
+        uint8_t length = packet[0] & 0x7f;
+        bool    isSync = (packet[0] & 0x80) != 0;
+
+        if (length > packet.size()) {
             ERR(PROTO_INCOMPLETE_PACKET);
-            return;
+            return false;
         }
 
-        // every packet has at-least length and CMAC (1+4)
-        if (data_size < 5) {
+        // every packet has at-least length, CMAC (1+4) and a byte of data
+        if (length < 6) {
             ERR(PROTO_PACKET_TOO_SHORT);
-            return;
+            return false;
         }
 
+        // whatever follows the length is not ours to decode
+        if (length < packet.size()) packet.trim(packet.size() - length);
+
+        size_t data_size = length - 1;
+
         // pkt_cnt gets increased the number of times it was
         // increased in encrypt_decrypt by sender (not applicable for sync)
         uint8_t cnt_offset = isSync ? 0 : (packet.size() + 1) / 8;
@@ -99,22 +125,29 @@ struct Protocol {
 #endif
         // verification failed? return
         if (!ver) {
+            // sync frames carry the year where others have the address,
+            // they are not counted for a client
+            uint8_t addr = isSync ? uint8_t(PacketQ::SYNC_ADDR) : packet[1];
+
             // bad packet might get special handling later on...
-            ERR_ARG(PROTO_BAD_CMAC, packet[1]);
+            ERR_ARG(PROTO_BAD_CMAC, addr);
+            // the address is not verified, but garbage won't hit a client
+            // often enough to matter
+            if (addr < MAX_HR_ADDR)
+                if (auto *hr = model[addr]) hr->link.cmac_failure();
             on_failed_verify();
-            return;
+            return false;
         }
 
         // log that we received a packet from client with address
         EVENT_ARG(PROTO_PACKET_RECEIVED, packet[1]);
 
+        // errors from here on are counted for this client
+        Counters::Client counted(counters, packet[1]);
+
         if (isSync) {
             process_sync_packet(packet);
         } else {
-            if (packet.size() < 6) {
-                ERR(PROTO_PACKET_TOO_SHORT);
-                return;
-            }
             // not a sync packet. we have to decode it
             crypto.encrypt_decrypt(
                     reinterpret_cast<uint8_t *>(packet.data()) + 2,
@@ -130,6 +163,8 @@ struct Protocol {
                 hex_dump("PKT", packet.data(), packet.size());
             }
         }
+
+        return true;
     }
 
     void ICACHE_FLASH_ATTR update(time_t curtime,
@@ -141,10 +176,11 @@ struct Protocol {
         // per second
         last_addr = 0xFF;
 
-        // clear
-        if (crypto.rtc.ss == 0) {
-            sndQ.clear(); // everything old is lost by design.
-        }
+        // queued packets are kept and revised at contact, but one that
+        // did not make it out whole by now will not
+        if (crypto.rtc.ss == 0) sndQ.abort_send();
+
+        update_links(changed_time);
 
         if ((crypto.rtc.ss == 0 ||
              crypto.rtc.ss == 30))
@@ -176,6 +212,64 @@ struct Protocol {
         return last_force_count == 0;
     }
 
+    /// idle time work: queues the updates for one client with pending work
+    /// and nothing queued yet, so the reply is ready when the client talks
+    void ICACHE_FLASH_ATTR queue_ahead() {
+        rd_time = time.unixTime();
+
+        for (uint8_t n = 0; n < MAX_HR_ADDR; ++n) {
+            uint8_t a = ahead_addr;
+            ahead_addr = (ahead_addr + 1) % MAX_HR_ADDR;
+
+            auto *hr = model[a];
+            if (!hr || !hr->last_contact || hr->link.unreachable()) continue;
+            if (hr->synced && !hr->needs_basic_value_sync()) continue;
+            if (sndQ.get_update_count(a)) continue;
+
+            queue_updates_for(a, *hr);
+            return;
+        }
+    }
+
+    /** finds a client with a queued reply that talked in the same second of
+     * the minute as the (unix) time at, last time. Length is the length
+     * byte of its last packet, the best guess of the next one.
+     */
+    bool ICACHE_FLASH_ATTR expected_at(time_t at, uint8_t &addr,
+                                       uint8_t &length)
+    {
+        for (uint8_t a = 0; a < MAX_HR_ADDR; ++a) {
+            auto *hr = model[a];
+            if (!hr || !hr->last_contact || !hr->last_length) continue;
+            if (hr->link.unreachable()) continue;
+            if (hr->last_contact % 60 != at % 60) continue;
+            if (!sndQ.get_update_count(a)) continue;
+
+            rd_time = time.unixTime();
+            refresh_updates_for(a, *hr);
+            if (!sndQ.get_update_count(a)) continue;
+
+            addr   = a;
+            length = hr->last_length;
+            return true;
+        }
+
+        return false;
+    }
+
+    /// crypto packet count after receiving a packet with given length byte
+    /// as the first one in a second. See receive()
+    static uint8_t ICACHE_FLASH_ATTR count_after_receive(uint8_t length) {
+        uint8_t payload = length > 6 ? length - 6 : 0;
+        // a count per 8 byte block decrypted, then one for the packet
+        return (payload + 7) / 8 + 1;
+    }
+
+    /// the radio already sent the reply to addr, see RFM12B::arm()
+    void ICACHE_FLASH_ATTR replied(uint8_t addr) {
+        last_addr = addr;
+    }
+
 protected:
     bool ICACHE_FLASH_ATTR process_sync_packet(RcvPacket &packet) {
         if (packet.rest_size() < 1+4+4) {
@@ -210,7 +304,7 @@ protected:
     bool ICACHE_FLASH_ATTR process_packet(RcvPacket &packet) {
         // owned by object to save on now() calls and param passes
         // before the main loop, we trim the packet's mac and first 2 bytes
-        packet.pop(); // skip length
+        uint8_t length = packet.pop() & 0x7F;
         // sending device's address
         uint8_t addr = packet.pop();
 
@@ -220,6 +314,11 @@ protected:
         if (!hr) return false;
 
         hr->last_contact = rd_time;
+        hr->last_length  = length;
+        hr->link.contact(rd_time);
+        hr->radio.add(rd_meta);
+        // the whole packet is processed before anyone looks, so touch early
+        model.touch(*hr);
 
         // eat up the MAC, it's already verified
         packet.trim(4);
@@ -295,25 +394,66 @@ protected:
         if (last_addr != addr) {
             // prepare for immediate response if possible - shortens discovery
             // time by 1 minute.
-            queue_updates_for(addr, *hr);
-
-            // how many packets are queued for the client?
-            hr->need_fat_comms = (sndQ.get_update_count(addr) > 1);
+            // work queued earlier is revised against the model instead
+            uint8_t writes = sndQ.get_update_count(addr)
+                                 ? refresh_updates_for(addr, *hr)
+                                 : 0;
+            if (!sndQ.get_update_count(addr))
+                writes = queue_updates_for(addr, *hr);
+            writes &= WRITE_BASIC;
+
+            // how many packets are queued for the client? Poor links
+            // would only waste the extra slots
+            hr->need_fat_comms = (sndQ.get_update_count(addr) > 1)
+                                 && !hr->link.poor();
 
             // if there's anything for the current address, we prepare to
             // send right away.
-#ifdef VERBOSE
             bool haveData = sndQ.prepare_to_send_to(addr);
+#ifdef VERBOSE
             DBG(" * prep: %s for %d", haveData ? "packet" : "nothing", addr);
-#else
-            sndQ.prepare_to_send_to(addr);
 #endif
+            // writes only count as sent if nothing stays queued behind
+            bool allSent = haveData && sndQ.get_update_count(addr) == 0;
+            hr->link.writes(allSent ? writes : 0, pending_writes(*hr));
             last_addr = addr;
         }
 
         return err == OK;
     }
 
+    /// basic values requested and not yet confirmed by the client
+    static uint8_t ICACHE_FLASH_ATTR pending_writes(const HR20 &hr) {
+        return (hr.temp_wanted.is_requested_set() ? WRITE_TEMP : 0)
+               | (hr.auto_mode.is_requested_set() ? WRITE_AUTO : 0)
+               | (hr.menu_locked.is_requested_set() ? WRITE_LOCK : 0);
+    }
+
+    /// rolls the link quality windows of all clients
+    void ICACHE_FLASH_ATTR update_links(bool changed_time) {
+        time_t now = time.unixTime();
+
+        for (uint8_t a = 0; a < MAX_HR_ADDR; ++a) {
+            auto *hr = model[a];
+            if (!hr) continue;
+
+            if (changed_time) {
+                hr->link.rebase(now);
+                continue;
+            }
+
+            uint8_t score = hr->link.score();
+            if (!hr->link.update(now)) continue;
+
+            // a dead client settles at 0 and stops getting published
+            if (hr->link.score() == score) continue;
+
+            DBG("(MISS %d %d)", (int)a, (int)hr->link.score());
+            model.touch(*hr);
+            if (on_change_cb) on_change_cb(a, CHANGE_FREQUENT);
+        }
+    }
+
     void ICACHE_FLASH_ATTR on_failed_verify() {
         // TODO: Might immediately send sync as response to sync a stubborn HR20
         // with incompatible receive windows that does not hear normal Synces
@@ -400,7 +540,19 @@ protected:
         hr->mode_window.set_remote(sec_mm & 0x40);
         hr->temp_avg.set_remote(tmp_avg_h << 8 | tmp_avg_l);
         hr->bat_avg.set_remote(bat_avg_h << 8 | bat_avg_l);
+        bool setpoint_pending = hr->temp_wanted.is_requested_set();
         hr->temp_wanted.set_remote(tmp_wtd);
+
+        // the client confirmed the requested setpoint just now
+        if (setpoint_pending && !hr->temp_wanted.is_requested_set()
+            && hr->setpoint_ms)
+        {
+            hr->setpoint_latency_ms = millis() - hr->setpoint_ms;
+            hr->setpoint_ms = 0;
+            DBG("(SETPOINT %d %lu ms)", addr,
+                (unsigned long)hr->setpoint_latency_ms);
+        }
+
         hr->cur_valve_wtd.set_remote(valve_wtd);
         hr->ctl_err.set_remote(ctl_err);
 
@@ -519,54 +671,57 @@ protected:
         return OK;
     }
 
-    void ICACHE_FLASH_ATTR queue_updates_for(uint8_t addr, HR20 &hr) {
+    /// queues writes/reads the client needs. Returns the WRITE_/READ_ bits
+    /// of what was needed
+    uint8_t ICACHE_FLASH_ATTR queue_updates_for(uint8_t addr, HR20 &hr) {
         bool synced = true;
         bool was_synced = hr.synced;
 
         // base values not yet read are not a reason for non-synced state
         // the reason is that we'll get them for free after the client
         // shows up
-        unsigned flags = 0;
+        uint8_t flags = 0;
 
         DBGI("(Q %d", (int)addr);
 
         // wanted temperature
         if (hr.temp_wanted.needs_write()) {
             synced = false;
-            flags |= 1;
+            flags |= WRITE_TEMP;
             DBGI(" T");
             send_set_temp(addr, hr.temp_wanted);
         }
 
         if (hr.auto_mode.needs_write()) {
             synced = false;
-            flags |= 2;
+            flags |= WRITE_AUTO;
             DBGI(" A");
             send_set_auto_mode(addr, hr.auto_mode);
         }
 
         if (hr.menu_locked.needs_write()) {
             synced = false;
-            flags |= 4;
+            flags |= WRITE_LOCK;
             DBGI(" L");
             send_set_menu_locked(addr, hr.menu_locked);
         }
 
-        // only allow queueing N eeprom accesses at a time
-        uint8_t ee_ctr = MAX_QUEUE_EEPROM;
+        // only allow queueing N eeprom accesses at a time, one on poor links
+        const uint8_t ee_max = hr.link.poor() ? 1 : MAX_QUEUE_EEPROM;
+        uint8_t ee_ctr = ee_max;
 
         // read/write on eeprom?
         for (unsigned ee_addr = 0; ee_addr < EEPROM_SIZE; ++ee_addr) {
             auto &eeprom_slot = hr.eeprom[ee_addr];
             if (eeprom_slot.needs_read()) {
                 synced = false;
-                flags |= 8;
+                flags |= RW_EEPROM;
                 DBGI(" RE");
                 send_get_eeprom(addr, ee_addr);
                 if (!(--ee_ctr)) break;
             } else if (eeprom_slot.needs_write()) {
                 synced = false;
-                flags |= 8;
+                flags |= RW_EEPROM;
                 DBGI(" WE");
                 send_set_eeprom(addr, ee_addr, eeprom_slot);
                 if (!(--ee_ctr)) break;
@@ -575,32 +730,32 @@ protected:
 
         // only read timers if we didn't handle eeprom ops.
         // otherwise the client gets overhelmed
-        if (ee_ctr == MAX_QUEUE_EEPROM) {
+        if (ee_ctr == ee_max) {
             // only allow queueing 8 timers to save time
-            uint8_t tmr_ctr = MAX_QUEUE_TIMERS;
+            uint8_t tmr_ctr = hr.link.poor() ? 1 : MAX_QUEUE_TIMERS;
 
             // get timers if we don't have them, set them if change happened
             for (uint8_t dow = 0; dow < 8; ++dow) {
                 for (uint8_t slot = 0; slot < TIMER_SLOTS_PER_DAY; ++slot) {
                     auto &timer = hr.timers[dow][slot];
                     if (timer.needs_read()) {
-                        flags |= 16;
+                        flags |= READ_TIMER;
                         synced = hr.synced = false; // shortcut, we might return
                         DBGI(" RT");
                         send_get_timer(addr, dow, slot, timer);
                         if (!(--tmr_ctr)) {
                             DBG(")");
-                            return;
+                            return flags;
                         }
                     }
                     if (timer.needs_write()) {
-                        flags |= 32;
+                        flags |= WRITE_TIMER;
                         synced = hr.synced = false;
                         DBGI(" WT");
                         send_set_timer(addr, dow, slot, timer);
                         if (!(--tmr_ctr)) {
                             DBG(")");
-                            return;
+                            return flags;
                         }
                     }
                 }
@@ -626,6 +781,137 @@ protected:
         if (synced) {
             send_ack(addr);
         }
+
+        return flags;
+    }
+
+    /// revises the packets queued for the client and queues the basic value
+    /// writes they miss. Returns the WRITE_ bits queued
+    uint8_t ICACHE_FLASH_ATTR refresh_updates_for(uint8_t addr, HR20 &hr) {
+        uint8_t queued = refresh_queued(addr, hr);
+
+        if (!(queued & WRITE_TEMP) && hr.temp_wanted.needs_write()) {
+            queued |= WRITE_TEMP;
+            send_set_temp(addr, hr.temp_wanted);
+        }
+
+        if (!(queued & WRITE_AUTO) && hr.auto_mode.needs_write()) {
+            queued |= WRITE_AUTO;
+            send_set_auto_mode(addr, hr.auto_mode);
+        }
+
+        if (!(queued & WRITE_LOCK) && hr.menu_locked.needs_write()) {
+            queued |= WRITE_LOCK;
+            send_set_menu_locked(addr, hr.menu_locked);
+        }
+
+        return queued;
+    }
+
+    /** drops the queued commands for the client the model no longer needs,
+     * and refreshes the values the rest carry to the currently requested
+     * ones. Returns the WRITE_ bits of the basic value writes left queued
+     */
+    uint8_t ICACHE_FLASH_ATTR refresh_queued(uint8_t addr, HR20 &hr) {
+        uint8_t queued = 0;
+
+        sndQ.revise(addr, rd_time, [&](SndPacket &p) {
+            SndPacket old = p;
+            uint8_t prio  = PacketQ::PRIO_ACK;
+
+            p.clear();
+
+            for (uint8_t pos = 0; pos < old.size();) {
+                uint8_t *cmd = old.data() + pos;
+                uint8_t len  = command_size(cmd[0]);
+
+                // not one of ours, nothing to revise it against
+                if (!len || pos + len > old.size()) break;
+                pos += len;
+
+                if (!refresh_command(hr, cmd)) continue;
+
+                for (uint8_t i = 0; i < len; ++i) p.push(cmd[i]);
+
+                uint8_t cp = command_prio(cmd[0]);
+                if (cp < prio) prio = cp;
+
+                queued |= cmd[0] == 'A' ? WRITE_TEMP
+                        : cmd[0] == 'M' ? WRITE_AUTO
+                        : cmd[0] == 'L' ? WRITE_LOCK : 0;
+            }
+
+            return prio;
+        });
+
+        return queued;
+    }
+
+    /// size of a command we send, 0 for unknown
+    static uint8_t ICACHE_FLASH_ATTR command_size(uint8_t op) {
+        switch (op) {
+        case 'A':
+        case 'M':
+        case 'L':
+        case 'R':
+        case 'G': return 2;
+        case 'S': return 3;
+        case 'W': return 4;
+        default:  return 0;
+        }
+    }
+
+    static uint8_t ICACHE_FLASH_ATTR command_prio(uint8_t op) {
+        switch (op) {
+        case 'A': return PacketQ::PRIO_SETPOINT;
+        case 'M':
+        case 'L': return PacketQ::PRIO_MODE;
+        case 'R':
+        case 'W': return PacketQ::PRIO_TIMER;
+        default:  return PacketQ::PRIO_EEPROM;
+        }
+    }
+
+    /// checks a queued command against the model and updates the value it
+    /// carries. Returns false if the model does not need it anymore
+    static bool ICACHE_FLASH_ATTR refresh_command(HR20 &hr, uint8_t *cmd) {
+        switch (cmd[0]) {
+        case 'A':
+            cmd[1] = hr.temp_wanted.get_requested();
+            return hr.temp_wanted.is_requested_set();
+        case 'M':
+            cmd[1] = hr.auto_mode.get_requested() ? 1 : 0;
+            return hr.auto_mode.is_requested_set();
+        case 'L':
+            cmd[1] = hr.menu_locked.get_requested() ? 1 : 0;
+            return hr.menu_locked.is_requested_set();
+        case 'R':
+        case 'W': {
+            uint8_t dow  = cmd[1] >> 4;
+            uint8_t slot = cmd[1] & 0xF;
+            if (dow >= TIMER_DAYS || slot >= TIMER_SLOTS_PER_DAY) return false;
+
+            auto &timer = hr.timers[dow][slot];
+            if (cmd[0] == 'R')
+                return !timer.remote_valid() && !timer.masked();
+
+            cmd[2] = timer.get_requested().raw() >> 8;
+            cmd[3] = timer.get_requested().raw() & 0xFF;
+            return timer.is_requested_set();
+        }
+        case 'G':
+        case 'S': {
+            if (cmd[1] >= EEPROM_SIZE) return false;
+
+            auto &ee = hr.eeprom[cmd[1]];
+            if (cmd[0] == 'G') return !ee.remote_valid() && !ee.masked();
+
+            cmd[2] = ee.get_requested();
+            return ee.is_requested_set();
+        }
+        default:
+            return false;
+        }
     }
 
     void ICACHE_FLASH_ATTR send_ack(uint8_t addr) {
@@ -635,7 +921,8 @@ protected:
 
         // 0 bytes just empty packet for the client
         // we acknowledge we know about the client this way
-        SndPacket *p = sndQ.want_to_send_for(addr, 0, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 0, rd_time,
+                                             PacketQ::PRIO_ACK);
         if (!p) return;
     }
 
@@ -659,7 +946,8 @@ protected:
         }
 
         // 2 bytes [A][xx] xx is in half degrees
-        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time,
+                                             PacketQ::PRIO_SETPOINT);
         if (!p) return;
 
         p->push('A');
@@ -672,7 +960,8 @@ protected:
 #ifdef VERBOSE
         DBG("   * AUTO %u", addr);
 #endif
-        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time,
+                                             PacketQ::PRIO_MODE);
         if (!p) return;
 
         p->push('M');
@@ -685,7 +974,8 @@ protected:
 #ifdef VERBOSE
         DBG("   * LOCK %u", addr);
 #endif
-        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time,
+                                             PacketQ::PRIO_MODE);
         if (!p) return;
 
         p->push('L');
@@ -698,7 +988,8 @@ protected:
 #ifdef VERBOSE
         DBG("   * GET TIMER %u", addr);
 #endif
-        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 2, rd_time,
+                                             PacketQ::PRIO_TIMER);
         if (!p) return;
 
         p->push('R');
@@ -711,13 +1002,14 @@ protected:
 #ifdef VERBOSE
         DBG("   * SET TIMER %u", addr);
 #endif
-        SndPacket *p = sndQ.want_to_send_for(addr, 4, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 4, rd_time,
+                                             PacketQ::PRIO_TIMER);
         if (!p) return;
 
         p->push('W');
         p->push(dow << 4 | slot);
         p->push(timer.get_requested().raw() >> 8);
-        p->push(timer.get_requested().raw() && 0xFF);
+        p->push(timer.get_requested().raw() & 0xFF);
     }
 
     void ICACHE_FLASH_ATTR send_set_eeprom(
@@ -726,7 +1018,8 @@ protected:
 #ifdef VERBOSE
         DBG("   * EEPROM S %u", addr);
 #endif
-        SndPacket *p = sndQ.want_to_send_for(addr, 3, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 3, rd_time,
+                                             PacketQ::PRIO_EEPROM);
         if (!p) return;
 
         p->push('S');
@@ -740,7 +1033,8 @@ protected:
 #ifdef VERBOSE
         DBG("   * EEPROM G %u", addr);
 #endif
-        SndPacket *p = sndQ.want_to_send_for(addr, 3, rd_time);
+        SndPacket *p = sndQ.want_to_send_for(addr, 3, rd_time,
+                                             PacketQ::PRIO_EEPROM);
         if (!p) return;
 
         p->push('G');
@@ -752,7 +1046,11 @@ protected:
 
     void ICACHE_FLASH_ATTR send_sync(time_t curtime) {
 #ifdef NTP_CLIENT
-        SndPacket *p = sndQ.want_to_send_for(PacketQ::SYNC_ADDR, 8, curtime);
+        // a sync that did not go out in its second carries a stale time
+        sndQ.drop(PacketQ::SYNC_ADDR);
+
+        SndPacket *p = sndQ.want_to_send_for(PacketQ::SYNC_ADDR, 8, curtime,
+                                             PacketQ::PRIO_SYNC);
         if (!p) return;
 
         // TODO: force flags, if needed!
@@ -779,6 +1077,8 @@ protected:
                     ((!hr->synced) || hr->needs_basic_value_sync()) ? 1 : 0);
 #endif
                 if (hr->last_contact == 0) continue;
+                // forcing a client that does not hear us wastes the slot
+                if (hr->link.unreachable()) continue;
                 if ((!hr->synced) || hr->needs_basic_value_sync()) {
                     ff.push(a, hr->need_fat_comms);
                 }
@@ -814,8 +1114,14 @@ protected:
     /// count of forced addrs last time we iterated them in send_sync
     uint8_t last_force_count = 0;
 
+    /// next client queue_ahead() looks at
+    uint8_t ahead_addr = 0;
+
     // current read time
     time_t rd_time;
+
+    // radio status of the packet being processed
+    RxMeta rd_meta;
 };
 
 
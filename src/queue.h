@@ -22,6 +22,7 @@
 #include <Arduino.h>
 
 #include <cstdint>
+#include <string.h>
 
 namespace hr20 {
 
@@ -100,6 +101,16 @@ struct ShortQ {
         return LenT - _top;
     }
 
+    // replaces the contents with n bytes from src. Returns false if they
+    // don't fit. No interrupt masking here, see RFM12B::arm()
+    bool assign(const uint8_t *src, uint8_t n) {
+        if (n > LenT) return false;
+        memcpy(buf, src, n);
+        _pos = 0;
+        _top = n;
+        return true;
+    }
+
     // trims extra bytes from queue end
     bool trim(uint8_t count) {
         if (count >= _top || (_pos + count) >= _top) {
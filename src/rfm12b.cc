@@ -19,6 +19,7 @@
 
 #include "rfm12b.h"
 #include "rfmdef.h"
+#include "capture.h"
 #include "debug.h"
 #include "error.h"
 
@@ -31,20 +32,10 @@ static const char *MODE = "NIRT";
 RFM12B *RFM12B::irq_instance = nullptr;
 #endif
 
-// scoped object setting the correct SPI parameters and selecting our radio
-struct SPIScope {
-    SPIScope(const SPISettings &s) {
-        // this is the setting to use with our RFM12 client
-        SPI.beginTransaction(s);
-        // pull SS pin low to select it, too
-        digitalWrite(RFM_SS_PIN, LOW);
-    }
-
-    ~SPIScope() {
-        digitalWrite(RFM_SS_PIN, HIGH);
-        SPI.endTransaction();
-    }
-};
+// NSEL is driven through the GPIO set/clear registers, digitalWrite is
+// too slow to be called twice per SPI word in the ISR
+static inline void rfm_select() { GPOC = 1 << RFM_SS_PIN; }
+static inline void rfm_deselect() { GPOS = 1 << RFM_SS_PIN; }
 
 void RFM12B::begin() {
     if (init) {
@@ -55,6 +46,9 @@ void RFM12B::begin() {
     init = true;
 
     SPI.begin();
+    // the radio is the only device on the bus, the bus stays set up for it.
+    // No transaction per SPI word, spi16 just toggles NSEL
+    SPI.beginTransaction(spi_settings);
 
     // set GPIO2 to be our NSEL pin
     pinMode(RFM_SS_PIN, OUTPUT);
@@ -172,6 +166,9 @@ void RFM12B::begin() {
 #ifdef DEBUG_RFM
 static volatile uint16_t isr_status = 0xFFFF;
 static volatile uint16_t isr_ctr    = 0;
+// cpu cycles spent in the ISR since the last report
+static volatile uint32_t isr_cycles     = 0;
+static volatile uint32_t isr_cycles_max = 0;
 #endif
 
 // status and counters from isr
@@ -185,20 +182,32 @@ void ICACHE_FLASH_ATTR RFM12B::update() {
 
     // interrupt(s) happened in the meantime
     if (ctr != isr_ctr) {
-        DBG("(ISR %u: %X TX %d RX %d O %d I %d/%d)",
+        uint16_t cnt = isr_ctr - ctr;
+
+        DBG("(ISR %u: %X TX %d RX %d O %d I %d%d CY %u/%u GAP %u)",
             isr_ctr,
             isr_status,
             isr_txb,
             isr_rxb,
             out.rest_size(),
-            in.rest_size(),
-            in.size());
+            slots[0].ready ? 1 : 0,
+            slots[1].ready ? 1 : 0,
+            isr_cycles / cnt,
+            isr_cycles_max,
+            turnaround_us);
 
         isr_status = 0x0FFFF;
+        isr_cycles = isr_cycles_max = 0;
         ctr = isr_ctr;
     }
 #endif
 
+    // packets lost for lack of a free slot
+    if (rx_overflows != rx_reported) {
+        rx_reported = rx_overflows;
+        ERR_ARG(RFM_RX_OVERFLOW, rx_reported);
+    }
+
 #ifndef RFM_POLL_MODE
     // handle underrun reporting
     if (isr_underrun) {
@@ -211,8 +220,9 @@ void ICACHE_FLASH_ATTR RFM12B::update() {
     // we need a polling routine called anyway, for situations
     // when send was called while we were still RX...
 
-    // if there are data in the out queue, we switch to TX
-    if (!out.empty() && (mode != TX)) {
+    // if there are data in the out queue, we switch to TX. Armed replies
+    // wait for their packet
+    if (!out.empty() && (mode != TX) && !armed) {
         switch_to_tx();
     }
 
@@ -235,49 +245,117 @@ void ICACHE_FLASH_ATTR RFM12B::update() {
             return;
         }
     } else {
-        // don't overfill the input queue!
-        if (in.full()) return;
+        // this will poll the radio if it has any data. it will be silent in
+        // IDLE mode. rx_byte will switch to RX after it gets some.
+        int b;
+        auto st = read_status_fifo(b);
+        if (b >= 0) rx_byte(b, st);
+    }
+#endif
+}
+
+bool ICACHE_FLASH_ATTR RFM12B::arm(uint8_t addr, uint8_t length,
+                                   const uint8_t *reply, uint8_t size)
+{
+    if (size > OUT_SIZE) return false;
 
-        // this will poll the radio if it has any data. it will be silent in IDLE
-        // mode. recv_byte will switch to RX after it gets some.
-        auto r = recv_byte();
-        if (r >= 0) in.push((char)r);
+    // the ISR clears the send buffer when not armed, so the reply goes in
+    // and gets armed in one step
+#ifndef RFM_POLL_MODE
+    noInterrupts();
+#endif
+    bool ok = (mode != TX) && out.empty() && !armed;
+    if (ok) {
+        out.assign(reply, size);
+        tx_addr      = addr;
+        armed_addr   = addr;
+        armed_length = length;
+        armed        = true;
     }
+#ifndef RFM_POLL_MODE
+    interrupts();
 #endif
+
+    return ok;
 }
 
 uint16_t ICACHE_FLASH_ATTR RFM12B::read_status() {
     return spi16(RFM_STATUS_CMD);
 }
 
-int ICACHE_FLASH_ATTR RFM12B::recv_byte() {
-    // can't receive in TX mode
-    if (mode == TX) return -2;
+// NOTE: Called from the ISR, no ICACHE_FLASH_ATTR
+void RFM12B::rx_byte(uint8_t b, uint16_t st) {
+    // NOTE: RGUR (FIFO overflow) is not reported, it happens too often when
+    // we're not interested in incoming data any more, but didn't manage to
+    // close the RX in time.
+    RxSlot &slot = slots[fill];
 
-    auto st = read_status();
+    // the first byte after the sync word is the length
+    if (mode == IDLE) {
+        mode  = RX;
+        limit = b & 0x7F;
 
-    if (st & RFM_STATUS_RGUR) {
-        // ERR(RFM_RX_OVERFLOW); // RX overflow
-        // Not reporting, happens too often when we're not interested in
-        // incoming data any more, but didn't manage to close the RX
-        // in time.
+        // the other packet is still being processed
+        dropping = slot.ready;
+
+        if (dropping) {
+            ++rx_overflows;
+        } else {
+            slot.data.clear();
+            slot.meta.clear();
+            slot.error = limit ? 0 : PROTO_EMPTY_PACKET;
+            slot.replied = false;
+        }
+
+        if (!limit) {
+            if (!dropping) {
+                slot.ready = true;
+                fill ^= 1;
+            }
+            switch_to_idle();
+            return;
+        }
     }
 
-    if (st & RFM_STATUS_FFIT) {
-        // forced RX as the radio woken up from IDLE for sure
-#ifdef DEBUG_RFM
-        Mode last_mode = mode;
-#endif
-        mode = RX;
-#ifdef DEBUG_RFM
-        if (last_mode != RX) { DBG("(R %c %c)", MODE[last_mode], MODE[mode]); }
-#endif
-        auto b = spi16(RFM_FIFO_READ);
-        ++counter;
-        return ((uint16_t)b & 0x00FF);
+    ++counter;
+
+    if (!dropping) {
+        slot.meta.sample(st);
+        if (!slot.data.push(b)) slot.error = PROTO_PACKET_TOO_LONG;
+    }
+
+    if (--limit) return;
+
+    if (dropping) {
+        switch_to_idle();
+        return;
+    }
+
+    // syncs have the year where others have the address
+    uint8_t addr = (slot.data[0] & 0x80) ? Capture::ADDR_NONE : slot.data[1];
+    slot.capture_seq = capture.add(
+        false, addr,
+        slot.meta.samples ? slot.meta.rssi * 100 / slot.meta.samples : 0,
+        slot.data.data(), slot.data.size());
+
+    slot.ready = true;
+    fill ^= 1;
+    rx_done = true;
+    rx_end  = micros();
+
+    // the reply is ready, no need to wait for the main loop
+    if (armed && slot.data.size() > 1 && slot.data[1] == armed_addr
+        && (!armed_length || (slot.data[0] & 0x7F) == armed_length))
+    {
+        armed = false;
+        ++armed_sent;
+        slot.replied = true;
+        switch_to_tx();
+        return;
     }
 
-    return -1;
+    // wait for the next packet right away
+    switch_to_idle();
 }
 
 bool ICACHE_FLASH_ATTR RFM12B::send_byte(unsigned char c) {
@@ -343,8 +421,30 @@ void RFM12B::switch_to_tx() {
               RFM_POWER_MANAGEMENT_ES |
               RFM_POWER_MANAGEMENT_EX);
 
-        in.clear();
+        // the transmitter is on. Sampled before the capture copy below,
+        // which is not part of the radio turnaround
+        if (rx_end) {
+            uint32_t gap = micros() - rx_end;
+            rx_end = 0;
+
+            if (gap < RFM_TURNAROUND_MAX_US) {
+                turnaround_us = gap;
+                if (gap > turnaround_max_us) turnaround_max_us = gap;
+            }
+        }
+
+        // a partially received packet is lost, complete ones stay
+        limit = 0;
         counter = 0;
+
+        // the frame follows the preamble and the sync word
+        if (out.rest_size() > 4) {
+            const uint8_t *frame = out.data() + out.pos() + 4;
+            uint8_t len = std::min<uint8_t>(frame[0] & 0x7F,
+                                            out.rest_size() - 4);
+            uint8_t addr = (frame[0] & 0x80) ? Capture::ADDR_NONE : tx_addr;
+            capture.add(true, addr, 0, frame, len);
+        }
     }
 }
 
@@ -376,26 +476,50 @@ void RFM12B::switch_to_idle() {
 #endif
         counter = 0;
 
-        out.clear();
+        // an armed reply waits for its packet
+        if (!armed) out.clear();
     }
 }
 
 uint16_t RFM12B::spi16(uint16_t reg) {
-    SPIScope scope(spi_settings);
+    rfm_select();
     uint16_t res = SPI.transfer16(reg);
+    rfm_deselect();
     return res;
 }
 
+uint16_t RFM12B::read_status_fifo(int &data) {
+    rfm_select();
+    // status command is all zeros, the status word comes in one transfer
+    uint16_t st = SPI.transfer16(RFM_STATUS_CMD);
+    // with FFIT set, clocking on after the status word reads the FIFO
+    data = (st & RFM_STATUS_FFIT) ? SPI.transfer(0) : -1;
+    rfm_deselect();
+    return st;
+}
+
 #ifndef RFM_POLL_MODE
 // NOTE: Not using ICACHE_RAM_ATTR as it seems to cause Exception 0
 // Just skipping the ICACHE_FLASH_ATTR is enough for this to work
 void ICACHE_RAM_ATTR RFM12B::rfm_interrupt_handler() {
+#ifdef DEBUG_RFM
+    uint32_t start = ESP.getCycleCount();
+#endif
+
     if (irq_instance) irq_instance->on_interrupt();
+
+#ifdef DEBUG_RFM
+    uint32_t cycles = ESP.getCycleCount() - start;
+    isr_cycles += cycles;
+    if (cycles > isr_cycles_max) isr_cycles_max = cycles;
+#endif
 }
 
 void ICACHE_RAM_ATTR RFM12B::on_interrupt() {
-    // Interrupt handler
-    auto st = spi16(RFM_STATUS_CMD);
+    // Interrupt handler. When receiving, the FIFO byte comes in the same
+    // SPI exchange as the status word
+    int b = -1;
+    auto st = mode == TX ? spi16(RFM_STATUS_CMD) : read_status_fifo(b);
 
 #ifdef DEBUG_RFM
     isr_status = st;
@@ -431,23 +555,9 @@ void ICACHE_RAM_ATTR RFM12B::on_interrupt() {
             }
         }
     } else {
-        if (st & RFM_STATUS_FFIT) {
-            // FIFO is 16 bit!
-            auto b = spi16(RFM_FIFO_READ);
-
-            if (mode == IDLE) {
-                mode = RX; // if it were IDLE, it's not any more
-                limit = b & 0x7F;
-                in.clear();
-            }
-
-            if (limit) {
-                in.push(b & 0x00FF);
-                limit--;
-                isr_rxb++;
-            } else {
-                switch_to_idle();
-            }
+        if (b >= 0) {
+            rx_byte(b, st);
+            isr_rxb++;
         }
     }
 }
@@ -23,6 +23,7 @@
 #include <SPI.h>
 
 #include "debug.h"
+#include "linkquality.h"
 #include "queue.h"
 
 namespace hr20 {
@@ -31,11 +32,30 @@ namespace hr20 {
 constexpr const uint8_t RFM_SS_PIN = 2;
 // GPIO5 is connected to NIRQ to push/pull bytes
 constexpr const uint8_t RFM_NIRQ_PIN = 5;
+// RX end to TX start gaps longer than this (us) are not counted as replies
+constexpr const uint32_t RFM_TURNAROUND_MAX_US = 100000;
 
 /*
  * A simple interface to RFM12B
  */
 struct RFM12B {
+    /// received packet. The radio fills one slot while the other one waits
+    /// to be processed
+    struct RxSlot {
+        // same type as RcvPacket. Holds the length byte too
+        ShortQ<80> data;
+        // status sampled while receiving
+        RxMeta meta;
+        // nonzero if the packet is broken, see ErrorCode
+        uint8_t error = 0;
+        // complete, owned by the main loop until release()
+        volatile bool ready = false;
+        // the armed reply went out for this packet, see arm()
+        bool replied = false;
+        // capture record of the packet, 0 if not captured
+        uint32_t capture_seq = 0;
+    };
+
     SPISettings spi_settings;
 
     enum Mode {
@@ -61,13 +81,48 @@ struct RFM12B {
         switch_to_idle();
     }
 
-    /// -1 if no data is present, >= 0 received byte
-    int recv() {
-        if (in.empty())
-            return -1;
-        return in.pop();
+    /// the oldest received packet, nullptr if none is waiting
+    RxSlot *received() {
+        return slots[read].ready ? &slots[read] : nullptr;
+    }
+
+    /// hands a slot from received() back to the radio. rx_byte() clears it
+    /// when the next packet starts - clearing it here could be reordered
+    /// after the store to ready and wipe what the ISR received meanwhile
+    void release(RxSlot *slot) {
+        slot->ready = false;
+        read ^= 1;
     }
 
+    /// true once after a packet was completed. Lets the main loop handle
+    /// the packet (and the reply) right away
+    bool rx_complete() {
+        if (!rx_done) return false;
+        rx_done = false;
+        return true;
+    }
+
+    /// send buffer size, a whole packet has to fit
+    static constexpr const uint8_t OUT_SIZE = 84;
+
+    /** holds reply (size bytes) back for addr. The reply is sent from the
+     * interrupt as soon as the last byte of a packet from addr arrives,
+     * without waiting for the main loop. Length is the expected length byte
+     * of that packet (without the sync flag), 0 for any.
+     * Returns false if the reply does not fit or the radio has something
+     * else to send by now.
+     */
+    bool arm(uint8_t addr, uint8_t length, const uint8_t *reply, uint8_t size);
+
+    /// drops the armed reply, if any
+    void disarm() {
+        if (!armed) return;
+        armed = false;
+        if (mode != TX) out.clear();
+    }
+
+    bool is_armed() const { return armed; }
+
     /// enqueues a character to be sent. returns false if fifo's full
     /// @note FILL the whole buffer in one go, or at least enough
     /// for the ISR based sending routine not to underrun. update() call
@@ -81,6 +136,9 @@ struct RFM12B {
         return true;
     }
 
+    /// client the bytes sent next are for, capture labels the frame with it
+    void send_to(uint8_t addr) { tx_addr = addr; }
+
     /// true if the output queue is empty
     bool sent() {
         return out.empty();
@@ -97,6 +155,15 @@ struct RFM12B {
     bool is_sending() const { return mode == TX; }
     bool is_receiving() const { return mode == RX; }
 
+    /// packets dropped because both slots were full
+    volatile uint32_t rx_overflows = 0;
+    /// armed replies sent from the interrupt
+    volatile uint32_t armed_sent = 0;
+    /// last and longest time from the end of a received packet to the start
+    /// of the reply, in microseconds
+    volatile uint32_t turnaround_us     = 0;
+    volatile uint32_t turnaround_max_us = 0;
+
 protected:
     bool init = false;
 
@@ -104,15 +171,31 @@ protected:
     // we have to be able to hold the whole packet at once,
     // as the naiive implementation of ShortQ does not allow for data appends
     // while being emptied (would need a circular buffer for that)
-    ShortQ<84> out, in;
+    ShortQ<OUT_SIZE> out;
+    RxSlot slots[2];
+    uint8_t fill = 0; // slot being received into
+    uint8_t read = 0; // slot to be processed next
+    bool dropping = false; // no free slot, the packet is being skipped
     uint8_t limit = 0; // read limit, decoded from the first byte
     uint8_t counter = 0; // envent counter - read/written bytes, reset on switch_*
+    uint32_t rx_reported = 0; // rx_overflows already reported
+    volatile bool rx_done = false; // see rx_complete()
+    volatile uint32_t rx_end = 0; // micros() at the end of the last packet
+
+    // client the frame in the send buffer is for, see send_to()
+    uint8_t tx_addr = 0;
+
+    // reply held back for a packet from armed_addr, see arm()
+    volatile bool armed = false;
+    uint8_t armed_addr   = 0;
+    uint8_t armed_length = 0;
 
     /// reads the status word
     uint16_t read_status();
 
-    // receives single byte data from the radio, or -1 if none are available
-    int recv_byte();
+    // stores a received byte (st is the status read with it). Re-arms the
+    // sync word detection as soon as the packet is complete
+    void rx_byte(uint8_t b, uint16_t st);
 
     // sends a byte if possible, otherwise returns false
     bool send_byte(unsigned char c);
@@ -130,6 +213,10 @@ protected:
     /// down the RFM_SS_PIN
     uint16_t spi16(uint16_t reg);
 
+    /// reads the status word, and the received byte in the same exchange if
+    /// there is one (data is -1 otherwise)
+    uint16_t read_status_fifo(int &data);
+
 #ifndef RFM_POLL_MODE
     // callback from interrupt that handles the TX/RX as needed
     void on_interrupt();
@@ -24,24 +24,23 @@ namespace hr20 {
 #define LONG_INT_DIGITS 20
 
 StrMaker & StrMaker::operator += (long int i) {
-    char buf[LONG_INT_DIGITS];
+    if (i >= 0) return this->operator+=((unsigned long)i);
+
+    append_char('-');
+    // -i would overflow for LONG_MIN
+    return this->operator+=((unsigned long)(-(i + 1)) + 1);
+}
 
-    bool neg = i < 0;
-    if (neg) i = -i;
+StrMaker & StrMaker::operator += (unsigned long u) {
+    char buf[LONG_INT_DIGITS];
 
     uint8_t p;
 
     // reverse temporary conversion
     for (p = 0; p < LONG_INT_DIGITS; ++p) {
-        buf[p] = '0' + (i % 10);
-        i = i / 10;
-        if (!i) break;
-    }
-
-    if (neg) {
-        if (full()) return *this;
-        *pos = '-';
-        ++pos;
+        buf[p] = '0' + (u % 10);
+        u = u / 10;
+        if (!u) break;
     }
 
     const char *b = &buf[p];
@@ -53,11 +52,24 @@ StrMaker & StrMaker::operator += (long int i) {
 }
 
 ICACHE_FLASH_ATTR void StrMaker::append(float f, unsigned decimals) {
-    // split to two integral parts, append both using integral append
-    int pre = f;
-    int post = (f - pre) * pow(10, decimals);
-    (*this) += pre;
+    // split to two integral parts, append both using integral append.
+    // the sign goes first, -0.5 would print as 0.-50 otherwise
+    bool neg = f < 0;
+    if (neg) f = -f;
+
+    unsigned long scale = pow(10, decimals);
+    unsigned long fixed = f * scale + 0.5f;
+
+    if (neg && fixed) (*this) += '-';
+
+    (*this) += fixed / scale;
     (*this) += '.';
+
+    // leading zeroes of the fractional part
+    unsigned long post = fixed % scale;
+    for (unsigned long d = scale / 10; d > 1 && post < d; d /= 10)
+        (*this) += '0';
+
     (*this) += post;
 }
 
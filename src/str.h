@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <functional>
+
 #include "util.h"
 
 namespace hr20 {
@@ -82,7 +84,7 @@ struct Str {
     }
 
     bool equalsIgnoreCase(const char *buf) const {
-        const char *p1 = ptr, *p2 = ptr;
+        const char *p1 = ptr, *p2 = buf;
         unsigned l1 = len, l2 = ::strlen(buf);
         for (;l1 && l2; --l1, --l2, ++p1, ++p2) {
             if (::tolower(*p1) != tolower(*p2))
@@ -102,9 +104,11 @@ struct Str {
         bool dot = false;
         const char *p = ptr;
         bool neg = false;
-        uint8_t digits = 0;
+        unsigned digits = 0;
+        // integer part is capped like in toInt(), more would overflow
+        uint8_t int_digits = 0;
 
-        if (*p == '-') {
+        if (len && *p == '-') {
             ++p;
             neg = true;
         }
@@ -122,6 +126,7 @@ struct Str {
             if (digit == -1) return false;
 
             if (!dot) {
+                if (++int_digits > 9) return false;
                 result *= 10;
                 result += digit;
                 ++digits;
@@ -141,7 +146,7 @@ struct Str {
 
     ICACHE_FLASH_ATTR bool toInt(uint8_t &tgt) const {
         int temp;
-        if (toInt(temp) && temp >= 0) {
+        if (toInt(temp) && temp >= 0 && temp <= 0xFF) {
             tgt = temp;
             return true;
         }
@@ -150,7 +155,7 @@ struct Str {
 
     ICACHE_FLASH_ATTR bool toInt(uint16_t &tgt) const {
         int temp;
-        if (toInt(temp) && temp >= 0) {
+        if (toInt(temp) && temp >= 0 && temp <= 0xFFFF) {
             tgt = temp;
             return true;
         }
@@ -165,8 +170,10 @@ struct Str {
         const char *p = ptr;
 
         bool neg = false;
+        // more would overflow
+        uint8_t digits = 0;
 
-        if (*p == '-') {
+        if (len && *p == '-') {
             ++p;
             neg = true;
         }
@@ -177,11 +184,14 @@ struct Str {
         {
             int8_t digit = todigit(*p);
             if (digit == -1) return false;
+            if (++digits > 9) return false;
 
             result *= 10;
             result += digit;
         }
 
+        if (!digits) return false;
+
         tgt = result;
         if (neg) tgt = -tgt;
         return true;
@@ -211,10 +221,20 @@ protected:
 
 /// appendable string composition helper
 struct StrMaker {
+    /// receives the buffered data of a streaming StrMaker
+    using Sink = std::function<void(const char *data, unsigned len)>;
+
     ICACHE_FLASH_ATTR StrMaker(Buffer buf)
         : ptr(buf.ptr), capacity(buf.len), pos(ptr)
     {}
 
+    /// streaming variant - whenever the buffer fills up, the contents are
+    /// handed over to the sink and the buffer is reused, so the size of the
+    /// composed string is not limited by the buffer
+    ICACHE_FLASH_ATTR StrMaker(Buffer buf, Sink sink)
+        : ptr(buf.ptr), capacity(buf.len), pos(ptr), sink(sink)
+    {}
+
     ICACHE_FLASH_ATTR Str str() {
         if (invalid()) return {};
         // zero terminate the string to be compatible with C APIs
@@ -244,13 +264,14 @@ struct StrMaker {
     }
 
     ICACHE_FLASH_ATTR StrMaker & operator += (long int i);
+    ICACHE_FLASH_ATTR StrMaker & operator += (unsigned long u);
 
     ICACHE_FLASH_ATTR StrMaker & operator += (int i) {
         return this->operator+=((long int)i);
     }
 
     ICACHE_FLASH_ATTR StrMaker & operator += (unsigned u) {
-        return this->operator+=((long int)u);
+        return this->operator+=((unsigned long)u);
     }
 
     // appends float with rounding to default num. of decimal places
@@ -269,9 +290,17 @@ struct StrMaker {
     inline const char *data() const { return ptr; }
     inline unsigned size() const  { return pos != nullptr ? pos - ptr : 0; }
 
+    /// hands the buffered data over to the sink, if there is one
+    ICACHE_FLASH_ATTR void flush() {
+        if (!sink || invalid()) return;
+        if (pos > ptr) sink(ptr, pos - ptr);
+        pos = ptr;
+    }
+
 protected:
 
     inline void append_char(char c) {
+        if (sink && pos == ptr + capacity) flush();
         if (full()) return;
         *pos = c;
         ++pos;
@@ -298,6 +327,7 @@ protected:
     char *ptr = nullptr;
     unsigned capacity = 0;
     char *pos = nullptr;
+    Sink sink;
 };
 
 } // namespace hr20
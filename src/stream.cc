@@ -0,0 +1,157 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include "stream.h"
+#include "debug.h"
+#include "eventlog.h"
+#include "json.h"
+
+namespace hr20 {
+
+static const char S_SSE_HEADER[] PROGMEM =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n\r\n";
+
+// single record size limit, client attributes take ~150 bytes
+#define STREAM_RECORD_SIZE 256
+
+ICACHE_FLASH_ATTR bool EventStream::accept(WiFiClient client) {
+    for (auto &slot : slots) {
+        if (slot.active) continue;
+
+        slot.client = client;
+        slot.client.setNoDelay(true);
+        slot.client.write(S_SSE_HEADER, sizeof(S_SSE_HEADER) - 1);
+
+        slot.active     = true;
+        // initial snapshot of all clients, events from now on
+        slot.generation = 0;
+        slot.event      = eventLog.last_seq();
+        slot.last_write = millis();
+
+        DBG("(SSE OPEN)");
+        return true;
+    }
+
+    return false;
+}
+
+ICACHE_FLASH_ATTR void EventStream::update() {
+    for (auto &slot : slots) {
+        if (!slot.active) continue;
+
+        if (!slot.client.connected()) {
+            DBG("(SSE CLOSE)");
+            slot.client.stop();
+            slot.active = false;
+            continue;
+        }
+
+        update(slot);
+    }
+}
+
+ICACHE_FLASH_ATTR void EventStream::update(Slot &slot) {
+    // out of space in the send buffer? continue next time
+    if (!send_events(slot)) return;
+    if (!send_clients(slot)) return;
+
+    // comments keep proxies from closing the idle connection
+    if (millis() - slot.last_write > WEB_STREAM_KEEPALIVE * 1000UL)
+        write(slot, Str{": \n\n", 4});
+}
+
+ICACHE_FLASH_ATTR bool EventStream::send_events(Slot &slot) {
+    if (slot.event >= eventLog.last_seq()) return true;
+
+    // overwritten before we managed to send it
+    if (slot.event + 1 < eventLog.first_seq()) {
+        send_resync(slot);
+        return false;
+    }
+
+    EventLog::Reader reader(eventLog, slot.event + 1);
+    Event ev;
+
+    while (reader.next(ev)) {
+        BufferHolder<STREAM_RECORD_SIZE> buf;
+        StrMaker rec(buf);
+        rec += "event: log\ndata: ";
+        json::append_event(rec, ev, slot.event + 1);
+        rec += "\n\n";
+
+        if (!write(slot, rec.str())) return false;
+        ++slot.event;
+    }
+
+    return true;
+}
+
+ICACHE_FLASH_ATTR bool EventStream::send_clients(Slot &slot) {
+    uint32_t gen = model.generation;
+    if (slot.generation >= gen) return true;
+
+    for (uint8_t addr = 0; addr < MAX_HR_ADDR; ++addr) {
+        auto *hr = model[addr];
+
+        if (!hr) continue;
+        if (hr->last_contact == 0) continue;
+        if (hr->generation <= slot.generation) continue;
+
+        BufferHolder<STREAM_RECORD_SIZE> buf;
+        StrMaker rec(buf);
+        rec += "event: client\ndata: ";
+        {
+            json::Object obj(rec);
+            obj.key(addr);
+            json::append_client_attr(rec, *hr);
+        }
+        rec += "\n\n";
+
+        // the cursor stays, so clients sent already will be sent again.
+        // harmless as these are whole state snapshots
+        if (!write(slot, rec.str())) return false;
+    }
+
+    slot.generation = gen;
+    return true;
+}
+
+ICACHE_FLASH_ATTR void EventStream::send_resync(Slot &slot) {
+    static const char S_RESYNC[] = "event: resync\ndata: {}\n\n";
+
+    // the client refetches everything, skip what we have not sent
+    if (write(slot, Str{S_RESYNC, sizeof(S_RESYNC) - 1}))
+        slot.event = eventLog.last_seq();
+}
+
+ICACHE_FLASH_ATTR bool EventStream::write(Slot &slot, const Str &record) {
+    // invalid StrMaker result - record did not fit the buffer
+    if (!record.length()) return true;
+
+    if (slot.client.availableForWrite() < record.length()) return false;
+
+    slot.client.write(reinterpret_cast<const uint8_t *>(record.data()),
+                      record.length());
+    slot.last_write = millis();
+    return true;
+}
+
+} // namespace hr20
@@ -0,0 +1,73 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#include "config.h"
+#include "model.h"
+#include "str.h"
+
+namespace hr20 {
+
+/** Server-Sent Events push of client state and event log records.
+ *
+ * Each connected client keeps cursors into the model (generation) and into
+ * the event log, and update() sends whatever is newer than these. Nothing
+ * is queued per client - a slow client just lags behind, so the only thing
+ * it can lose is event log records that got overwritten meanwhile. It gets
+ * a "resync" record then, telling it to refetch /list and /events.
+ *
+ * Records:
+ *   event: client  data: {"ADDR": {client attributes as in /list}}
+ *   event: log     data: {event as in /events}
+ *   event: resync  data: {}
+ */
+struct EventStream {
+    EventStream(Model &model) : model(model) {}
+
+    /// takes over the connection. Returns false if there is no free slot
+    bool accept(WiFiClient client);
+
+    /// sends pending records to all connected clients
+    void update();
+
+protected:
+    struct Slot {
+        WiFiClient client;
+        bool active = false;
+        uint32_t generation = 0; // model generation sent already
+        uint32_t event      = 0; // seq of the last event log record sent
+        unsigned long last_write = 0;
+    };
+
+    void update(Slot &slot);
+    bool send_events(Slot &slot);
+    bool send_clients(Slot &slot);
+    void send_resync(Slot &slot);
+
+    /// writes whole record or nothing. Returns false if it did not fit
+    bool write(Slot &slot, const Str &record);
+
+    Model &model;
+    Slot slots[WEB_STREAM_SLOTS];
+};
+
+} // namespace hr20
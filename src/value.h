@@ -20,6 +20,7 @@
 #pragma once
 
 #include "converters.h"
+#include "error.h"
 
 namespace hr20 {
 
@@ -22,6 +22,10 @@
 
 #include "webserver.h"
 #include "util.h"
+#include "journal.h"
+#include "counters.h"
+#include "metrics.h"
+#include "capture.h"
 
 namespace hr20 {
 
@@ -65,6 +69,7 @@ ICACHE_FLASH_ATTR Web::Web(Config &config, HR20Master &master)
                  wifiInitialApPassword,
                  CONFIG_VERSION),
       master(master),
+      stream(master.model),
       rfm_pass("RFM Password", "rfm_pass", config.rfm_pass_hex, 17),
       separator1(),
       ntp_server("NTP Server", "ntp_server", config.ntp_server, 40)
@@ -112,9 +117,21 @@ ICACHE_FLASH_ATTR void Web::begin() {
 
     iotWebConf.init();
 
+    boot_nonce = random(0x7FFFFFFF);
+
+    // needed for conditional requests
+    static const char *headers[] = {"If-None-Match"};
+    server.collectHeaders(headers, 1);
+
     server.on("/list", [&]   { handle_list(); } );
     server.on("/timer", [&]  { handle_timer(); } );
     server.on("/events", [&] { handle_events(); } );
+    server.on("/stream", [&] { handle_stream(); } );
+    server.on("/journal", [&] { handle_journal(); } );
+    server.on("/counters", [&] { handle_counters(); } );
+    server.on("/radio", [&] { handle_radio(); } );
+    server.on("/metrics", [&] { handle_metrics(); } );
+    server.on("/capture", [&] { handle_capture(); } );
 
     // iotWebConf handling
     server.on("/config", [&] { iotWebConf.handleConfig(); });
@@ -127,10 +144,85 @@ ICACHE_FLASH_ATTR void Web::begin() {
     server.begin();
 }
 
+ICACHE_FLASH_ATTR StrMaker Web::begin_chunked(const char *type) {
+    // unknown length means chunked transfer encoding
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, type, "");
+
+    return StrMaker(chunk, [&](const char *data, unsigned len) {
+                               server.sendContent_P(data, len);
+                           });
+}
+
+ICACHE_FLASH_ATTR void Web::end_json(StrMaker &result) {
+    result += "\r\n";
+    end_chunked(result);
+}
+
+ICACHE_FLASH_ATTR void Web::end_chunked(StrMaker &result) {
+    result.flush();
+
+    // empty chunk terminates the response
+    server.sendContent("");
+}
+
+// FNV-1a hash of the file contents, used for static file ETags
+ICACHE_FLASH_ATTR static uint32_t hash_file(File &f) {
+    uint32_t hash = 2166136261UL;
+    uint8_t buf[64];
+
+    while (size_t len = f.read(buf, sizeof(buf))) {
+        for (size_t i = 0; i < len; ++i) {
+            hash ^= buf[i];
+            hash *= 16777619UL;
+        }
+    }
+
+    f.seek(0);
+    return hash;
+}
+
+ICACHE_FLASH_ATTR bool Web::not_modified(uint32_t generation) {
+    return not_modified(boot_nonce, generation);
+}
+
+ICACHE_FLASH_ATTR bool Web::not_modified(uint32_t prefix, uint32_t tag) {
+    BufferHolder<24> buf;
+    StrMaker etag(buf);
+    etag += '"';
+    etag += (long)(prefix & 0x7FFFFFFF);
+    etag += '-';
+    etag += (long)(tag & 0x7FFFFFFF);
+    etag += '"';
+
+    server.sendHeader("ETag", etag.str().c_str());
+
+    if (server.header("If-None-Match") == etag.str().c_str()) {
+        server.send(304);
+        return true;
+    }
+
+    return false;
+}
+
 ICACHE_FLASH_ATTR void Web::handle_list() {
-    // we need 32*140 for client list
-    static BufferHolder<LIST_MAX_SIZE> buf;
-    StrMaker result(buf);
+    uint32_t gen = master.model.generation;
+
+    // only clients changed after this generation are listed
+    auto ssince = server.arg("since");
+    uint32_t since = std::max(0L, ssince.toInt());
+
+    // generations restart from zero on reboot. list everything then
+    if (since > gen) since = 0;
+
+    // the tag only covers the full list. a delta depends on since as well,
+    // and an up to date one is an empty object anyway
+    if (!since && not_modified(gen)) return;
+
+    // the generation to use for the next ?since= query
+    server.sendHeader("X-Generation", String(gen));
+
+    StrMaker result = begin_json();
     {
         json::Object main(result);
 
@@ -140,6 +232,7 @@ ICACHE_FLASH_ATTR void Web::handle_list() {
 
             if (!m) continue;
             if (m->last_contact == 0) continue;
+            if (m->generation <= since) continue;
 
             // append a key for this client
             main.key(i);
@@ -149,18 +242,10 @@ ICACHE_FLASH_ATTR void Web::handle_list() {
 
     } // closes the curly brace
 
-    result += "\r\n";
-
-    // compose a json list of all visible clients
-    // send header and content separately
-    server.sendContent_P(JSON200, JSON200_LEN);
-    server.sendContent_P(result.data(), result.size());
+    end_json(result);
 }
 
 ICACHE_FLASH_ATTR void Web::handle_timer() {
-    // WE NEED 32*8*8 for timers
-    static BufferHolder<TIMER_MAX_SIZE> buf;
-    StrMaker result(buf);
     // did we get an argument?
     auto client = server.arg("client");
 
@@ -179,6 +264,10 @@ ICACHE_FLASH_ATTR void Web::handle_timer() {
         return;
     }
 
+    if (not_modified(m->generation)) return;
+
+    StrMaker result = begin_json();
+
     { // intentional brace to close the json before we send it
         json::Object obj(result);
 
@@ -189,37 +278,37 @@ ICACHE_FLASH_ATTR void Web::handle_timer() {
         }
     }
 
-    result += "\r\n";
-
-    server.sendContent_P(JSON200, JSON200_LEN);
-    server.sendContent_P(result.data(), result.size());
+    end_json(result);
 }
 
 ICACHE_FLASH_ATTR void Web::handle_events() {
-    static BufferHolder<EVENT_MAX_SIZE> buf;
-    StrMaker result(buf);
+    // cursor based paging, oldest first
+    if (server.hasArg("after")) {
+        handle_events_after();
+        return;
+    }
 
+    // legacy offset paging, newest first
     auto soffset = server.arg("offset");
     unsigned offset   = std::max(0L, soffset.toInt());
     unsigned counter  = MAX_JSON_EVENTS;
+
+    StrMaker result = begin_json();
     {
         json::Object main(result);
 
         main.key("events");
         json::Array arr(main);
 
-        // iterate all clients
-        for (const auto &event : eventLog) {
-            if (offset != 0) {
-                --offset;
-                continue;
-            }
+        uint32_t first = eventLog.first_seq();
+        uint32_t seq   = eventLog.last_seq();
 
-            if (!counter) break;
-            --counter;
+        // iterate from the newest event back
+        for (; seq >= first && offset; --seq, --offset) {}
 
-            // skip empty events
-            if (event.time == 0) continue;
+        Event event;
+        for (; seq >= first && counter; --seq, --counter) {
+            if (!eventLog.get(seq, event)) break;
 
             // a comma is inserted unless this is first element
             arr.element();
@@ -230,10 +319,273 @@ ICACHE_FLASH_ATTR void Web::handle_events() {
 
     } // closes the curly brace
 
-    result += "\r\n";
+    end_json(result);
+}
+
+ICACHE_FLASH_ATTR void Web::handle_events_after() {
+    uint32_t after = strtoul(server.arg("after").c_str(), nullptr, 10);
+    long limit     = MAX_JSON_EVENTS;
+
+    if (server.hasArg("limit")) limit = server.arg("limit").toInt();
+    if (limit <= 0 || limit > EventLog::MAX_EVENTS) limit = EventLog::MAX_EVENTS;
+
+    uint32_t first = eventLog.first_seq();
+    uint32_t last  = eventLog.last_seq();
+
+    // cursor from before reboot - the boot nonce tells the client
+    if (after > last) after = 0;
+
+    // events overwritten since the client's cursor
+    uint32_t lost = 0;
+    uint32_t seq  = after + 1;
+    if (seq < first) {
+        lost = first - seq;
+        seq  = first;
+    }
+
+    StrMaker result = begin_json();
+    {
+        json::Object main(result);
+
+        json::kv_raw(main, "boot", (long)(boot_nonce & 0x7FFFFFFF));
+        json::kv_raw(main, "lost", (long)lost);
+
+        main.key("events");
+        {
+            json::Array arr(main);
 
-    server.sendContent_P(JSON200, JSON200_LEN);
-    server.sendContent_P(result.data(), result.size());
+            EventLog::Reader reader(eventLog, seq);
+            Event ev;
+
+            for (; limit && reader.next(ev); ++seq, --limit) {
+                arr.element();
+                json::append_event(result, ev, seq);
+            }
+        }
+
+        // cursor for the next request
+        json::kv_raw(main, "next", (long)(seq - 1));
+    }
+
+    end_json(result);
+}
+
+ICACHE_FLASH_ATTR void Web::handle_journal() {
+    uint32_t after = strtoul(server.arg("after").c_str(), nullptr, 10);
+    long limit     = MAX_JSON_EVENTS;
+
+    if (server.hasArg("limit")) limit = server.arg("limit").toInt();
+    if (limit <= 0 || limit > EventLog::MAX_EVENTS) limit = EventLog::MAX_EVENTS;
+
+    StrMaker result = begin_json();
+    {
+        json::Object main(result);
+
+        main.key("events");
+
+        uint32_t lost = 0;
+        uint32_t next;
+        {
+            json::Array arr(main);
+
+            next = journal.read(after, limit,
+                                [&](uint32_t seq, const Event &ev) {
+                                    arr.element();
+                                    json::append_event(result, ev, seq);
+                                    return true;
+                                },
+                                lost);
+        }
+
+        // lost is known only after reading, hence at the end
+        json::kv_raw(main, "lost", (long)lost);
+        json::kv_raw(main, "last", (long)journal.last_seq());
+        // cursor for the next request
+        json::kv_raw(main, "next", (long)next);
+    }
+
+    end_json(result);
+}
+
+ICACHE_FLASH_ATTR static const char *counter_name(EventType type,
+                                                  uint8_t code)
+{
+    return type == EventType::ERROR ? err_to_str(static_cast<ErrorCode>(code))
+                                    : event_to_str(static_cast<EventCode>(code));
+}
+
+// nonzero counters of one type as name: count pairs
+ICACHE_FLASH_ATTR static void append_counters(json::Object &obj,
+                                              EventType type, uint8_t max)
+{
+    for (uint8_t code = 0; code < max; ++code) {
+        uint32_t cnt = counters.get(type, code);
+        if (cnt) json::kv_raw(obj, counter_name(type, code), (unsigned long)cnt);
+    }
+}
+
+#ifdef COUNTER_RATES
+ICACHE_FLASH_ATTR static void append_rates(json::Object &obj,
+                                           EventType type, uint8_t max)
+{
+    for (uint8_t code = 0; code < max; ++code) {
+        uint16_t rate = counters.rate(type, code);
+        if (rate) json::kv_raw(obj, counter_name(type, code), (unsigned)rate);
+    }
+}
+#endif
+
+// per client counters of addr, returns false if all are zero
+ICACHE_FLASH_ATTR static bool client_counters(uint8_t addr,
+                                              json::Object *obj = nullptr)
+{
+    bool any = false;
+
+    for (uint8_t slot = 0; slot < Counters::CLIENT_CODES; ++slot) {
+        EventType type;
+        uint8_t code;
+        Counters::slot_code(slot, type, code);
+
+        uint32_t cnt = counters.get(addr, type, code);
+        if (!cnt) continue;
+
+        any = true;
+        if (obj) json::kv_raw(*obj, counter_name(type, code), (unsigned long)cnt);
+    }
+
+    return any;
+}
+
+ICACHE_FLASH_ATTR void Web::handle_counters() {
+    StrMaker result = begin_json();
+    {
+        json::Object main(result);
+
+        main.key("errors");
+        {
+            json::Object obj(main);
+            append_counters(obj, EventType::ERROR, Counters::ERROR_CODES);
+        }
+
+        main.key("events");
+        {
+            json::Object obj(main);
+            append_counters(obj, EventType::EVENT, Counters::EVENT_CODES);
+        }
+
+#ifdef COUNTER_RATES
+        // counts of the last whole minute
+        main.key("rates");
+        {
+            json::Object rates(main);
+
+            rates.key("errors");
+            {
+                json::Object obj(rates);
+                append_rates(obj, EventType::ERROR, Counters::ERROR_CODES);
+            }
+
+            rates.key("events");
+            {
+                json::Object obj(rates);
+                append_rates(obj, EventType::EVENT, Counters::EVENT_CODES);
+            }
+        }
+#endif
+
+        main.key("clients");
+        {
+            json::Object clients(main);
+
+            for (uint8_t addr = 1; addr < MAX_HR_ADDR; ++addr) {
+                if (!client_counters(addr)) continue;
+
+                clients.key(addr);
+                json::Object obj(clients);
+                client_counters(addr, &obj);
+            }
+        }
+    }
+
+    end_json(result);
+}
+
+ICACHE_FLASH_ATTR void Web::handle_radio() {
+    StrMaker result = begin_json();
+    {
+        json::Object main(result);
+
+        for (uint8_t i = 0; i < hr20::MAX_HR_ADDR; ++i) {
+            auto m = master.model[i];
+
+            if (!m || !m->radio.packets) continue;
+
+            main.key(i);
+            json::append_client_radio(result, *m);
+        }
+    }
+
+    end_json(result);
+}
+
+ICACHE_FLASH_ATTR void Web::handle_metrics() {
+    StrMaker result = begin_chunked("text/plain; version=0.0.4");
+    append_metrics(result, master, publisher);
+    end_chunked(result);
+}
+
+ICACHE_FLASH_ATTR void Web::handle_capture() {
+    // any of these change the capture settings, the reply is the status then
+    bool settings = false;
+
+    if (server.hasArg("enable")) {
+        capture.enabled = server.arg("enable").toInt() != 0;
+        settings = true;
+    }
+
+    if (server.hasArg("filter")) {
+        long addr = server.arg("filter").toInt();
+        capture.filter = (addr > 0 && addr < MAX_HR_ADDR) ? addr
+                                                          : Capture::ADDR_NONE;
+        settings = true;
+    }
+
+    if (server.hasArg("full")) {
+        capture.stop_when_full = server.arg("full") == "stop";
+        settings = true;
+    }
+
+    if (server.hasArg("clear")) {
+        capture.clear();
+        settings = true;
+    }
+
+    if (settings) {
+        StrMaker result = begin_json();
+        {
+            json::Object main(result);
+            json::kv_raw(main, "enabled", capture.enabled ? "true" : "false");
+            json::kv_raw(main, "filter", capture.filter == Capture::ADDR_NONE
+                                             ? -1 : (int)capture.filter);
+            json::kv_str(main, "full", capture.stop_when_full ? "stop" : "wrap");
+            json::kv_raw(main, "records", (unsigned long)capture.size());
+            json::kv_raw(main, "lost", (unsigned long)capture.lost);
+        }
+        end_json(result);
+        return;
+    }
+
+    server.sendHeader("Content-Disposition",
+                      "attachment; filename=\"hr20.pcap\"");
+    StrMaker result = begin_chunked("application/vnd.tcpdump.pcap");
+    capture.pcap(result, master.time.unixTime());
+    end_chunked(result);
+}
+
+ICACHE_FLASH_ATTR void Web::handle_stream() {
+    // the connection is kept open by the stream, not by the server
+    if (!stream.accept(server.client()))
+        server.send_P(503, "text/plain", "Too many streams");
 }
 
 ICACHE_FLASH_ATTR void Web::handle_root() {
@@ -255,13 +607,33 @@ ICACHE_FLASH_ATTR void Web::handle_root() {
     }
 
     DBG("(handle_root %d)", iotWebConf.getState());
-    File f = SPIFFS.open("/index.html", "r");
+    serve_index();
+}
+
+ICACHE_FLASH_ATTR void Web::serve_index() {
+    File f = SPIFFS.open("/index.html.gz", "r");
+
+    // uncompressed fallback, in case the fs image was built by hand
+    if (!f) {
+        f = SPIFFS.open("/index.html", "r");
+        server.streamFile(f, "text/html");
+        return;
+    }
+
+    if (!index_hash) index_hash = hash_file(f) | 1;
+
+    if (not_modified(f.size(), index_hash)) return;
+
+    server.sendHeader("Cache-Control", "max-age=" WEB_STATIC_MAX_AGE);
+
+    // streamFile adds Content-Encoding: gzip for .gz files
     server.streamFile(f, "text/html");
 }
 
 ICACHE_FLASH_ATTR void Web::update() {
     iotWebConf.doLoop();
     server.handleClient();
+    stream.update();
 }
 
 ICACHE_FLASH_ATTR bool Web::validate_config() {
@@ -26,15 +26,13 @@
 #include "config.h"
 #include "master.h"
 #include "json.h"
-
-#define LIST_MAX_SIZE (32*140)
-#define TIMER_MAX_SIZE (32*8*8)
-#define EVENT_MAX_SIZE (100*MAX_JSON_EVENTS)
+#include "stream.h"
 
 namespace hr20 {
 
-#define JSON200 "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"
-#define JSON200_LEN 70
+namespace mqtt {
+struct MQTTPublisher;
+} // namespace mqtt
 
 struct Web {
     Web(Config &config, HR20Master &master);
@@ -42,18 +40,56 @@ struct Web {
     void begin();
     void update();
 
+    /// publisher's counters are included in /metrics if set
+    void set_publisher(mqtt::MQTTPublisher *pub) { publisher = pub; }
+
 protected:
     void handle_list();
     void handle_timer();
     void handle_events();
+    void handle_events_after();
+    void handle_journal();
+    void handle_counters();
+    void handle_radio();
+    void handle_metrics();
+    void handle_capture();
+    void handle_stream();
     void handle_root();
     bool validate_config();
 
+    // starts a chunked response, returns a maker streaming into it
+    StrMaker begin_chunked(const char *type);
+    // flushes the rest of the response and terminates it
+    void end_chunked(StrMaker &result);
+    // chunked response variants for json
+    StrMaker begin_json() { return begin_chunked("application/json"); }
+    void end_json(StrMaker &result);
+    // sends ETag for the generation, replies 304 and returns true if the
+    // client already has it
+    bool not_modified(uint32_t generation);
+    bool not_modified(uint32_t prefix, uint32_t tag);
+    // serves index.html from SPIFFS, preferring the pre-compressed .gz
+    // variant. Its ETag is the cached index_hash
+    void serve_index();
+
     Config &config;
     DNSServer dnsServer;
     WebServer server;
     IotWebConf iotWebConf;
     HR20Master &master;
+    mqtt::MQTTPublisher *publisher = nullptr;
+
+    // responses are composed in this buffer and sent out chunk by chunk
+    BufferHolder<WEB_CHUNK_SIZE> chunk;
+
+    // live push of changes over server-sent events
+    EventStream stream;
+
+    // makes ETags differ between reboots, as generations start from zero
+    uint32_t boot_nonce = 0;
+
+    // content hash of the compressed index.html, computed on first request
+    uint32_t index_hash = 0;
 
     IotWebConfParameter rfm_pass;
     IotWebConfSeparator separator1;
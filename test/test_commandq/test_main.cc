@@ -0,0 +1,162 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+// Staging of set requests, chained ones in particular
+
+#include <unity.h>
+
+#include "command.h"
+
+using namespace hr20;
+
+namespace {
+
+using Queue = CommandQ<8>;
+
+/// pops the next group the way apply_commands does - up to and including
+/// the first command that is not chained. Returns the group size
+uint8_t next_group(Queue &q, Command *out) {
+    uint8_t n = 0;
+    Command cmd;
+    while (q.pop(cmd)) {
+        out[n++] = cmd;
+        if (!cmd.chained) break;
+    }
+    return n;
+}
+
+void test_singles_coalesce() {
+    Queue q;
+    q.push({1, Command::TEMP, 40});
+    q.push({2, Command::TEMP, 42});
+    q.push({1, Command::TEMP, 44});
+
+    TEST_ASSERT_EQUAL(2, q.size());
+    TEST_ASSERT_EQUAL(1, q.coalesced);
+
+    Command g[8];
+    TEST_ASSERT_EQUAL(1, next_group(q, g));
+    TEST_ASSERT_EQUAL(1, g[0].addr);
+    TEST_ASSERT_EQUAL(44, g[0].value);
+}
+
+void test_batch_overlapping_staged_single() {
+    Queue q;
+    q.push({1, Command::TEMP, 40});
+
+    // set/batch or a mode change touching the staged value
+    Command batch[] = {{1, Command::TEMP, 44}, {1, Command::AUTO, 1}};
+    TEST_ASSERT_TRUE(q.push_all(batch, 2));
+
+    // the chain stays whole and after the single
+    TEST_ASSERT_EQUAL(3, q.size());
+    TEST_ASSERT_EQUAL(0, q.coalesced);
+
+    Command g[8];
+    TEST_ASSERT_EQUAL(1, next_group(q, g));
+    TEST_ASSERT_EQUAL(40, g[0].value);
+
+    TEST_ASSERT_EQUAL(2, next_group(q, g));
+    TEST_ASSERT_EQUAL(Command::TEMP, g[0].kind);
+    TEST_ASSERT_EQUAL(44, g[0].value);
+    TEST_ASSERT_EQUAL(Command::AUTO, g[1].kind);
+
+    TEST_ASSERT_TRUE(q.empty());
+}
+
+void test_single_after_batch_is_not_merged_into_it() {
+    Queue q;
+    Command batch[] = {{1, Command::TEMP, 44}, {1, Command::AUTO, 1}};
+    q.push_all(batch, 2);
+
+    // neither the last nor the other chain members take it
+    q.push({1, Command::AUTO, 0});
+    q.push({1, Command::TEMP, 50});
+    // ...but singles still coalesce among themselves
+    q.push({1, Command::TEMP, 52});
+
+    TEST_ASSERT_EQUAL(4, q.size());
+
+    Command g[8];
+    TEST_ASSERT_EQUAL(2, next_group(q, g));
+    TEST_ASSERT_EQUAL(44, g[0].value);
+    TEST_ASSERT_EQUAL(1, g[1].value);
+
+    TEST_ASSERT_EQUAL(1, next_group(q, g));
+    TEST_ASSERT_EQUAL(Command::AUTO, g[0].kind);
+    TEST_ASSERT_EQUAL(0, g[0].value);
+
+    TEST_ASSERT_EQUAL(1, next_group(q, g));
+    TEST_ASSERT_EQUAL(52, g[0].value);
+}
+
+void test_newest_change_wins() {
+    Queue q;
+    q.push({1, Command::TEMP, 40});
+    Command batch[] = {{1, Command::TEMP, 44}, {1, Command::AUTO, 1}};
+    q.push_all(batch, 2);
+
+    // must not go into the single in front of the batch, the batch would
+    // override it
+    q.push({1, Command::TEMP, 50});
+
+    Command g[8], last;
+    while (uint8_t n = next_group(q, g))
+        for (uint8_t i = 0; i < n; ++i)
+            if (g[i].kind == Command::TEMP) last = g[i];
+
+    TEST_ASSERT_EQUAL(50, last.value);
+}
+
+void test_chained_flag_of_single_is_ignored() {
+    Queue q;
+    Command c{1, Command::TEMP, 40};
+    c.chained = true;
+    q.push(c);
+    q.push({2, Command::TEMP, 42});
+
+    Command g[8];
+    TEST_ASSERT_EQUAL(1, next_group(q, g));
+    TEST_ASSERT_EQUAL(1, next_group(q, g));
+}
+
+void test_batch_all_or_nothing() {
+    Queue q;
+    for (uint8_t a = 1; a <= 7; ++a) q.push({a, Command::TEMP, 40});
+
+    Command batch[] = {{1, Command::TEMP, 44}, {1, Command::AUTO, 1}};
+    TEST_ASSERT_FALSE(q.push_all(batch, 2));
+    TEST_ASSERT_EQUAL(7, q.size());
+    TEST_ASSERT_EQUAL(1, q.overflows);
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_singles_coalesce);
+    RUN_TEST(test_batch_overlapping_staged_single);
+    RUN_TEST(test_single_after_batch_is_not_merged_into_it);
+    RUN_TEST(test_newest_change_wins);
+    RUN_TEST(test_chained_flag_of_single_is_ignored);
+    RUN_TEST(test_batch_all_or_nothing);
+    return UNITY_END();
+}
@@ -0,0 +1,243 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+// Connection state machine against a stand-in broker, see tools/shim
+
+#include <unity.h>
+
+#include "mqttconn.h"
+
+using namespace hr20;
+using namespace hr20::mqtt;
+
+namespace {
+
+const uint8_t CONNACK_OK[]      = {0x20, 0x02, 0x00, 0x00};
+const uint8_t CONNACK_REFUSED[] = {0x20, 0x02, 0x00, 0x05};
+
+struct Fixture {
+    Fixture() : link(wifi), client(link), conn(config, wifi, link, client) {
+        strcpy(config.mqtt_client_id, "hr20");
+        strcpy(config.mqtt_server, "10.0.0.1");
+        WiFi.wl_status = WL_CONNECTED;
+        at(1000);
+        conn.begin("hr20/set/#");
+    }
+
+    void at(unsigned long ms) { shim_set_time(ms / 1000, ms); }
+
+    /// the broker's answer to the CONNECT sent
+    void answer(const uint8_t *connack) {
+        wifi.incoming.append(reinterpret_cast<const char *>(connack), 4);
+    }
+
+    /// runs update() until CONNECT was sent, returns the calls it took
+    int until_connect_sent() {
+        int calls = 0;
+        while (wifi.sent.empty() && calls < 10) {
+            conn.update();
+            ++calls;
+        }
+        return calls;
+    }
+
+    Config config;
+    WiFiClient wifi;
+    Link link;
+    PubSubClient client;
+    Connection conn;
+};
+
+void test_connects_in_steps() {
+    Fixture f;
+
+    // backoff check, resolve, TCP connect, CONNECT - one per call
+    TEST_ASSERT_EQUAL(4, f.until_connect_sent());
+    TEST_ASSERT_EQUAL(1, f.wifi.connects);
+
+    const char CONNECT[] = "\x10\x10\x00\x04MQTT\x04\x02\x00\x0F\x00\x04hr20";
+    TEST_ASSERT_EQUAL(sizeof(CONNECT) - 1, f.wifi.sent.size());
+    TEST_ASSERT_EQUAL_MEMORY(CONNECT, f.wifi.sent.data(), f.wifi.sent.size());
+
+    // no CONNACK yet - returns at once instead of waiting
+    TEST_ASSERT_FALSE(f.conn.update());
+    TEST_ASSERT_FALSE(f.conn.update());
+
+    f.answer(CONNACK_OK);
+    TEST_ASSERT_FALSE(f.conn.update()); // CONNACK
+    TEST_ASSERT_TRUE(f.conn.update());  // SUBSCRIBE
+
+    TEST_ASSERT_TRUE(f.conn.connected());
+    TEST_ASSERT_TRUE(f.client.connected());
+    TEST_ASSERT_EQUAL(0, f.client.blocked);
+    TEST_ASSERT_EQUAL_STRING("hr20/set/#", f.client.subscribed.c_str());
+    TEST_ASSERT_EQUAL(1, f.conn.connects);
+    TEST_ASSERT_EQUAL(0, f.conn.failures);
+
+    // PubSubClient's own CONNECT did not reach the broker
+    TEST_ASSERT_EQUAL(sizeof(CONNECT) - 1, f.wifi.sent.size());
+}
+
+void test_login_with_user() {
+    Fixture f;
+    strcpy(f.config.mqtt_user, "u");
+    strcpy(f.config.mqtt_pass, "pw");
+
+    f.until_connect_sent();
+
+    const char CONNECT[] =
+        "\x10\x17\x00\x04MQTT\x04\xC2\x00\x0F\x00\x04hr20\x00\x01u\x00\x02pw";
+    TEST_ASSERT_EQUAL(sizeof(CONNECT) - 1, f.wifi.sent.size());
+    TEST_ASSERT_EQUAL_MEMORY(CONNECT, f.wifi.sent.data(), f.wifi.sent.size());
+}
+
+void test_connack_timeout_backs_off() {
+    Fixture f;
+    const unsigned long WAIT = MQTT_RECONNECT_TIME * 1000UL;
+
+    f.until_connect_sent();
+    f.at(1000 + MQTT_CONNACK_TIMEOUT * 1000UL);
+    f.conn.update();
+
+    TEST_ASSERT_EQUAL(1, f.conn.failures);
+    TEST_ASSERT_FALSE(f.wifi.open);
+
+    // no attempt before the wait, one after it and its jitter
+    f.wifi.sent.clear();
+    f.at(2000 + WAIT - 1);
+    TEST_ASSERT_EQUAL(10, f.until_connect_sent());
+    f.at(2000 + WAIT + WAIT / 4);
+    TEST_ASSERT_EQUAL(3, f.until_connect_sent()); // address is known
+    TEST_ASSERT_EQUAL(2, f.wifi.connects);
+
+    // the next wait is twice as long
+    unsigned long failed_at = 2000 + WAIT + WAIT / 4 + 1000;
+    f.at(failed_at);
+    f.conn.update();
+    TEST_ASSERT_EQUAL(2, f.conn.failures);
+
+    f.wifi.sent.clear();
+    f.at(failed_at + 2 * WAIT - 1);
+    TEST_ASSERT_EQUAL(10, f.until_connect_sent());
+    f.at(failed_at + 2 * WAIT + WAIT / 2);
+    TEST_ASSERT_EQUAL(3, f.until_connect_sent());
+}
+
+void test_refused() {
+    Fixture f;
+
+    f.until_connect_sent();
+    f.answer(CONNACK_REFUSED);
+    f.conn.update();
+
+    TEST_ASSERT_FALSE(f.conn.connected());
+    TEST_ASSERT_FALSE(f.client.connected());
+    TEST_ASSERT_FALSE(f.wifi.open);
+    TEST_ASSERT_EQUAL(1, f.conn.failures);
+}
+
+void test_tcp_and_dns_failures() {
+    Fixture f;
+    const unsigned long WAIT = MQTT_RECONNECT_TIME * 1000UL;
+
+    f.wifi.accept = false;
+    TEST_ASSERT_EQUAL(10, f.until_connect_sent());
+    TEST_ASSERT_EQUAL(1, f.conn.failures);
+
+    // names get resolved again after a failed TCP connect
+    strcpy(f.config.mqtt_server, "broker");
+    WiFi.resolves = false;
+    f.at(1000 + 2 * WAIT);
+    TEST_ASSERT_EQUAL(10, f.until_connect_sent());
+    TEST_ASSERT_EQUAL(2, f.conn.failures);
+    TEST_ASSERT_EQUAL(1, f.wifi.connects);
+
+    WiFi.resolves = true;
+    f.wifi.accept = true;
+    f.at(1000 + 6 * WAIT);
+    TEST_ASSERT_EQUAL(4, f.until_connect_sent());
+}
+
+void test_no_wifi_no_attempt() {
+    Fixture f;
+
+    WiFi.wl_status = WL_DISCONNECTED;
+    TEST_ASSERT_EQUAL(10, f.until_connect_sent());
+    TEST_ASSERT_EQUAL(0, f.wifi.connects);
+    TEST_ASSERT_EQUAL(0, f.conn.failures);
+}
+
+void test_lost_connection_reconnects() {
+    Fixture f;
+    const unsigned long WAIT = MQTT_RECONNECT_TIME * 1000UL;
+
+    f.until_connect_sent();
+    f.answer(CONNACK_OK);
+    f.conn.update();
+    TEST_ASSERT_TRUE(f.conn.update());
+
+    // the broker went away. not a failed attempt
+    f.wifi.open = false;
+    TEST_ASSERT_FALSE(f.conn.update());
+    TEST_ASSERT_EQUAL(0, f.conn.failures);
+
+    f.wifi.sent.clear();
+    f.at(1000 + WAIT + WAIT / 4);
+    TEST_ASSERT_EQUAL(3, f.until_connect_sent()); // address is known
+    f.answer(CONNACK_OK);
+    f.conn.update();
+    TEST_ASSERT_TRUE(f.conn.update());
+    TEST_ASSERT_EQUAL(2, f.conn.connects);
+}
+
+void test_held_link_keeps_tcp() {
+    Fixture f;
+
+    f.until_connect_sent();
+    TEST_ASSERT_EQUAL(1, f.wifi.connects);
+
+    // what PubSubClient 2.7 does inside connect()
+    f.link.hold(CONNACK_OK);
+    TEST_ASSERT_EQUAL(1, f.link.connect(IPAddress(), 1883));
+    TEST_ASSERT_EQUAL(1, f.link.connect("broker", 1883));
+    f.link.release();
+
+    TEST_ASSERT_EQUAL(1, f.wifi.connects);
+    TEST_ASSERT_TRUE(f.wifi.open);
+}
+
+} // namespace
+
+void setUp() {
+    WiFi = WiFiClass();
+}
+
+void tearDown() {}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_connects_in_steps);
+    RUN_TEST(test_login_with_user);
+    RUN_TEST(test_connack_timeout_backs_off);
+    RUN_TEST(test_refused);
+    RUN_TEST(test_tcp_and_dns_failures);
+    RUN_TEST(test_no_wifi_no_attempt);
+    RUN_TEST(test_lost_connection_reconnects);
+    RUN_TEST(test_held_link_keeps_tcp);
+    return UNITY_END();
+}
@@ -0,0 +1,238 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+// Priority classes of the outgoing packet queue
+
+#include <vector>
+
+#include <unity.h>
+
+#include "counters.h"
+#include "ntptime.h"
+#include "packetqueue.h"
+
+using namespace hr20;
+
+namespace {
+
+using Item = PacketQ::Item;
+
+const uint8_t ADDR = 5;
+
+struct Fixture {
+    Fixture() : crypto(tm), q(crypto, PACKET_DISCARD_AGE) {}
+
+    /// queues a command the way Protocol::send_* does
+    bool queue(uint8_t addr, uint8_t op, uint8_t bytes, uint8_t prio,
+               time_t t = 100)
+    {
+        auto *p = q.want_to_send_for(addr, bytes, t, prio);
+        if (!p) return false;
+        if (!bytes) return true; // an ack
+
+        p->push(op);
+        for (uint8_t i = 1; i < bytes; ++i) p->push(i);
+        return true;
+    }
+
+    /// all timer slots of the week written, as after a schedule change
+    void timer_sync(uint8_t addr) {
+        for (uint8_t n = 0; n < 8 * TIMER_SLOTS_PER_DAY; ++n)
+            queue(addr, 'W', 4, PacketQ::PRIO_TIMER);
+    }
+
+    /// sends the packets queued for addr, their classes go to sent
+    void drain(uint8_t addr) {
+        sent.clear();
+        while (Item *it = q.first_for(addr)) {
+            sent.push_back(it->prio);
+            TEST_ASSERT_TRUE(q.prepare_to_send_to(addr));
+            TEST_ASSERT_TRUE(q.sending == it);
+            while (q.pop()) {}
+        }
+    }
+
+    ntptime::NTPTime tm;
+    crypto::Crypto crypto;
+    PacketQ q;
+    std::vector<uint8_t> sent;
+};
+
+/// size of the command op starts, see Protocol::command_size
+uint8_t command_size(uint8_t op) {
+    switch (op) {
+    case 'W': return 4;
+    case 'G':
+    case 'S': return 3;
+    default:  return 2;
+    }
+}
+
+bool interactive(uint8_t op) {
+    return op == 'A' || op == 'M' || op == 'L';
+}
+
+void test_setpoint_goes_out_first() {
+    Fixture f;
+    f.timer_sync(ADDR);
+    uint8_t timer_packets = f.q.size();
+    TEST_ASSERT_TRUE(timer_packets > 1);
+
+    TEST_ASSERT_TRUE(f.queue(ADDR, 'A', 2, PacketQ::PRIO_SETPOINT, 101));
+
+    // in a packet of its own, not behind the timers
+    Item *first = f.q.first_for(ADDR);
+    TEST_ASSERT_EQUAL(PacketQ::PRIO_SETPOINT, first->prio);
+    TEST_ASSERT_EQUAL(2, first->packet.size());
+    TEST_ASSERT_EQUAL('A', first->packet[0]);
+
+    f.drain(ADDR);
+    TEST_ASSERT_EQUAL(timer_packets + 1, f.sent.size());
+    TEST_ASSERT_EQUAL(PacketQ::PRIO_SETPOINT, f.sent[0]);
+    for (size_t i = 1; i < f.sent.size(); ++i)
+        TEST_ASSERT_EQUAL(PacketQ::PRIO_TIMER, f.sent[i]);
+    TEST_ASSERT_EQUAL(0, f.q.size());
+}
+
+void test_interactive_never_behind_bulk() {
+    Fixture f;
+
+    // interleaved, as the mqtt commands come in while the sync is queued
+    for (uint8_t n = 0; n < 24; ++n) {
+        f.queue(ADDR, 'W', 4, PacketQ::PRIO_TIMER);
+        if (n % 3 == 0) f.queue(ADDR, 'G', 3, PacketQ::PRIO_EEPROM);
+        if (n % 5 == 0) f.queue(ADDR, 'M', 2, PacketQ::PRIO_MODE);
+        if (n % 7 == 0) f.queue(ADDR, 'A', 2, PacketQ::PRIO_SETPOINT);
+    }
+
+    for (auto &it : f.q.que) {
+        if (it.addr != ADDR) continue;
+
+        // a packet goes out in one frame. Bulk may fill up the space left
+        // in an interactive one, but a packet that started with bulk work
+        // never takes interactive commands
+        TEST_ASSERT_TRUE(interactive(it.packet[0])
+                         || it.prio > PacketQ::PRIO_INTERACTIVE);
+
+        uint8_t best = PacketQ::PRIO_ACK;
+        for (uint8_t i = 0; i < it.packet.size();
+             i += command_size(it.packet[i]))
+        {
+            uint8_t op = it.packet[i];
+            uint8_t prio = op == 'A' ? PacketQ::PRIO_SETPOINT
+                         : op == 'M' ? PacketQ::PRIO_MODE
+                         : op == 'W' ? PacketQ::PRIO_TIMER
+                         : PacketQ::PRIO_EEPROM;
+            if (prio < best) best = prio;
+        }
+
+        // the class is the one of its most urgent command
+        TEST_ASSERT_EQUAL(best, it.prio);
+    }
+
+    // everything interactive goes out before any bulk-only packet
+    f.drain(ADDR);
+    bool bulk = false;
+    for (auto prio : f.sent) {
+        if (prio <= PacketQ::PRIO_INTERACTIVE) TEST_ASSERT_FALSE(bulk);
+        bulk = bulk || prio > PacketQ::PRIO_INTERACTIVE;
+    }
+}
+
+void test_first_for_order() {
+    Fixture f;
+    f.queue(ADDR, 'G', 3, PacketQ::PRIO_EEPROM);
+    f.queue(ADDR, 'M', 2, PacketQ::PRIO_MODE);
+    f.queue(ADDR + 1, 'A', 2, PacketQ::PRIO_SETPOINT);
+    f.timer_sync(ADDR);
+
+    // best class first, other clients' packets do not count
+    Item *it = f.q.first_for(ADDR);
+    TEST_ASSERT_EQUAL(ADDR, it->addr);
+    TEST_ASSERT_EQUAL(PacketQ::PRIO_MODE, it->prio);
+
+    // within a class, the slot order prepare_to_send_to always used
+    f.drain(ADDR + 1);
+    for (unsigned i = 0; i < PACKET_QUEUE_LEN; ++i) {
+        Item *first = f.q.first_for(ADDR);
+        if (!first) break;
+
+        for (auto &other : f.q.que) {
+            if (other.addr != ADDR) continue;
+            TEST_ASSERT_TRUE(first->prio <= other.prio);
+            if (other.prio == first->prio)
+                TEST_ASSERT_TRUE(first <= &other);
+        }
+
+        f.q.prepare_to_send_to(ADDR);
+        while (f.q.pop()) {}
+    }
+
+    TEST_ASSERT_NULL(f.q.first_for(ADDR));
+    TEST_ASSERT_NULL(f.q.first_for(PacketQ::SYNC_ADDR));
+}
+
+void test_evicts_oldest_of_worst_class() {
+    Fixture f;
+    uint32_t evicted = counters.get(EventType::ERROR, QUEUE_EVICTED);
+
+    // a client per slot, so nothing gets appended. 10 eeprom packets with
+    // client 7 the oldest, 10 older timer packets, 10 interactive, an ack
+    // and a sync
+    for (uint8_t a = 1; a <= 10; ++a)
+        f.queue(a, 'G', 3, PacketQ::PRIO_EEPROM, a == 7 ? 20 : 30 + a);
+    for (uint8_t a = 11; a <= 20; ++a)
+        f.queue(a, 'W', 4, PacketQ::PRIO_TIMER, 10);
+    for (uint8_t a = 21; a <= 30; ++a)
+        f.queue(a, 'M', 2, PacketQ::PRIO_MODE, 50);
+    f.queue(31, 0, 0, PacketQ::PRIO_ACK, 60);
+    f.queue(PacketQ::SYNC_ADDR, 0, 8, PacketQ::PRIO_SYNC, 60);
+    TEST_ASSERT_EQUAL(PACKET_QUEUE_LEN, f.q.size());
+
+    // the ack is worth the least
+    TEST_ASSERT_TRUE(f.queue(3, 'A', 2, PacketQ::PRIO_SETPOINT, 70));
+    TEST_ASSERT_EQUAL(0, f.q.get_update_count(31));
+
+    // then the oldest bulk packet of the worst class left
+    TEST_ASSERT_TRUE(f.queue(4, 'A', 2, PacketQ::PRIO_SETPOINT, 70));
+    TEST_ASSERT_EQUAL(0, f.q.get_update_count(7));
+    for (uint8_t a = 11; a <= 20; ++a)
+        TEST_ASSERT_EQUAL(1, f.q.get_update_count(a));
+
+    TEST_ASSERT_EQUAL(evicted + 2,
+                      counters.get(EventType::ERROR, QUEUE_EVICTED));
+
+    // bulk only makes room for more urgent work
+    TEST_ASSERT_FALSE(f.queue(32, 'S', 3, PacketQ::PRIO_EEPROM, 70));
+    TEST_ASSERT_EQUAL(PACKET_QUEUE_LEN, f.q.size());
+}
+
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_setpoint_goes_out_first);
+    RUN_TEST(test_interactive_never_behind_bulk);
+    RUN_TEST(test_first_for_order);
+    RUN_TEST(test_evicts_oldest_of_worst_class);
+    return UNITY_END();
+}
@@ -0,0 +1,206 @@
+/*
+ * HR20 ESP Master
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+// Publish retry queue of MQTTPublisher against a stand-in broker, see
+// tools/shim
+
+#include <unity.h>
+
+#include "mqtt.h"
+
+using namespace hr20;
+using namespace hr20::mqtt;
+
+namespace {
+
+const uint8_t CONNACK_OK[] = {0x20, 0x02, 0x00, 0x00};
+
+// LAST_SEEN, LINK_QUALITY and MODE get published for any client, the other
+// frequent topics only once the client reported them
+const Topic ALWAYS[] = {LAST_SEEN, LINK_QUALITY, MODE};
+const uint8_t ALWAYS_COUNT = sizeof(ALWAYS) / sizeof(ALWAYS[0]);
+
+struct Fixture {
+    Fixture() : master(config, tm), pub(config, master) {
+        strcpy(config.mqtt_client_id, "hr20");
+        strcpy(config.mqtt_server, "10.0.0.1");
+        WiFi.wl_status = WL_CONNECTED;
+        at(1000);
+        pub.begin();
+    }
+
+    void at(unsigned long ms) { shim_set_time(ms / 1000, ms); }
+
+    /// runs update() until the broker accepted the connection
+    void connect() {
+        pub.wifiClient.sent.clear();
+        for (int i = 0; i < 10 && pub.wifiClient.sent.empty(); ++i)
+            pub.update(now());
+
+        pub.wifiClient.incoming.append(
+            reinterpret_cast<const char *>(CONNACK_OK), 4);
+        for (int i = 0; i < 10 && !pub.conn.connected(); ++i)
+            pub.update(now());
+    }
+
+    /// a client with all frequent topics to publish
+    void changed(uint8_t addr, uint32_t mask = CHANGE_FREQUENT) {
+        master.model.prepare_client(addr);
+        pub.states[addr] |= mask;
+    }
+
+    /// update() calls, the clock stands still
+    void run(int calls) {
+        for (int i = 0; i < calls; ++i) pub.update(now());
+    }
+
+    bool published(const Path &p) {
+        PathBuffer pb;
+        std::string topic = p.compose(pb).c_str();
+        auto &all = pub.client.published;
+        return std::find(all.begin(), all.end(), topic) != all.end();
+    }
+
+    Config config;
+    ntptime::NTPTime tm;
+    HR20Master master;
+    MQTTPublisher pub;
+};
+
+void test_failed_publish_is_queued() {
+    Fixture f;
+    f.connect();
+    f.changed(5);
+
+    f.pub.client.rejecting = true;
+    f.run(100);
+
+    TEST_ASSERT_EQUAL(ALWAYS_COUNT, f.pub.retries.size());
+    for (auto t : ALWAYS)
+        TEST_ASSERT_EQUAL(1, f.pub.retries.count_of(t));
+
+    // the pass is over, the change is in the queue now
+    TEST_ASSERT_EQUAL(0, f.pub.states[5] & CHANGE_FREQUENT);
+    TEST_ASSERT_EQUAL(0, f.pub.retries.dropped);
+}
+
+void test_retried_on_reconnect() {
+    Fixture f;
+    const unsigned long WAIT = MQTT_RECONNECT_TIME * 1000UL;
+
+    f.connect();
+    f.changed(5);
+    f.pub.client.rejecting = true;
+    f.run(100);
+    TEST_ASSERT_EQUAL(ALWAYS_COUNT, f.pub.retries.size());
+
+    // the broker went away. nothing gets retried while it is gone
+    f.pub.client.rejecting = false;
+    f.pub.wifiClient.open = false;
+    f.at(5000);
+    f.run(10);
+    TEST_ASSERT_EQUAL(ALWAYS_COUNT, f.pub.retries.size());
+    TEST_ASSERT_EQUAL(0, f.pub.retries.retried);
+
+    // one retry per update call once it is back
+    f.at(5000 + WAIT + WAIT / 4);
+    f.connect();
+    f.run(ALWAYS_COUNT);
+
+    TEST_ASSERT_EQUAL(0, f.pub.retries.size());
+    TEST_ASSERT_EQUAL(ALWAYS_COUNT, f.pub.retries.retried);
+    for (auto t : ALWAYS)
+        TEST_ASSERT_TRUE(f.published(Path{5, t}));
+}
+
+void test_same_path_queued_once() {
+    Fixture f;
+    f.connect();
+    f.pub.client.rejecting = true;
+
+    // two passes over the same client, the retry is not due in between
+    f.changed(5);
+    f.run(100);
+    f.changed(5);
+    f.run(100);
+
+    TEST_ASSERT_EQUAL(ALWAYS_COUNT, f.pub.retries.size());
+    TEST_ASSERT_TRUE(f.pub.retries.push(Path{5, MODE}, now()));
+    TEST_ASSERT_EQUAL(ALWAYS_COUNT, f.pub.retries.size());
+    TEST_ASSERT_EQUAL(0, f.pub.retries.dropped);
+}
+
+void test_overflow_drops() {
+    Fixture f;
+    f.connect();
+    f.pub.client.rejecting = true;
+
+    const uint8_t clients = MQTT_PUBLISH_QUEUE_LEN / ALWAYS_COUNT + 1;
+    for (uint8_t a = 1; a <= clients; ++a) f.changed(a);
+    f.run(300);
+
+    TEST_ASSERT_EQUAL(MQTT_PUBLISH_QUEUE_LEN, f.pub.retries.size());
+    TEST_ASSERT_EQUAL(clients * ALWAYS_COUNT - MQTT_PUBLISH_QUEUE_LEN,
+                      f.pub.retries.dropped);
+
+    // a full queue takes no more, not even a new path
+    TEST_ASSERT_FALSE(f.pub.retries.push(Path{clients + 1, MODE}, now()));
+}
+
+void test_eeprom_slot_cap() {
+    Fixture f;
+    f.connect();
+
+    auto *hr = f.master.model.prepare_client(5);
+    for (unsigned a = 0; a < EEPROM_SIZE; ++a) hr->eeprom[a].set_remote(a);
+
+    f.pub.client.rejecting = true;
+    f.changed(5, CHANGE_EEPROM);
+    f.run(100);
+
+    // the dump stopped at the cap and gets picked up again later
+    TEST_ASSERT_EQUAL(MQTT_PUBLISH_EEPROM_SLOTS,
+                      f.pub.retries.count_of(EEPROM));
+    TEST_ASSERT_TRUE(f.pub.states[5] & CHANGE_EEPROM);
+
+    // the rest of the queue is left for the other topics
+    f.changed(6);
+    f.run(100);
+    TEST_ASSERT_EQUAL(MQTT_PUBLISH_EEPROM_SLOTS,
+                      f.pub.retries.count_of(EEPROM));
+    TEST_ASSERT_EQUAL(1, f.pub.retries.count_of(MODE));
+    TEST_ASSERT_EQUAL(0, f.pub.retries.dropped);
+}
+
+} // namespace
+
+void setUp() {
+    WiFi = WiFiClass();
+}
+
+void tearDown() {}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_failed_publish_is_queued);
+    RUN_TEST(test_retried_on_reconnect);
+    RUN_TEST(test_same_path_queued_once);
+    RUN_TEST(test_overflow_drops);
+    RUN_TEST(test_eeprom_slot_cap);
+    return UNITY_END();
+}
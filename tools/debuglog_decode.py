@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# HR20 ESP Master
+#
+# Decodes the binary debug log (build with -DDEBUG_BINARY) into text.
+# Format strings are looked up in the firmware ELF by their address.
+#
+# Usage:
+#   pio device monitor --raw | tools/debuglog_decode.py .pio/build/esp12e/firmware.elf
+#   tools/debuglog_decode.py firmware.elf capture.bin
+#
+# Bytes outside of the frames (boot messages, crash dumps) are passed through.
+
+import re
+import struct
+import sys
+
+FRAME_START = 0xDB
+FLAG_NEWLINE = 1
+
+TAG_INT = ord('i')
+TAG_STR = ord('s')
+TAG_HEX = ord('h')
+
+SPEC_RE = re.compile(r'%[-+ #0-9.]*[lhz]*([a-zA-Z%])')
+
+
+class Elf:
+    """Allocated sections of a 32 bit little endian ELF file"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1:
+            raise ValueError('%s is not a 32 bit ELF file' % path)
+
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x2E)
+
+        self.sections = []
+        for i in range(shnum):
+            (name, typ, flags, addr, offset, size,
+             link, info, align, entsize) = struct.unpack_from(
+                 '<10I', self.data, shoff + i * shentsize)
+            # SHT_PROGBITS with SHF_ALLOC
+            if typ == 1 and flags & 2 and addr:
+                self.sections.append((addr, offset, size))
+
+    def string(self, addr):
+        for start, offset, size in self.sections:
+            if start <= addr < start + size:
+                pos = offset + addr - start
+                end = self.data.index(b'\0', pos)
+                return self.data[pos:end].decode('latin-1')
+        return None
+
+
+def format_record(elf, rec):
+    flags = rec[0]
+    addr, = struct.unpack_from('<I', rec, 1)
+    fmt = elf.string(addr)
+    if fmt is None:
+        return '<unknown format 0x%08x>\n' % addr
+
+    args = []
+    pos = 5
+    while pos < len(rec):
+        tag = rec[pos]
+        pos += 1
+        if tag == TAG_INT:
+            args.append(struct.unpack_from('<I', rec, pos)[0])
+            pos += 4
+        elif tag in (TAG_STR, TAG_HEX):
+            size = rec[pos]
+            data = rec[pos + 1:pos + 1 + size]
+            pos += 1 + size
+            if tag == TAG_STR:
+                args.append(data.decode('latin-1'))
+            else:
+                args.append(' '.join('%02x' % b for b in data) + ' ')
+        else:
+            break
+
+    def conv(m):
+        spec, c = m.group(0), m.group(1)
+        if c == '%':
+            return '%'
+        if not args:
+            return '?'
+        val = args.pop(0)
+        spec = re.sub(r'[lhz]', '', spec)
+        if isinstance(val, str):
+            return spec % val if c == 's' else val
+        if c in 'di':
+            return spec % (val - (1 << 32) if val & 0x80000000 else val)
+        if c == 'p':
+            return '0x%08x' % val
+        if c == 's':
+            return '?'
+        if c == 'u':
+            spec = spec[:-1] + 'd'
+        return spec % val
+
+    text = SPEC_RE.sub(conv, fmt)
+    if flags & FLAG_NEWLINE:
+        text += '\n'
+    return text
+
+
+def decode(elf, stream, out):
+    buf = bytearray()
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            break
+        buf += chunk
+
+        while buf:
+            if buf[0] != FRAME_START:
+                # plain text up to the next frame
+                end = buf.find(bytes([FRAME_START]))
+                end = len(buf) if end < 0 else end
+                out.write(buf[:end].decode('latin-1'))
+                del buf[:end]
+                continue
+
+            if len(buf) < 2 or len(buf) < 2 + buf[1]:
+                break
+
+            rec = bytes(buf[2:2 + buf[1]])
+            del buf[:2 + len(rec)]
+            out.write(format_record(elf, rec))
+
+        out.flush()
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.stderr.write('usage: %s firmware.elf [capture]\n' % sys.argv[0])
+        return 1
+
+    elf = Elf(sys.argv[1])
+
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], 'rb') as f:
+            decode(elf, f, sys.stdout)
+    else:
+        decode(elf, sys.stdin.buffer, sys.stdout)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,12 @@
+# HR20 ESP Master
+#
+# PlatformIO extra script for the env:fuzz_* environments. libFuzzer comes
+# with clang, so the targets in tools/fuzz are built and linked with it,
+# instrumented for libFuzzer and the address and undefined sanitizers.
+
+Import("env")
+
+SANITIZE = ["-fsanitize=fuzzer,address,undefined"]
+
+env.Replace(CC="clang", CXX="clang++", LINK="clang++")
+env.Append(CCFLAGS=SANITIZE, LINKFLAGS=SANITIZE)
@@ -0,0 +1,62 @@
+/*
+ * HR20 ESP Master - fuzz targets
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+/** libFuzzer target for mqtt::Path::parse, see env:fuzz_path.
+ *
+ * The input is the topic. A topic that parses has to compose back into one
+ * that parses the same.
+ */
+
+#include <string>
+
+#include "mqttpath.h"
+
+using namespace hr20;
+using namespace hr20::mqtt;
+
+namespace {
+
+bool same(const Path &a, const Path &b) {
+    return a.addr == b.addr && a.topic == b.topic && a.set_mode == b.set_mode
+           && a.as_uint() == b.as_uint() && a.day == b.day
+           && a.slot == b.slot && a.eeprom_address == b.eeprom_address
+           && (!a.set_mode || a.eeprom_access == b.eeprom_access);
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // topics are zero terminated by PubSubClient
+    std::string topic(reinterpret_cast<const char *>(data), size);
+
+    Path p = Path::parse(topic.c_str());
+    if (!p.valid()) return 0;
+
+    BufferHolder<128> buf;
+    Str composed = p.compose(buf);
+    std::string again(composed.c_str(), composed.length());
+
+    Path q = Path::parse(again.c_str());
+    if (!same(p, q)) {
+        fprintf(stderr, "'%s' composes to '%s', parsed differently\n",
+                topic.c_str(), again.c_str());
+        abort();
+    }
+
+    return 0;
+}
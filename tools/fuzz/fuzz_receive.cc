@@ -0,0 +1,120 @@
+/*
+ * HR20 ESP Master - fuzz targets
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+/** libFuzzer target for Protocol::receive, see env:fuzz_receive.
+ *
+ * The first input byte selects what the rest is:
+ *   0 - a frame as the radio received it, length byte first. Mostly stops
+ *       at the CMAC check, that is the path random noise takes
+ *   1 - client address and plaintext payload. Encrypted and signed the way
+ *       a client does it, so it gets through to process_packet
+ *   2 - sync payload, signed as a sync packet
+ * Every input runs against a fresh model, with the clock at a fixed time.
+ */
+
+#include <memory>
+
+#include "protocol.h"
+
+using namespace hr20;
+
+namespace {
+
+enum Mode : uint8_t { RAW = 0, SIGNED, SYNC, MODES };
+
+// 2019-03-01 12:00:00, not on a sync second
+constexpr const time_t NOW = 1551441600;
+
+struct Target {
+    Target()
+        : crypto(time), sndQ(crypto, PACKET_DISCARD_AGE),
+          proto(model, time, crypto, sndQ)
+    {
+        const uint8_t pass[8] = {0x01, 0x23, 0x45, 0x67,
+                                 0x89, 0x01, 0x23, 0x45};
+        crypto.begin(pass);
+        crypto.update(NOW);
+    }
+
+    // frames a client packet around payload, see Protocol::receive
+    void sign(RcvPacket &pkt, const uint8_t *data, uint8_t size, bool sync) {
+        RcvPacket payload;
+        for (uint8_t i = 0; i < size; ++i) payload.push(data[i]);
+
+        ShortQ<6> mac;
+        if (sync) {
+            pkt.push((1 + size + crypto::CMAC::CMAC_SIZE) | 0x80);
+            crypto.cmac_fill_sync(payload.data(), size, mac);
+        } else {
+            // data[0] is the address, only the rest is encrypted
+            uint8_t length = 1 + size + crypto::CMAC::CMAC_SIZE;
+            uint8_t cnt    = crypto.rtc.pkt_cnt;
+            if (size > 1) crypto.encrypt_decrypt(payload.data() + 1, size - 1);
+            // the cmac is made with the count after the encryption
+            crypto.rtc.pkt_cnt = cnt + (length + 1) / 8;
+            crypto.cmac_fill_addr(payload.data() + 1, size - 1,
+                                  payload[0], mac);
+            crypto.rtc.pkt_cnt = cnt;
+            pkt.push(length);
+        }
+
+        for (uint8_t i = 0; i < size; ++i) pkt.push(payload[i]);
+        while (!mac.empty()) pkt.push(mac.pop());
+    }
+
+    ntptime::NTPTime time;
+    crypto::Crypto crypto;
+    Model model;
+    PacketQ sndQ;
+    Protocol proto;
+};
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 1 || data[0] >= MODES) return 0;
+
+    Mode mode = static_cast<Mode>(data[0]);
+    ++data;
+    --size;
+
+    shim_set_time(NOW, NOW * 1000ULL);
+
+    std::unique_ptr<Target> t(new Target());
+    RcvPacket pkt;
+
+    if (mode == RAW) {
+        if (size > sizeof(pkt.buf)) return 0;
+        for (size_t i = 0; i < size; ++i) pkt.push(data[i]);
+    } else {
+        // room for the length byte and the cmac
+        if (size < 1 || size > sizeof(pkt.buf) - 1 - crypto::CMAC::CMAC_SIZE)
+            return 0;
+        t->sign(pkt, data, size, mode == SYNC);
+    }
+
+    RxMeta meta;
+    meta.samples = meta.rssi = meta.dqd = pkt.size();
+
+    t->proto.receive(pkt, meta);
+
+    // the reply, as the radio would take it
+    while (t->sndQ.pop()) {}
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * HR20 ESP Master - fuzz targets
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+/** libFuzzer target for Str::toInt and Str::toFloat, see env:fuzz_str.
+ *
+ * The input is the string, as a payload is - not zero terminated. Integers
+ * that parse are checked against strtol.
+ */
+
+#include <cmath>
+#include <memory>
+#include <string>
+
+#include "str.h"
+
+using namespace hr20;
+
+namespace {
+
+// what toInt accepts - an optional minus and 1 to 9 digits
+bool plain_int(const std::string &s) {
+    size_t i = (!s.empty() && s[0] == '-') ? 1 : 0;
+    size_t digits = s.size() - i;
+    if (digits < 1 || digits > 9) return false;
+    for (; i < s.size(); ++i)
+        if (s[i] < '0' || s[i] > '9') return false;
+    return true;
+}
+
+void check(bool cond, const char *what, const std::string &s) {
+    if (cond) return;
+    fprintf(stderr, "%s: '%s'\n", what, s.c_str());
+    abort();
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // a copy of the exact size, so reads past the end get caught
+    std::unique_ptr<char[]> copy(new char[size]);
+    if (size) memcpy(copy.get(), data, size);
+    Str s{copy.get(), static_cast<unsigned>(size)};
+
+    std::string str(copy.get(), size);
+    long expected = plain_int(str) ? strtol(str.c_str(), nullptr, 10) : 0;
+
+    int i;
+    bool ok = s.toInt(i);
+    check(ok == plain_int(str), "toInt accepts", str);
+    check(!ok || i == expected, "toInt value", str);
+
+    uint8_t u8;
+    ok = s.toInt(u8);
+    check(ok == (plain_int(str) && expected >= 0 && expected <= 0xFF),
+          "toInt(uint8_t) accepts", str);
+    check(!ok || u8 == expected, "toInt(uint8_t) value", str);
+
+    uint16_t u16;
+    ok = s.toInt(u16);
+    check(ok == (plain_int(str) && expected >= 0 && expected <= 0xFFFF),
+          "toInt(uint16_t) accepts", str);
+    check(!ok || u16 == expected, "toInt(uint16_t) value", str);
+
+    float f;
+    if (s.toFloat(f)) check(std::isfinite(f), "toFloat value", str);
+
+    return 0;
+}
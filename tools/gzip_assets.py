@@ -0,0 +1,43 @@
+# HR20 ESP Master
+#
+# PlatformIO pre script. Compresses the web assets from web/ into data/,
+# which is the directory the SPIFFS image (pio run -t uploadfs) is built from.
+# The web server serves the .gz files with Content-Encoding: gzip.
+
+import gzip
+import os
+
+Import("env")
+
+SRC_DIR = os.path.join(env.subst("$PROJECT_DIR"), "web")
+DST_DIR = env.subst("$PROJECT_DATA_DIR")
+
+
+def gzip_assets():
+    if not os.path.isdir(DST_DIR):
+        os.makedirs(DST_DIR)
+
+    for name in sorted(os.listdir(SRC_DIR)):
+        src = os.path.join(SRC_DIR, name)
+        dst = os.path.join(DST_DIR, name + ".gz")
+
+        if not os.path.isfile(src):
+            continue
+
+        if os.path.exists(dst) and os.path.getmtime(dst) >= os.path.getmtime(src):
+            continue
+
+        with open(src, "rb") as f:
+            data = f.read()
+
+        # mtime=0 keeps the output (and so the ETag) stable between builds
+        with open(dst, "wb") as f:
+            with gzip.GzipFile(filename=name, mode="wb", fileobj=f,
+                               compresslevel=9, mtime=0) as gz:
+                gz.write(data)
+
+        print("Compressed %s: %d -> %d bytes"
+              % (name, len(data), os.path.getsize(dst)))
+
+
+gzip_assets()
@@ -0,0 +1,412 @@
+/*
+ * HR20 ESP Master - radio capture replay
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+/** Feeds a radio capture (the pcap from /capture) through Protocol::receive.
+ *
+ * The crypto rtc is rebuilt from the frame timestamps, the packet counter
+ * follows the captured frames - received ones as Protocol::receive counts
+ * them, sent ones as the master counted them when it encrypted them. The
+ * replies the replay itself prepares are decrypted for the report only.
+ *
+ * Prints the model changes, the replies and the queued packets per received
+ * frame, and the errors reported meanwhile. With -n N, the capture is
+ * replayed N more times silently and the time spent in Protocol::receive is
+ * reported - a benchmark of the decode path on real traffic. With -c DIR,
+ * the received frames are written to DIR as seeds for tools/fuzz.
+ */
+
+#include <chrono>
+#include <vector>
+
+#include "capture.h"
+#include "counters.h"
+#include "debug.h"
+#include "eventlog.h"
+#include "protocol.h"
+
+using namespace hr20;
+
+namespace {
+
+struct Frame {
+    time_t   secs;
+    uint32_t usecs;
+    uint8_t  flags;
+    uint8_t  addr;
+    uint8_t  rssi;
+    std::vector<uint8_t> data;
+};
+
+uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+bool load(const char *path, std::vector<Frame> &frames) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    uint8_t hdr[24];
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+        || get_u32(hdr) != 0xA1B2C3D4UL
+        || get_u32(hdr + 20) != Capture::LINKTYPE_USER0)
+    {
+        fprintf(stderr, "%s: not a capture from /capture\n", path);
+        fclose(f);
+        return false;
+    }
+
+    uint8_t rec[16];
+    while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+        uint32_t len = get_u32(rec + 8);
+        std::vector<uint8_t> data(len);
+        if (fread(data.data(), 1, len, f) != len) break;
+        // pseudo header and at least the length byte
+        if (len < 4) continue;
+
+        Frame fr;
+        fr.secs  = get_u32(rec);
+        fr.usecs = get_u32(rec + 4);
+        fr.flags = data[0];
+        fr.addr  = data[1];
+        fr.rssi  = data[2];
+        fr.data.assign(data.begin() + 3, data.end());
+        frames.push_back(fr);
+    }
+
+    fclose(f);
+    return true;
+}
+
+void hex(const char *prefix, const uint8_t *p, size_t size) {
+    printf("%s", prefix);
+    for (size_t i = 0; i < size; ++i) printf(" %02x", p[i]);
+    printf("\n");
+}
+
+// the client values a packet can change
+struct Snapshot {
+    Snapshot() = default;
+
+    explicit Snapshot(HR20 &hr) {
+        int i = 0;
+        v[i++] = hr.temp_wanted.get_remote();
+        v[i++] = hr.auto_mode.get_remote();
+        v[i++] = hr.menu_locked.get_remote();
+        v[i++] = hr.mode_window.get_remote();
+        v[i++] = hr.temp_avg.get_remote();
+        v[i++] = hr.bat_avg.get_remote();
+        v[i++] = hr.cur_valve_wtd.get_remote();
+        v[i++] = hr.ctl_err.get_remote();
+        v[i++] = hr.synced;
+
+        v[i] = 0;
+        for (auto &day : hr.timers)
+            for (auto &slot : day) v[i] += slot.remote_valid() ? 1 : 0;
+        ++i;
+
+        v[i] = 0;
+        for (auto &ee : hr.eeprom) v[i] += ee.remote_valid() ? 1 : 0;
+    }
+
+    static constexpr const int COUNT = 11;
+    static const char *const NAMES[COUNT];
+
+    long v[COUNT] = {};
+};
+
+const char *const Snapshot::NAMES[Snapshot::COUNT] = {
+    "temp_wanted", "auto", "lock", "window", "temp_avg", "bat_avg",
+    "valve_wtd", "ctl_err", "synced", "timers_known", "eeprom_known"};
+
+struct Replay {
+    Replay(const uint8_t *pass, long tz, bool report)
+        : crypto(time), sndQ(crypto, PACKET_DISCARD_AGE),
+          proto(model, time, crypto, sndQ), tz(tz), report(report)
+    {
+        crypto.begin(pass);
+        proto.set_callback([this](uint8_t, ChangeCategory cat) {
+            changes |= cat;
+        });
+    }
+
+    void run(const std::vector<Frame> &frames) {
+        for (auto &fr : frames) frame(fr);
+    }
+
+    void frame(const Frame &fr) {
+        // the clients' rtc runs on local time
+        time_t local = fr.secs + tz;
+        shim_set_time(local, fr.secs * 1000ULL + fr.usecs / 1000);
+        eventLog.update(local);
+
+        if (crypto.update(local)) proto.update(local, true, false, 0);
+
+        const uint8_t *data = fr.data.data();
+        uint8_t size        = std::min<size_t>(fr.data.size(), 80);
+        bool isSync         = data[0] & 0x80;
+
+        if (fr.flags & Capture::FLAG_TX) {
+            if (report) {
+                printf("%ld.%03u TX %s", (long)fr.secs, fr.usecs / 1000,
+                       isSync ? "sync" : "reply");
+                hex("", data, size);
+            }
+
+            // the master encrypted and signed it
+            if (!isSync)
+                crypto.rtc.pkt_cnt += Protocol::count_after_receive(data[0]);
+            return;
+        }
+
+        RcvPacket pkt;
+        for (uint8_t i = 0; i < size; ++i) pkt.push(data[i]);
+
+        RxMeta meta;
+        meta.samples = size;
+        meta.rssi    = fr.rssi * size / 100;
+        meta.dqd     = size;
+
+        uint8_t cnt    = crypto.rtc.pkt_cnt;
+        uint32_t error = eventLog.last_seq();
+        HR20 *hr       = size > 1 ? model[data[1]] : nullptr;
+        bool known     = hr != nullptr;
+        // a new client has no values to compare to yet
+        Snapshot before = known ? Snapshot(*hr) : Snapshot();
+        changes = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok    = proto.receive(pkt, meta);
+        elapsed += std::chrono::steady_clock::now() - start;
+        ++received;
+
+        // the received frame's share of the packet counter
+        uint8_t after_rx = cnt + (ok && !isSync
+                                      ? Protocol::count_after_receive(data[0])
+                                      : 0);
+
+        if (corpus) seed(data, size, ok, cnt);
+
+        if (report) {
+            printf("%ld.%03u RX from %u rssi %u%%%s", (long)fr.secs,
+                   fr.usecs / 1000, fr.addr, fr.rssi, ok ? "" : " FAILED");
+            hex("", data, size);
+
+            errors(error);
+
+            if (size > 1 && (hr = model[data[1]])) {
+                Snapshot now(*hr);
+                if (!known) printf("  new client\n");
+                for (int i = 0; i < Snapshot::COUNT; ++i) {
+                    if (!known)
+                        printf("  %s %ld\n", Snapshot::NAMES[i], now.v[i]);
+                    else if (now.v[i] != before.v[i])
+                        printf("  %s %ld -> %ld\n", Snapshot::NAMES[i],
+                               before.v[i], now.v[i]);
+                }
+                if (changes) printf("  changes 0x%x\n", changes);
+            }
+
+            reply(after_rx);
+            queued(size > 1 ? data[1] : 0xFF);
+        }
+
+        // our reply is sent by the pop loop only, the captured one counts
+        while (sndQ.pop()) {}
+        crypto.rtc.pkt_cnt = after_rx;
+    }
+
+    // errors reported since event sq
+    void errors(uint32_t sq) {
+        EventLog::Reader r(eventLog, sq + 1);
+        Event ev;
+        while (r.next(ev)) {
+            if (ev.type != EventType::ERROR) continue;
+            printf("  error %s %u\n",
+                   err_to_str(static_cast<ErrorCode>(ev.code)), ev.value);
+        }
+    }
+
+    // the reply prepared for the frame, decrypted again
+    void reply(uint8_t pkt_cnt) {
+        if (!sndQ.sending) return;
+
+        SndPacket copy = sndQ.sending->packet;
+        uint8_t saved  = crypto.rtc.pkt_cnt;
+        crypto.rtc.pkt_cnt = pkt_cnt;
+        crypto.encrypt_decrypt(copy.data(), copy.size());
+        crypto.rtc.pkt_cnt = saved;
+
+        hex("  reply", copy.data(), copy.size());
+    }
+
+    /** writes the frame in the input formats of tools/fuzz/fuzz_receive.cc
+     * - as received, and verified ones decrypted as well, for the target to
+     * sign again. Cnt is the packet counter the frame was received with
+     */
+    void seed(const uint8_t *data, uint8_t size, bool ok, uint8_t cnt) {
+        write_seed(0, data, size);
+
+        uint8_t length = data[0] & 0x7F;
+        if (!ok || length < 6 || length > size) return;
+
+        // address and payload, without the length and the cmac
+        RcvPacket copy;
+        for (uint8_t i = 1; i < length - crypto::CMAC::CMAC_SIZE; ++i)
+            copy.push(data[i]);
+
+        if (data[0] & 0x80) {
+            write_seed(2, copy.data(), copy.size());
+            return;
+        }
+
+        uint8_t saved      = crypto.rtc.pkt_cnt;
+        crypto.rtc.pkt_cnt = cnt;
+        crypto.encrypt_decrypt(copy.data() + 1, copy.size() - 1);
+        crypto.rtc.pkt_cnt = saved;
+
+        write_seed(1, copy.data(), copy.size());
+    }
+
+    void write_seed(uint8_t mode, const uint8_t *data, uint8_t size) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/rx%u_%04u", corpus, mode, seeds++);
+
+        FILE *f = fopen(path, "wb");
+        if (!f) {
+            perror(path);
+            return;
+        }
+
+        fputc(mode, f);
+        fwrite(data, 1, size, f);
+        fclose(f);
+    }
+
+    void queued(uint8_t addr) {
+        for (auto &it : sndQ.que) {
+            if (it.addr != addr) continue;
+            printf("  queued prio %u", it.prio);
+            hex("", it.packet.data(), it.packet.size());
+        }
+    }
+
+    ntptime::NTPTime time;
+    crypto::Crypto crypto;
+    Model model;
+    PacketQ sndQ;
+    Protocol proto;
+
+    long tz;
+    bool report;
+    uint16_t changes = 0;
+
+    // directory the fuzz seeds go to, see seed()
+    const char *corpus = nullptr;
+    unsigned seeds     = 0;
+
+    uint32_t received = 0;
+    std::chrono::steady_clock::duration elapsed{};
+};
+
+int usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-p RFM_PASS] [-z UTC_OFFSET_SECS] [-n REPEAT] [-v] "
+            "[-c DIR] capture.pcap\n"
+            "  -p  RFM password, 16 hex digits as in the configuration\n"
+            "  -z  offset of the local time the clients run on, in seconds\n"
+            "  -n  replay this many more times and report the decode time\n"
+            "  -v  print the debug log too\n"
+            "  -c  write the received frames to DIR as fuzzing seeds\n",
+            name);
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *pass_hex = "0123456789012345";
+    long tz              = 0;
+    long repeat          = 0;
+    bool verbose         = false;
+    const char *corpus   = nullptr;
+    const char *path     = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-p" && i + 1 < argc) pass_hex = argv[++i];
+        else if (arg == "-z" && i + 1 < argc) tz = atol(argv[++i]);
+        else if (arg == "-n" && i + 1 < argc) repeat = atol(argv[++i]);
+        else if (arg == "-v") verbose = true;
+        else if (arg == "-c" && i + 1 < argc) corpus = argv[++i];
+        else if (arg[0] != '-' && !path) path = argv[i];
+        else return usage(argv[0]);
+    }
+
+    if (!path) return usage(argv[0]);
+
+    uint8_t pass[8];
+    for (int j = 0; j < 8; ++j) {
+        int8_t x0 = strlen(pass_hex) == 16 ? hex2int(pass_hex[j * 2]) : -1;
+        int8_t x1 = strlen(pass_hex) == 16 ? hex2int(pass_hex[j * 2 + 1]) : -1;
+        if (x0 < 0 || x1 < 0) {
+            fprintf(stderr, "RFM password has to be 16 hex digits\n");
+            return 2;
+        }
+        pass[j] = x0 << 4 | x1;
+    }
+
+    std::vector<Frame> frames;
+    if (!load(path, frames)) return 1;
+
+    {
+        Replay replay(pass, tz, true);
+        replay.corpus = corpus;
+        for (auto &fr : frames) {
+            replay.frame(fr);
+            if (verbose) debugLog.drain();
+        }
+    }
+
+    printf("errors:");
+    for (uint8_t code = 0; code < Counters::ERROR_CODES; ++code) {
+        uint32_t cnt = counters.get(EventType::ERROR, code);
+        if (cnt) printf(" %s=%u", err_to_str(static_cast<ErrorCode>(code)), cnt);
+    }
+    printf("\n");
+
+    if (repeat <= 0) return 0;
+
+    uint32_t received = 0;
+    std::chrono::steady_clock::duration elapsed{};
+
+    for (long n = 0; n < repeat; ++n) {
+        Replay replay(pass, tz, false);
+        replay.run(frames);
+        received += replay.received;
+        elapsed += replay.elapsed;
+    }
+
+    double us = std::chrono::duration<double, std::micro>(elapsed).count();
+    printf("decoded %u frames in %.0f us, %.2f us per frame\n", received, us,
+           received ? us / received : 0.0);
+
+    return 0;
+}
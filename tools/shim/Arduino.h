@@ -0,0 +1,89 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+// Just enough of the Arduino core for the firmware code to build on the host.
+// Time is whatever the host program sets, see shim_set_time()
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <algorithm>
+#include <functional>
+
+typedef uint8_t byte;
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+unsigned long millis();
+unsigned long micros();
+
+/// sets the clock seen by millis(), micros() and now()
+void shim_set_time(time_t secs, uint32_t ms);
+
+/// 0 to max - 1, repeatable between runs
+long random(long max);
+
+class String {
+public:
+    String() = default;
+    String(const char *c) : s(c ? c : "") {}
+
+    bool concat(const char *c, unsigned len) {
+        s.append(c, len);
+        return true;
+    }
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned length() const { return s.size(); }
+
+protected:
+    std::string s;
+};
+
+/// debug log output goes to stdout
+class HardwareSerial {
+public:
+    int availableForWrite() { return 128; }
+    size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+    size_t write(const uint8_t *p, size_t len) {
+        return fwrite(p, 1, len, stdout);
+    }
+    size_t write(const char *p, size_t len) {
+        return fwrite(p, 1, len, stdout);
+    }
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    void restart() {}
+    uint32_t getCycleCount() { return micros() * 80; }
+};
+
+extern EspClass ESP;
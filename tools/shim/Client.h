@@ -0,0 +1,66 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+// The core's Print/Stream/Client hierarchy, reduced to the virtuals the
+// network clients implement
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+class Print {
+public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) = 0;
+
+    size_t write(const char *buf, size_t size) {
+        return write(reinterpret_cast<const uint8_t *>(buf), size);
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read()      = 0;
+    virtual int peek()      = 0;
+
+    void setTimeout(unsigned long ms) { timeout = ms; }
+
+protected:
+    unsigned long timeout = 1000;
+};
+
+class Client : public Stream {
+public:
+    using Print::write;
+
+    virtual int connect(IPAddress ip, uint16_t port)       = 0;
+    virtual int connect(const char *host, uint16_t port)   = 0;
+    virtual size_t write(uint8_t)                          = 0;
+    virtual size_t write(const uint8_t *buf, size_t size)  = 0;
+    virtual int available()                                = 0;
+    virtual int read()                                     = 0;
+    virtual int read(uint8_t *buf, size_t size)            = 0;
+    virtual int peek()                                     = 0;
+    virtual void flush()                                   = 0;
+    virtual void stop()                                    = 0;
+    virtual uint8_t connected()                            = 0;
+    virtual operator bool()                                = 0;
+};
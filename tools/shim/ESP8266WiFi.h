@@ -0,0 +1,40 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <WiFiClient.h>
+
+enum { WL_IDLE_STATUS = 0, WL_CONNECTED = 3, WL_DISCONNECTED = 6 };
+
+/// station state and name resolution, set up by the host program
+struct WiFiClass {
+    int status() { return wl_status; }
+
+    int hostByName(const char *, IPAddress &ip, uint32_t = 0) {
+        if (!resolves) return 0;
+        ip = resolved;
+        return 1;
+    }
+
+    int wl_status = WL_CONNECTED;
+    bool resolves = true;
+    IPAddress resolved{0x0100000A}; // 10.0.0.1
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,43 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class IPAddress {
+public:
+    IPAddress(uint32_t addr = 0) : addr(addr) {}
+
+    /// dotted quad only, no names
+    bool fromString(const char *s) {
+        unsigned a, b, c, d;
+        char tail;
+        if (sscanf(s, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4
+            || a > 255 || b > 255 || c > 255 || d > 255)
+            return false;
+
+        addr = a | b << 8 | c << 16 | d << 24;
+        return true;
+    }
+
+    operator uint32_t() const { return addr; }
+
+protected:
+    uint32_t addr;
+};
@@ -0,0 +1,148 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+// Stand-in for PubSubClient. connect() follows the library: it opens the
+// TCP connection unless it is up already, sends CONNECT and then waits for
+// the CONNACK. The host clock does not run on its own, so a wait that would
+// block times out at once and is counted in `blocked`. Publishes are recorded
+// in `published` by topic, with `rejecting` set they fail as a full send
+// buffer would
+
+#include <functional>
+#include <vector>
+
+#include <Client.h>
+
+#define MQTT_KEEPALIVE 15
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST    -3
+#define MQTT_DISCONNECTED       -1
+#define MQTT_CONNECTED           0
+
+#define MQTT_CALLBACK_SIGNATURE \
+    std::function<void(char *, uint8_t *, unsigned int)> callback
+
+class PubSubClient {
+public:
+    explicit PubSubClient(Client &client) : client(client) {}
+
+    PubSubClient &setServer(IPAddress ip, uint16_t port) {
+        this->ip   = ip;
+        this->port = port;
+        return *this;
+    }
+
+    PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) {
+        this->callback = callback;
+        return *this;
+    }
+
+    PubSubClient &setSocketTimeout(uint16_t) { return *this; }
+
+    bool connect(const char *id, const char *user, const char *pass) {
+        if (connected()) return true;
+
+        if (!client.connected() && !client.connect(ip, port)) {
+            _state = MQTT_DISCONNECTED;
+            return false;
+        }
+
+        std::string pkt;
+        put_str(pkt, "MQTT");
+        pkt += '\x04';
+        pkt += static_cast<char>(0x02 | (user ? 0xC0 : 0));
+        pkt += '\0';
+        pkt += static_cast<char>(MQTT_KEEPALIVE);
+        put_str(pkt, id);
+        if (user) {
+            put_str(pkt, user);
+            put_str(pkt, pass);
+        }
+        pkt.insert(0, 1, static_cast<char>(pkt.size()));
+        pkt.insert(0, 1, '\x10');
+        client.write(pkt.data(), pkt.size());
+
+        if (client.available() < 4) {
+            ++blocked;
+            _state = MQTT_CONNECTION_TIMEOUT;
+            client.stop();
+            return false;
+        }
+
+        uint8_t ack[4];
+        client.read(ack, sizeof(ack));
+        if (ack[0] != 0x20 || ack[3] != 0) {
+            _state = ack[3];
+            client.stop();
+            return false;
+        }
+
+        _state = MQTT_CONNECTED;
+        return true;
+    }
+
+    bool connected() {
+        if (client.connected()) return _state == MQTT_CONNECTED;
+        if (_state == MQTT_CONNECTED) _state = MQTT_CONNECTION_LOST;
+        return false;
+    }
+
+    bool loop() { return connected(); }
+
+    bool subscribe(const char *topic) {
+        if (!connected()) return false;
+        subscribed = topic;
+        return true;
+    }
+
+    bool publish(const char *topic, const uint8_t *, unsigned int, bool) {
+        if (!connected() || rejecting) return false;
+        published.push_back(topic);
+        return true;
+    }
+
+    void disconnect() {
+        _state = MQTT_DISCONNECTED;
+        client.stop();
+    }
+
+    int state() const { return _state; }
+
+    // connect() waits that would have blocked
+    unsigned blocked = 0;
+    std::string subscribed;
+    bool rejecting = false;
+    std::vector<std::string> published;
+
+protected:
+    static void put_str(std::string &pkt, const char *s) {
+        size_t len = strlen(s);
+        pkt += static_cast<char>(len >> 8);
+        pkt += static_cast<char>(len & 0xFF);
+        pkt.append(s, len);
+    }
+
+    Client &client;
+    IPAddress ip;
+    uint16_t port = 0;
+    MQTT_CALLBACK_SIGNATURE;
+    int _state = MQTT_DISCONNECTED;
+};
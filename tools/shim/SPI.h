@@ -0,0 +1,42 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+// Lets rfm12b.h build on the host. Nothing is wired, reads return 0
+
+#include <Arduino.h>
+
+#define MSBFIRST  1
+#define SPI_MODE0 0
+
+class SPISettings {
+public:
+    SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass {
+public:
+    void begin() {}
+    void beginTransaction(const SPISettings &) {}
+    void endTransaction() {}
+    uint8_t transfer(uint8_t) { return 0; }
+    uint16_t transfer16(uint16_t) { return 0; }
+};
+
+extern SPIClass SPI;
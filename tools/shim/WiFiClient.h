@@ -0,0 +1,77 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#pragma once
+
+// TCP client without a network. The host program plays the peer: it reads
+// what was written from `sent` and queues the peer's bytes in `incoming`
+
+#include <Client.h>
+
+class WiFiClient : public Client {
+public:
+    using Print::write;
+
+    int connect(IPAddress, uint16_t) override {
+        ++connects;
+        open = accept;
+        return open;
+    }
+
+    int connect(const char *, uint16_t) override {
+        return connect(IPAddress(), 0);
+    }
+
+    size_t write(uint8_t b) override { return write(&b, 1); }
+
+    size_t write(const uint8_t *buf, size_t size) override {
+        if (!open) return 0;
+        sent.append(reinterpret_cast<const char *>(buf), size);
+        return size;
+    }
+
+    int available() override { return open ? incoming.size() : 0; }
+
+    int read() override {
+        uint8_t b;
+        return read(&b, 1) == 1 ? b : -1;
+    }
+
+    int read(uint8_t *buf, size_t size) override {
+        size_t n = std::min(size, incoming.size());
+        memcpy(buf, incoming.data(), n);
+        incoming.erase(0, n);
+        return n;
+    }
+
+    int peek() override {
+        return incoming.empty() ? -1 : static_cast<uint8_t>(incoming[0]);
+    }
+
+    void flush() override {}
+    void stop() override { open = false; }
+    uint8_t connected() override { return open; }
+    operator bool() override { return open; }
+
+    // the peer's side
+    bool accept = true;    // connect() succeeds
+    bool open   = false;   // connection is up
+    unsigned connects = 0; // connect() calls
+    std::string sent;      // written by us
+    std::string incoming;  // to be read by us
+};
@@ -0,0 +1,61 @@
+/*
+ * HR20 ESP Master - host build shims
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http:*www.gnu.org/licenses
+ *
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <SPI.h>
+#include <TimeLib.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+SPIClass SPI;
+WiFiClass WiFi;
+
+namespace {
+
+time_t   cur_secs = 0;
+uint32_t cur_ms   = 0;
+
+struct tm split(time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return tm;
+}
+
+} // namespace
+
+void shim_set_time(time_t secs, uint32_t ms) {
+    cur_secs = secs;
+    cur_ms   = ms;
+}
+
+unsigned long millis() { return cur_ms; }
+unsigned long micros() { return cur_ms * 1000UL; }
+
+long random(long max) { return max > 0 ? rand() % max : 0; }
+
+time_t now() { return cur_secs; }
+void setTime(int, int, int, int, int, int) {}
+
+int year(time_t t)      { return split(t).tm_year + 1900; }
+int month(time_t t)     { return split(t).tm_mon + 1; }
+int day(time_t t)       { return split(t).tm_mday; }
+int hour(time_t t)      { return split(t).tm_hour; }
+int minute(time_t t)    { return split(t).tm_min; }
+int second(time_t t)    { return split(t).tm_sec; }
+int dayOfWeek(time_t t) { return split(t).tm_wday + 1; }